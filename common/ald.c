@@ -20,190 +20,718 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#ifdef _POSIX_MAPPED_FILES
-#include <sys/mman.h>
-#endif
-#ifndef _O_BINARY
-#define _O_BINARY 0
-#endif
 
 #define ALD_SIGNATURE  0x14c4e
 #define ALD_SIGNATURE2 0x12020
 
-static void write_ptr(int size, int *sector, FILE *fp) {
-	*sector += (size + 0xff) >> 8;
-	fputc(*sector & 0xff, fp);
-	fputc(*sector >> 8 & 0xff, fp);
-	fputc(*sector >> 16 & 0xff, fp);
-}
+#ifndef _O_BINARY
+#define _O_BINARY 0
+#endif
 
-static void pad(FILE *fp) {
-	// Align to next sector boundary
-	long pos = ftell(fp);
-	for (; pos & 0xff; pos++)
-		fputc(0, fp);
-}
+#ifdef _WIN32
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#else
+#include <limits.h>
+#include <sys/uio.h>
+#ifndef IOV_MAX  // glibc defines it only with _XOPEN_SOURCE or _GNU_SOURCE
+#define IOV_MAX 1024
+#endif
+#endif
+
+// Things shared by all volumes of an archive.
+typedef struct {
+	Vector *entries;
+	int ptr_count[256];  // number of entries in each volume
+	uint8_t *link_table;
+	int link_table_size;
+	bool *dup;  // entries stored by an earlier identical entry, or NULL
+	bool raw;  // entry data begin with their own headers, which are kept as is
+	char **paths;
+} AldLayout;
 
 static int entry_header_size(AldEntry *e) {
 	int namelen = strlen(e->name) + 1;  // length including null terminator
 	return (namelen + 31) & ~0xf;
 }
 
-static void write_entry(AldEntry *entry, FILE *fp) {
-	uint64_t wtime = time_t_to_win_filetime(entry->timestamp);
-	int hdrlen = entry_header_size(entry);
-	fputdw(hdrlen, fp);
-	fputdw(entry->size, fp);
-	fput64(wtime, fp);
-	fputs(entry->name, fp);
-	for (int i = 16 + strlen(entry->name); i < hdrlen; i++)
-		fputc(0, fp);
-	fwrite(entry->data, entry->size, 1, fp);
+// Number of bytes the entry occupies in a volume, without padding.
+static int stored_size(AldLayout *layout, AldEntry *e) {
+	return layout->raw ? e->size : entry_header_size(e) + e->size;
 }
 
-void ald_write(Vector *entries, int volume, FILE *fp) {
-	int sector = 0;
+static bool same_contents(const AldEntry *a, const AldEntry *b) {
+	if (!a->data && !b->data && !strcmp(a->path, b->path))
+		return true;
+	size_t size_a = a->size, size_b = b->size;
+	const uint8_t *data_a = a->data ? a->data : map_file(a->path, &size_a);
+	const uint8_t *data_b = b->data ? b->data : map_file(b->path, &size_b);
+	bool same = size_a == a->size && size_b == b->size && !memcmp(data_a, data_b, a->size);
+	if (!a->data)
+		unmap_file(data_a, size_a);
+	if (!b->data)
+		unmap_file(data_b, size_b);
+	return same;
+}
+
+// Only entries with identical headers can share a sector, so the contents are
+// compared only when the headers match.
+static uint32_t hash_entry_header(const void *key) {
+	const AldEntry *e = key;
+	return hash_bytes(e->name, strlen(e->name)) ^ e->volume ^ (uint32_t)e->size * 0x9e3779b1u ^ (uint32_t)e->timestamp * 0x85ebca6bu;
+}
+
+static int compare_entries(const void *k1, const void *k2) {
+	const AldEntry *a = k1, *b = k2;
+	if (a->volume != b->volume || a->size != b->size || a->timestamp != b->timestamp || strcmp(a->name, b->name))
+		return 1;
+	return !same_contents(a, b);
+}
 
-	int ptr_count = 0;
+// Returns the number of bytes saved by deduplication.
+static int64_t ald_layout(AldLayout *layout, Vector *entries, bool dedup) {
+	memset(layout, 0, sizeof(AldLayout));
+	layout->entries = entries;
+	layout->link_table_size = entries->len * 3;
+	layout->link_table = malloc(layout->link_table_size + 1);
+	HashMap *stored = NULL;
+	if (dedup) {
+		layout->dup = calloc(entries->len + 1, sizeof(bool));
+		stored = new_hash(hash_entry_header, compare_entries);
+	}
+	int64_t saved = 0;
+	uint8_t *p = layout->link_table;
 	for (int i = 0; i < entries->len; i++) {
 		AldEntry *entry = entries->data[i];
-		if (entry && entry->volume == volume)
-			ptr_count++;
+		int vol = entry ? entry->volume : 0;
+		int link = 0;
+		if (vol && stored) {
+			int j = (intptr_t)hash_get(stored, entry) - 1;
+			if (j >= 0) {
+				layout->dup[i] = true;
+				link = layout->link_table[j * 3 + 1] | layout->link_table[j * 3 + 2] << 8;
+				saved += (entry_header_size(entry) + entry->size + 0xff) & ~0xff;
+			} else {
+				hash_put(stored, entry, (void *)(intptr_t)(i + 1));
+			}
+		}
+		if (vol && !link)
+			link = ++layout->ptr_count[vol];
+		*p++ = vol;
+		*p++ = link & 0xff;
+		*p++ = link >> 8 & 0xff;
 	}
+	if (stored)
+		free_hash(stored);
+	return saved;
+}
 
-	write_ptr((ptr_count + 2) * 3, &sector, fp);
-	write_ptr(entries->len * 3, &sector, fp);
-	for (int i = 0; i < entries->len; i++) {
-		AldEntry *entry = entries->data[i];
-		if (entry && entry->volume == volume)
-			write_ptr(entry_header_size(entry) + entry->size, &sector, fp);
+static void write_ptr(int size, int *sector, ByteWriter *w) {
+	*sector += (size + 0xff) >> 8;
+	bw_u8(w, *sector & 0xff);
+	bw_u8(w, *sector >> 8 & 0xff);
+	bw_u8(w, *sector >> 16 & 0xff);
+}
+
+static void write_entry_header(AldEntry *entry, ByteWriter *w) {
+	int hdrlen = entry_header_size(entry);
+	bw_u32(w, hdrlen);
+	bw_u32(w, entry->size);
+	bw_u64(w, time_t_to_win_filetime(entry->timestamp));
+	int namelen = strlen(entry->name);
+	bw_bytes(w, entry->name, namelen);
+	bw_zeros(w, hdrlen - 16 - namelen);
+}
+
+static void write_iov(int fd, struct iovec *iov, int n) {
+#ifdef _WIN32
+	for (int i = 0; i < n; i++)
+		write_fd(fd, iov[i].iov_base, iov[i].iov_len, -1, 0);
+#else
+	while (n > 0) {
+		ssize_t written = writev(fd, iov, n < IOV_MAX ? n : IOV_MAX);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			error("write error: %s", strerror(errno));
+		}
+		// Skip the vectors that were written, and resume a partial one.
+		while (n > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
 	}
-	pad(fp);
+#endif
+}
+
+// Streams the contents of a file-backed entry to fd.
+static void copy_entry_file(int fd, AldEntry *entry) {
+	int src_fd = checked_open(entry->path, O_RDONLY | _O_BINARY);
+	struct stat sbuf;
+	if (fstat(src_fd, &sbuf) < 0)
+		error("%s: %s", entry->path, strerror(errno));
+	if (sbuf.st_size != entry->size)
+		error("%s: file size changed", entry->path);
+	copy_fd(fd, src_fd, entry->size);
+	close(src_fd);
+}
+
+// Headers, tables and padding are assembled in memory, and the entry data are
+// written from their own buffers in between. File-backed entries are copied
+// one at a time, so memory use does not depend on the size of the volume.
+static void write_volume(AldLayout *layout, int volume, FILE *fp) {
+	Vector *entries = layout->entries;
+	int ptr_count = layout->ptr_count[volume];
+	ByteWriter *w = new_byte_writer(NULL);
+	int sector = 0;
 
-	uint16_t link[256];
-	memset(link, 0, sizeof(link));
+	write_ptr((ptr_count + 2) * 3, &sector, w);
+	write_ptr(layout->link_table_size, &sector, w);
 	for (int i = 0; i < entries->len; i++) {
 		AldEntry *entry = entries->data[i];
-		int vol = entry ? entry->volume : 0;
-		fputc(vol, fp);
-		if (vol)
-			link[vol]++;
-		fputc(link[vol] & 0xff, fp);
-		fputc(link[vol] >> 8, fp);
+		if (entry && entry->volume == volume && !(layout->dup && layout->dup[i]))
+			write_ptr(stored_size(layout, entry), &sector, w);
 	}
-	pad(fp);
+	bw_align(w, 256);
+
+	bw_bytes(w, layout->link_table, layout->link_table_size);
+	bw_align(w, 256);
 
+	// The i-th entry's data goes between w->buf[cut[i-1]] and w->buf[cut[i]].
+	size_t *cut = malloc((ptr_count + 1) * sizeof(size_t));
+	AldEntry **payload = malloc((ptr_count + 1) * sizeof(AldEntry *));
+	int k = 0;
 	for (int i = 0; i < entries->len; i++) {
 		AldEntry *entry = entries->data[i];
-		if (!entry || entry->volume != volume)
+		if (!entry || entry->volume != volume || (layout->dup && layout->dup[i]))
 			continue;
-		write_entry(entry, fp);
-		pad(fp);
+		if (!layout->raw)
+			write_entry_header(entry, w);
+		cut[k] = w->len;
+		payload[k++] = entry;
+		bw_zeros(w, -stored_size(layout, entry) & 0xff);
 	}
 
 	// Footer
-	fputdw(ALD_SIGNATURE, fp);
-	fputdw(0x10, fp);
-	fputdw(ptr_count << 8 | volume, fp);
-	fputdw(0, fp);
+	bw_u32(w, ALD_SIGNATURE);
+	bw_u32(w, 0x10);
+	bw_u32(w, ptr_count << 8 | volume);
+	bw_u32(w, 0);
+
+	if (fflush(fp) != 0)
+		error("write error: %s", strerror(errno));
+	int fd = fileno(fp);
+	struct iovec *iov = malloc((2 * k + 1) * sizeof(struct iovec));
+	int n = 0;
+	size_t start = 0;
+	for (int i = 0; i < k; i++) {
+		iov[n++] = (struct iovec){ w->buf + start, cut[i] - start };
+		start = cut[i];
+		if (payload[i]->data) {
+			iov[n++] = (struct iovec){ (void *)payload[i]->data, payload[i]->size };
+		} else {
+			write_iov(fd, iov, n);
+			n = 0;
+			copy_entry_file(fd, payload[i]);
+		}
+	}
+	iov[n++] = (struct iovec){ w->buf + start, w->len - start };
+	write_iov(fd, iov, n);
+
+	free(iov);
+	free(payload);
+	free(cut);
+	free_byte_writer(w);
 }
 
-static inline uint8_t *ald_sector(uint8_t *ald, int size, int index) {
-	uint8_t *p = ald + index * 3;
-	int offset = p[0] << 8 | p[1] << 16 | p[2] << 24;
-	if (offset + 256 > size)
-		error("sector offset out of range: %d", offset);
-	return ald + offset;
+void ald_write(Vector *entries, int volume, FILE *fp) {
+	AldLayout layout;
+	ald_layout(&layout, entries, false);
+	write_volume(&layout, volume, fp);
+	free(layout.link_table);
 }
 
-static int count_entries_for_volume(int volume, uint8_t *data, int size) {
-	uint8_t *link_sector = ald_sector(data, size, 0);
-	uint8_t *link_sector_end = ald_sector(data, size, 1);
+static void write_volume_file(void *data, int volume) {
+	AldLayout *layout = data;
+	if (!layout->paths[volume])
+		return;
+	FILE *fp = checked_fopen(layout->paths[volume], "wb");
+	write_volume(layout, volume, fp);
+	if (fclose(fp) != 0)
+		error("%s: %s", layout->paths[volume], strerror(errno));
+}
 
-	int count = 0;
-	for (uint8_t *link = link_sector; link < link_sector_end; link += 3) {
-		uint8_t vol_nr = link[0];
-		if (vol_nr == volume)
-			count++;
-	}
-	return count;
+int64_t ald_write_volumes(Vector *entries, char *paths[ALD_MAX_VOLUMES + 1], int jobs, bool dedup) {
+	AldLayout layout;
+	int64_t saved = ald_layout(&layout, entries, dedup);
+	layout.paths = paths;
+	parallel_for(ALD_MAX_VOLUMES + 1, jobs, write_volume_file, &layout);
+	free(layout.link_table);
+	free(layout.dup);
+	return saved;
 }
 
-static void ald_read_entries(Vector *entries, int volume, uint8_t *data, int size) {
-	uint8_t *link_sector = ald_sector(data, size, 0);
-	uint8_t *link_sector_end = ald_sector(data, size, 1);
+typedef struct {
+	char *path;
+	const uint8_t *data;  // mapped when an entry is first requested
+	size_t size;
+	int fd;  // valid while data is mapped
+	AldEntry *views;  // one block for all links to this volume, allocated with the mapping
+	int nr_views;
+	int max_views;
+} AldVolume;
 
-	for (uint8_t *link = link_sector; link < link_sector_end; link += 3) {
-		uint8_t vol_nr = link[0];
-		uint16_t ptr_nr = link[1] | link[2] << 8;
-		if (vol_nr != volume)
-			continue;
-		uint8_t *entry_ptr = ald_sector(data, size, ptr_nr);
-		AldEntry *e = calloc(1, sizeof(AldEntry));
-		e->volume = volume;
-		e->name = (char *)entry_ptr + 16;
-		e->timestamp = win_filetime_to_time_t(le64(entry_ptr + 8));
-		e->data = entry_ptr + le32(entry_ptr);
-		e->size = le32(entry_ptr + 4);
-		if (e->data + e->size > data + size)
-			error("entry size exceeds end of ald file");
-		vec_set(entries, (link - link_sector) / 3, e);
-	}
+typedef struct {
+	uint8_t volume;  // 0 if the entry does not exist
+	uint16_t ptr;    // index in the volume's pointer table
+} AldLink;
+
+struct AldArchive {
+	AldVolume volumes[256];
+	AldLink *links;
+	AldEntry **views;  // created on demand, pointing into AldVolume.views
+	int nr_links;
+	HashMap *name_index;  // folded name -> index + 1, built on demand
+	pthread_mutex_t lock;
+};
+
+static inline const uint8_t *ald_sector(const uint8_t *ald, size_t size, int index) {
+	if ((size_t)index * 3 + 3 > size)
+		error("sector index out of range: %d", index);
+	const uint8_t *p = ald + index * 3;
+	uint32_t offset = p[0] << 8 | p[1] << 16 | (uint32_t)p[2] << 24;
+	if (offset + 256 > size)
+		error("sector offset out of range: %u", offset);
+	return ald + offset;
 }
 
-Vector *ald_read(Vector *entries, const char *path) {
-	if (!entries)
-		entries = new_vec();
+AldArchive *new_ald_archive(void) {
+	AldArchive *ar = calloc(1, sizeof(AldArchive));
+	pthread_mutex_init(&ar->lock, NULL);
+	return ar;
+}
 
-	int fd = checked_open(path, O_RDONLY | _O_BINARY);
+static bool read_at(FILE *fp, long offset, void *buf, size_t n) {
+	return fseek(fp, offset, offset < 0 ? SEEK_END : SEEK_SET) == 0 && fread(buf, n, 1, fp) == 1;
+}
 
-	struct stat sbuf;
-	if (fstat(fd, &sbuf) < 0)
-		error("%s: %s", path, strerror(errno));
+static void drop_name_index(AldArchive *ar) {
+	if (!ar->name_index)
+		return;
+	for (HashItem *i = hash_iterate(ar->name_index, NULL); i; i = hash_iterate(ar->name_index, i))
+		free((void *)i->key);
+	free_hash(ar->name_index);
+	ar->name_index = NULL;
+}
 
-#ifdef _POSIX_MAPPED_FILES
-	uint8_t *p = mmap(NULL, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
-	if (p == MAP_FAILED)
+// Reads only the footer and the link table; the volume is mapped later.
+bool ald_add_volume(AldArchive *ar, const char *path) {
+	ustat st;
+	if (stat_utf8(path, &st) != 0)
 		error("%s: %s", path, strerror(errno));
-#else
-	uint8_t *p = malloc(sbuf.st_size);
-	if (!p)
-		error("cannot read %s: out of memory", path);
-	size_t bytes = 0;
-	while (bytes < sbuf.st_size) {
-		ssize_t ret = read(fd, p + bytes, sbuf.st_size - bytes);
-		if (ret <= 0)
-			error("%s: %s", path, strerror(errno));
-		bytes += ret;
-	}
-#endif
-	close(fd);
-
-	if ((sbuf.st_size & 0xff) != 16) {
+	size_t size = st.st_size;
+	if ((size & 0xff) != 16) {
 		fprintf(stderr, "%s: unexpected file size (not an ALD file?)\n", path);
-		return entries;
+		return false;
 	}
-	uint8_t *footer = p + sbuf.st_size - 16;
+
+	FILE *fp = checked_fopen(path, "rb");
+	uint8_t footer[16], hdr[6];
+	if (!read_at(fp, -16, footer, 16) || !read_at(fp, 0, hdr, 6))
+		error("%s: %s", path, strerror(errno));
 	if (le32(footer) != ALD_SIGNATURE && le32(footer) != ALD_SIGNATURE2) {
 		fprintf(stderr, "%s: invalid signature (not an ALD file?)\n", path);
-		return entries;
+		fclose(fp);
+		return false;
 	}
+	uint32_t link_begin = hdr[0] << 8 | hdr[1] << 16 | (uint32_t)hdr[2] << 24;
+	uint32_t link_end = hdr[3] << 8 | hdr[4] << 16 | (uint32_t)hdr[5] << 24;
+	if (link_begin + 256 > size || link_end + 256 > size || link_end < link_begin)
+		error("%s: link table out of range", path);
+	int nr_links = (link_end - link_begin) / 3;
+	uint8_t *links = malloc(nr_links * 3 + 1);
+	if (nr_links && !read_at(fp, link_begin, links, nr_links * 3))
+		error("%s: %s", path, strerror(errno));
+	fclose(fp);
+
+	// Links to the same entry share a pointer (see ald_write_volumes()), so the
+	// largest pointer is the number of entries.
+	int max_ptrs[256] = {0};
+	for (int i = 0; i < nr_links; i++) {
+		int ptr = links[i * 3 + 1] | links[i * 3 + 2] << 8;
+		if (ptr > max_ptrs[links[i * 3]])
+			max_ptrs[links[i * 3]] = ptr;
+	}
+
 	int volume = footer[8];
 	int num_entries = footer[9] | footer[10] << 8;
 	// Some ALDs created with unofficial tools have incorrect volume id in footer.
-	if (count_entries_for_volume(volume, p, sbuf.st_size) != num_entries) {
+	if (max_ptrs[volume] != num_entries) {
 		fprintf(stderr, "Warning: %s has wrong volume id (%d) in footer\n", path, volume);
 		// Determine volume id from the filename.
 		volume = tolower(path[strlen(path) - 5]) - 'a' + 1;
-		if (count_entries_for_volume(volume, p, sbuf.st_size) != num_entries)
+		if (volume < 1 || volume > 255 || max_ptrs[volume] != num_entries)
 			error("cannot determine volume id");
 	}
+	if (ar->volumes[volume].path) {
+		fprintf(stderr, "Warning: %s: volume %d is already opened, ignored\n", path, volume);
+		free(links);
+		return false;
+	}
+	ar->volumes[volume].path = strdup(path);
+	for (int i = 0; i < nr_links; i++) {
+		if (links[i * 3] == volume)
+			ar->volumes[volume].max_views++;
+	}
+	drop_name_index(ar);
+
+	// Slots after the last entry of this volume, including the padding to a
+	// sector boundary, are not counted.
+	while (nr_links > 0 && links[(nr_links - 1) * 3] != volume)
+		nr_links--;
+	if (nr_links > ar->nr_links) {
+		ar->links = realloc(ar->links, nr_links * sizeof(AldLink));
+		ar->views = realloc(ar->views, nr_links * sizeof(AldEntry *));
+		memset(ar->links + ar->nr_links, 0, (nr_links - ar->nr_links) * sizeof(AldLink));
+		memset(ar->views + ar->nr_links, 0, (nr_links - ar->nr_links) * sizeof(AldEntry *));
+		ar->nr_links = nr_links;
+	}
+	for (int i = 0; i < nr_links; i++) {
+		if (links[i * 3] == volume)
+			ar->links[i] = (AldLink){ volume, links[i * 3 + 1] | links[i * 3 + 2] << 8 };
+	}
+	free(links);
+	return true;
+}
+
+int ald_count(AldArchive *ar) {
+	return ar->nr_links;
+}
+
+static AldEntry *create_view(AldArchive *ar, AldLink link) {
+	AldVolume *vol = &ar->volumes[link.volume];
+	if (!vol->data) {
+		vol->data = map_file_fd(vol->path, &vol->size, &vol->fd);
+		vol->views = calloc(vol->max_views, sizeof(AldEntry));
+	}
+	const uint8_t *entry_ptr = ald_sector(vol->data, vol->size, link.ptr);
+	// Each link gets at most one view, so the block does not overflow.
+	AldEntry *e = &vol->views[vol->nr_views++];
+	e->volume = link.volume;
+	e->name = (const char *)entry_ptr + 16;
+	e->timestamp = win_filetime_to_time_t(le64(entry_ptr + 8));
+	e->data = entry_ptr + le32(entry_ptr);
+	e->size = le32(entry_ptr + 4);
+	if (e->data + e->size > vol->data + vol->size)
+		error("entry size exceeds end of ald file");
+	return e;
+}
+
+AldEntry *ald_get(AldArchive *ar, int index) {
+	if (index < 0 || index >= ar->nr_links || !ar->links[index].volume)
+		return NULL;
+	pthread_mutex_lock(&ar->lock);
+	if (!ar->views[index])
+		ar->views[index] = create_view(ar, ar->links[index]);
+	AldEntry *e = ar->views[index];
+	pthread_mutex_unlock(&ar->lock);
+	return e;
+}
+
+int ald_entry_fd(AldArchive *ar, const AldEntry *e, int64_t *offset) {
+	AldVolume *vol = &ar->volumes[e->volume];
+	*offset = e->data - vol->data;
+	return vol->fd;
+}
+
+// Lowercases ASCII letters and replaces 2-byte characters that have more than
+// one code with their canonical codes, so that names that look the same in
+// UTF-8 compare equal.
+static char *fold_name(const char *name) {
+	char *folded = strdup(name);
+	for (uint8_t *p = (uint8_t *)folded; *p; p++) {
+		if (is_sjis_byte1(p[0]) && p[1]) {
+			if (is_valid_sjis(p[0], p[1]) && !is_unicode_safe(p[0], p[1])) {
+				uint16_t c = canonical_sjis(p[0], p[1]);
+				p[0] = c >> 8;
+				p[1] = c & 0xff;
+			}
+			p++;
+		} else if ('A' <= *p && *p <= 'Z') {
+			*p += 'a' - 'A';
+		}
+	}
+	return folded;
+}
+
+int ald_find(AldArchive *ar, const char *sjis_name) {
+	pthread_mutex_lock(&ar->lock);
+	if (!ar->name_index) {
+		ar->name_index = new_string_hash();
+		hash_reserve(ar->name_index, ar->nr_links);
+		for (int i = 0; i < ar->nr_links; i++) {
+			if (!ar->links[i].volume)
+				continue;
+			if (!ar->views[i])
+				ar->views[i] = create_view(ar, ar->links[i]);
+			char *key = fold_name(ar->views[i]->name);
+			if (hash_get(ar->name_index, key))
+				free(key);
+			else
+				hash_put(ar->name_index, key, (void *)(intptr_t)(i + 1));
+		}
+	}
+	char *key = fold_name(sjis_name);
+	int index = (intptr_t)hash_get(ar->name_index, key) - 1;
+	free(key);
+	pthread_mutex_unlock(&ar->lock);
+	return index;
+}
 
-	ald_read_entries(entries, volume, p, sbuf.st_size);
+void ald_close(AldArchive *ar) {
+	drop_name_index(ar);
+	for (int i = 0; i < 256; i++) {
+		AldVolume *vol = &ar->volumes[i];
+		if (vol->data) {
+			unmap_file(vol->data, vol->size);
+			close(vol->fd);
+		}
+		free(vol->views);
+		free(vol->path);
+	}
+	free(ar->views);
+	free(ar->links);
+	pthread_mutex_destroy(&ar->lock);
+	free(ar);
+}
 
+Vector *ald_read(Vector *entries, const char *path) {
+	if (!entries)
+		entries = new_vec();
+
+	// The archive is never closed, because the entries point into it.
+	AldArchive *ar = new_ald_archive();
+	if (!ald_add_volume(ar, path))
+		return entries;
+	for (int i = 0; i < ald_count(ar); i++) {
+		AldEntry *e = ald_get(ar, i);
+		if (e)
+			vec_set(entries, i, e);
+	}
 	return entries;
 }
+
+static bool write_at(FILE *fp, long offset, const void *buf, size_t n) {
+	return fseek(fp, offset, SEEK_SET) == 0 && (n == 0 || fwrite(buf, n, 1, fp) == 1);
+}
+
+static inline uint32_t get_ptr(const uint8_t *p) {
+	return p[0] | p[1] << 8 | p[2] << 16;
+}
+
+static inline void put_ptr(uint8_t *p, uint32_t sector) {
+	p[0] = sector & 0xff;
+	p[1] = sector >> 8 & 0xff;
+	p[2] = sector >> 16 & 0xff;
+}
+
+static int compare_sectors(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Writes the header, data and padding of `entry` at `sector`.
+static void write_entry_at(FILE *fp, uint32_t sector, AldEntry *entry, const char *path) {
+	static const uint8_t zeros[256];
+	size_t size = entry->size;
+	const uint8_t *data = entry->data;
+	if (!data) {
+		data = map_file(entry->path, &size);
+		if (size != entry->size)
+			error("%s: file size changed", entry->path);
+	}
+	ByteWriter *w = new_byte_writer(NULL);
+	write_entry_header(entry, w);
+	size_t padding = -(w->len + entry->size) & 0xff;
+	if (!write_at(fp, (long)sector << 8, w->buf, w->len) ||
+		(entry->size && fwrite(data, entry->size, 1, fp) != 1) ||
+		(padding && fwrite(zeros, padding, 1, fp) != 1))
+		error("%s: %s", path, strerror(errno));
+	free_byte_writer(w);
+	if (!entry->data)
+		unmap_file(data, size);
+}
+
+int ald_update(const char *path, Vector *entries) {
+	FILE *fp = checked_fopen(path, "r+b");
+	uint8_t footer[16];
+	if (fseek(fp, 0, SEEK_END) != 0)
+		error("%s: %s", path, strerror(errno));
+	long size = ftell(fp);
+	if ((size & 0xff) != 16 || !read_at(fp, -16, footer, 16) ||
+		(le32(footer) != ALD_SIGNATURE && le32(footer) != ALD_SIGNATURE2))
+		error("%s: not an ALD file", path);
+
+	// ptrs[0] is the link table, ptrs[1..nr_ptrs-2] are the entries, and
+	// ptrs[nr_ptrs-1] is the end of the last entry.
+	int nr_ptrs = (footer[9] | footer[10] << 8) + 2;
+	uint8_t *ptrs = malloc(nr_ptrs * 3);
+	if (!read_at(fp, 0, ptrs, nr_ptrs * 3))
+		error("%s: %s", path, strerror(errno));
+	uint32_t end = (size - 16) >> 8;  // where the footer begins
+
+	// An entry may use the sectors up to the next thing in the file.
+	uint32_t *sorted = malloc((nr_ptrs + 1) * sizeof(uint32_t));
+	for (int i = 0; i < nr_ptrs; i++)
+		sorted[i] = get_ptr(ptrs + i * 3);
+	sorted[nr_ptrs] = end;
+	qsort(sorted, nr_ptrs + 1, sizeof(uint32_t), compare_sectors);
+
+	HashMap *index = new_string_hash();
+	char **names = calloc(nr_ptrs, sizeof(char *));
+	for (int i = 1; i < nr_ptrs - 1; i++) {
+		uint32_t sector = get_ptr(ptrs + i * 3);
+		uint8_t hdr[16];
+		if (sector >= end || !read_at(fp, (long)sector << 8, hdr, 16))
+			error("%s: entry %d out of range", path, i);
+		uint32_t hdrlen = le32(hdr);
+		if (hdrlen < 16 || hdrlen > 512)
+			error("%s: entry %d has a broken header", path, i);
+		names[i] = calloc(hdrlen - 16 + 1, 1);
+		if (!read_at(fp, ((long)sector << 8) + 16, names[i], hdrlen - 16))
+			error("%s: %s", path, strerror(errno));
+		char *key = fold_name(names[i]);
+		if (hash_get(index, key))
+			free(key);
+		else
+			hash_put(index, key, (void *)(intptr_t)i);
+	}
+
+	int moved = 0;
+	bool *updated = calloc(nr_ptrs, sizeof(bool));
+	for (int i = 0; i < entries->len; i++) {
+		AldEntry *e = entries->data[i];
+		char *key = fold_name(e->name);
+		int k = (intptr_t)hash_get(index, key);
+		free(key);
+		if (!k)
+			error("%s: no entry named %s", path, sjis2utf(e->name));
+		if (updated[k])
+			error("%s: %s is given more than once", path, sjis2utf(e->name));
+		updated[k] = true;
+
+		// Keep the name as stored in the archive.
+		AldEntry entry = *e;
+		entry.name = names[k];
+		uint32_t sector = get_ptr(ptrs + k * 3);
+		uint32_t *next = bsearch(&sector, sorted, nr_ptrs + 1, sizeof(uint32_t), compare_sectors);
+		while (next < sorted + nr_ptrs && *next == sector)
+			next++;
+		uint32_t needed = (entry_header_size(&entry) + entry.size + 0xff) >> 8;
+		if (sector + needed <= *next) {
+			write_entry_at(fp, sector, &entry, path);
+			continue;
+		}
+
+		// Readers take the link table to end where the first entry begins, so
+		// the link table moves along with the first entry.
+		uint32_t link_sectors = 0;
+		uint8_t *link_table = NULL;
+		if (k == 1) {
+			link_sectors = sector - get_ptr(ptrs);
+			link_table = malloc(link_sectors << 8);
+			if (!read_at(fp, (long)get_ptr(ptrs) << 8, link_table, link_sectors << 8))
+				error("%s: %s", path, strerror(errno));
+		}
+
+		// The footer goes to the new end first, and the pointers are patched
+		// last, so the volume stays readable (with the old contents of the
+		// entry) if writing the entry fails.
+		uint32_t link_begin = end;
+		sector = end + link_sectors;
+		end = sector + needed;
+		if (end > 0xffffff)
+			error("%s: volume too large", path);
+		if (!write_at(fp, (long)end << 8, footer, 16) ||
+			(link_table && !write_at(fp, (long)link_begin << 8, link_table, link_sectors << 8)))
+			error("%s: %s", path, strerror(errno));
+		write_entry_at(fp, sector, &entry, path);
+		if (link_table) {
+			put_ptr(ptrs, link_begin);
+			free(link_table);
+		}
+		put_ptr(ptrs + k * 3, sector);
+		put_ptr(ptrs + (nr_ptrs - 1) * 3, end);
+		if (!write_at(fp, 0, ptrs, nr_ptrs * 3) || fflush(fp) != 0)
+			error("%s: %s", path, strerror(errno));
+		moved++;
+	}
+	if (fclose(fp) != 0)
+		error("%s: %s", path, strerror(errno));
+
+	for (HashItem *i = hash_iterate(index, NULL); i; i = hash_iterate(index, i))
+		free((void *)i->key);
+	free_hash(index);
+	for (int i = 0; i < nr_ptrs; i++)
+		free(names[i]);
+	free(names);
+	free(updated);
+	free(sorted);
+	free(ptrs);
+	return moved;
+}
+
+// The entries are written in the order of the pointer table. The link table
+// and the entry headers are copied as is, so timestamps keep their sub-second
+// parts.
+void ald_compact(const char *path) {
+	size_t size;
+	const uint8_t *data = map_file(path, &size);
+	if ((size & 0xff) != 16 || (le32(data + size - 16) != ALD_SIGNATURE && le32(data + size - 16) != ALD_SIGNATURE2))
+		error("%s: not an ALD file", path);
+	int volume = data[size - 8];
+	int nr_entries = data[size - 7] | data[size - 6] << 8;
+
+	AldLayout layout = { .entries = new_vec(), .raw = true };
+	layout.ptr_count[volume] = nr_entries;
+	layout.link_table = (uint8_t *)ald_sector(data, size, 0);
+	layout.link_table_size = ald_sector(data, size, 1) - layout.link_table;
+	for (int i = 1; i <= nr_entries; i++) {
+		const uint8_t *p = ald_sector(data, size, i);
+		AldEntry *e = calloc(1, sizeof(AldEntry));
+		e->volume = volume;
+		uint64_t n = (uint64_t)le32(p) + le32(p + 4);
+		if (n > (uint64_t)(data + size - p))
+			error("entry size exceeds end of ald file");
+		e->data = p;
+		e->size = n;
+		vec_push(layout.entries, e);
+	}
+
+	char *tmp_path = malloc(strlen(path) + 5);
+	sprintf(tmp_path, "%s.tmp", path);
+	FILE *fp = checked_fopen(tmp_path, "wb");
+	write_volume(&layout, volume, fp);
+	if (fclose(fp) != 0)
+		error("%s: %s", tmp_path, strerror(errno));
+	unmap_file(data, size);
+	checked_rename(tmp_path, path);
+
+	for (int i = 0; i < layout.entries->len; i++)
+		free(layout.entries->data[i]);
+	free(layout.entries->data);
+	free(layout.entries);
+	free(tmp_path);
+}
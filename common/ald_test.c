@@ -69,6 +69,39 @@ static void test_write(void) {
 	remove(outfile);
 }
 
+static void test_write_from_file(void) {
+	const char infile[] = "testdata/content.txt";
+	FILE *fp = checked_fopen(infile, "wb");
+	fputs("content", fp);
+	fclose(fp);
+
+	AldEntry e1 = {
+		.volume = 1,
+		.name = "a.txt",
+		.timestamp = TIMESTAMP,
+		.path = infile,
+		.size = 7,
+	};
+	AldEntry e2 = {
+		.volume = 1,
+		.name = "very_long_file_name.txt",
+		.timestamp = TIMESTAMP,
+		.data = (const uint8_t *)"ok",
+		.size = 2,
+	};
+	Vector *es = new_vec();
+	vec_push(es, &e1);
+	vec_push(es, NULL);
+	vec_push(es, &e2);
+	const char outfile[] = "testdata/actual.ald";
+	fp = checked_fopen(outfile, "wb");
+	ald_write(es, 1, fp);
+	fclose(fp);
+	assert(system("cmp testdata/expected.ald testdata/actual.ald") == 0);
+	remove(outfile);
+	remove(infile);
+}
+
 static void test_multivolume_read(void) {
 	Vector *es = new_vec();
 	ald_read(es, "testdata/expected_a.ald");
@@ -112,11 +145,205 @@ static void test_multivolume_write(void) {
 	assert(system("cmp testdata/expected_b.ald testdata/actual_b.ald") == 0);
 	remove(aldname[0]);
 	remove(aldname[1]);
+
+	char *paths[ALD_MAX_VOLUMES + 1] = { NULL, strdup(aldname[0]), strdup(aldname[1]) };
+	assert(ald_write_volumes(es, paths, 2, false) == 0);
+	assert(system("cmp testdata/expected_a.ald testdata/actual_a.ald") == 0);
+	assert(system("cmp testdata/expected_b.ald testdata/actual_b.ald") == 0);
+	remove(aldname[0]);
+	remove(aldname[1]);
+}
+
+static void test_dedup(void) {
+	AldEntry e1 = { .volume = 1, .name = "a.txt", .timestamp = TIMESTAMP, .data = (const uint8_t *)"content", .size = 7 };
+	AldEntry e2 = e1;
+	e2.data = (const uint8_t *)strdup("content");
+	AldEntry e3 = e1;
+	e3.timestamp = TIMESTAMP + 1;  // different header, stored separately
+	Vector *es = new_vec();
+	vec_push(es, &e1);
+	vec_push(es, &e2);
+	vec_push(es, &e3);
+	vec_push(es, &e1);
+	char *paths[ALD_MAX_VOLUMES + 1] = { NULL, "testdata/actual.ald" };
+	assert(ald_write_volumes(es, paths, 1, true) == 512);
+
+	AldArchive *ar = new_ald_archive();
+	assert(ald_add_volume(ar, paths[1]));
+	assert(ald_count(ar) == 4);
+	for (int i = 0; i < 4; i++) {
+		AldEntry *e = ald_get(ar, i);
+		assert(e->size == 7 && !memcmp(e->data, "content", 7));
+		assert(e->timestamp == (i == 2 ? TIMESTAMP + 1 : TIMESTAMP));
+	}
+	assert(ald_get(ar, 0)->data == ald_get(ar, 1)->data);
+	assert(ald_get(ar, 0)->data != ald_get(ar, 2)->data);
+	ald_close(ar);
+	remove(paths[1]);
+}
+
+static void test_update(void) {
+	const char path[] = "testdata/actual_b.ald";
+	assert(system("cp testdata/expected_b.ald testdata/actual_b.ald") == 0);
+
+	AldEntry e1 = { .name = "1.TXT", .timestamp = TIMESTAMP, .data = (const uint8_t *)"one", .size = 3 };
+	Vector *updates = new_vec();
+	vec_push(updates, &e1);
+	assert(ald_update(path, updates) == 0);
+	AldArchive *ar = new_ald_archive();
+	assert(ald_add_volume(ar, path));
+	assert(ald_count(ar) == 4);
+	AldEntry *e = ald_get(ar, 1);
+	assert(!strcmp(e->name, "1.txt"));  // the stored name is kept
+	assert(e->size == 3 && !memcmp(e->data, "one", 3));
+	ald_close(ar);
+
+	// Entries that end exactly on a sector boundary (with a 32-byte header),
+	// overwritten in place and moved.
+	static uint8_t aligned[480];
+	memset(aligned, 'y', sizeof(aligned));
+	AldEntry e1_aligned = { .name = "1.txt", .timestamp = TIMESTAMP, .data = aligned, .size = 224 };
+	vec_set(updates, 0, &e1_aligned);
+	assert(ald_update(path, updates) == 0);
+	ar = new_ald_archive();
+	assert(ald_add_volume(ar, path));
+	e = ald_get(ar, 1);
+	assert(e->size == 224 && !memcmp(e->data, aligned, 224));
+	ald_close(ar);
+
+	e1_aligned.size = 480;
+	assert(ald_update(path, updates) == 1);
+
+	static uint8_t large[300];
+	memset(large, 'x', sizeof(large));
+	AldEntry e3 = { .name = "3.txt", .timestamp = TIMESTAMP, .data = large, .size = sizeof(large) };
+	vec_set(updates, 0, &e3);
+	assert(ald_update(path, updates) == 1);
+
+	ar = new_ald_archive();
+	assert(ald_add_volume(ar, path));
+	assert(ald_count(ar) == 4);  // the link table has moved with entry 1
+	e = ald_get(ar, 1);
+	assert(e->size == 480 && !memcmp(e->data, aligned, 480));
+	e = ald_get(ar, 3);
+	assert(e->size == sizeof(large) && !memcmp(e->data, large, sizeof(large)));
+	ald_close(ar);
+
+	// Compaction gives the same volume as writing it from scratch.
+	ald_compact(path);
+	Vector *expected = new_vec();
+	for (int i = 0; i < 5; i++) {
+		char buf[20];
+		sprintf(buf, "%d.txt", i);
+		AldEntry *e = calloc(1, sizeof(AldEntry));
+		e->volume = i % 2 + 1;
+		e->name = strdup(buf);
+		e->timestamp = TIMESTAMP;
+		e->data = i == 1 ? aligned : i == 3 ? e3.data : (const uint8_t *)e->name;
+		e->size = i == 1 ? sizeof(aligned) : i == 3 ? e3.size : strlen(e->name);
+		vec_push(expected, e);
+	}
+	FILE *fp = checked_fopen("testdata/expected_update.ald", "wb");
+	ald_write(expected, 2, fp);
+	fclose(fp);
+	assert(system("cmp testdata/expected_update.ald testdata/actual_b.ald") == 0);
+	remove("testdata/expected_update.ald");
+	remove(path);
+}
+
+// Headers of entries that are not updated survive compaction byte for byte.
+static void test_compact(void) {
+	const char path[] = "testdata/actual_b.ald";
+	assert(system("cp testdata/expected_b.ald testdata/actual_b.ald") == 0);
+
+	// Give 3.txt a timestamp with a sub-second part, which time_t cannot hold.
+	const uint64_t filetime = 132224078451234567ULL;
+	FILE *fp = checked_fopen(path, "r+b");
+	uint8_t ptr[3], bytes[8];
+	assert(fseek(fp, 6, SEEK_SET) == 0 && fread(ptr, 3, 1, fp) == 1);
+	put_le64(bytes, filetime);
+	assert(fseek(fp, (ptr[0] << 8 | ptr[1] << 16 | ptr[2] << 24) + 8, SEEK_SET) == 0);
+	assert(fwrite(bytes, 8, 1, fp) == 1);
+	fclose(fp);
+
+	static uint8_t large[300];
+	memset(large, 'x', sizeof(large));
+	AldEntry e1 = { .name = "1.txt", .timestamp = TIMESTAMP, .data = large, .size = sizeof(large) };
+	Vector *updates = new_vec();
+	vec_push(updates, &e1);
+	assert(ald_update(path, updates) == 1);
+	ald_compact(path);
+
+	AldArchive *ar = new_ald_archive();
+	assert(ald_add_volume(ar, path));
+	AldEntry *e = ald_get(ar, 1);
+	assert(e->size == sizeof(large) && !memcmp(e->data, large, sizeof(large)));
+	e = ald_get(ar, 3);
+	assert(le64((const uint8_t *)e->name - 8) == filetime);
+	assert(e->size == 5 && !memcmp(e->data, "3.txt", 5));
+	ald_close(ar);
+	remove(path);
+}
+
+static void test_archive(void) {
+	AldArchive *ar = new_ald_archive();
+	assert(!ald_add_volume(ar, "testdata/16colors.vsp"));
+	assert(ald_add_volume(ar, "testdata/expected_b.ald"));
+	assert(ald_count(ar) == 4);
+	assert(!ald_get(ar, 0));
+	assert(!ald_get(ar, 4));
+
+	AldEntry *e = ald_get(ar, 1);
+	assert(e->volume == 2);
+	assert(!strcmp(e->name, "1.txt"));
+	assert(e->size == 5 && !memcmp(e->data, "1.txt", 5));
+	assert(ald_get(ar, 1) == e);
+
+	assert(ald_add_volume(ar, "testdata/expected_a.ald"));
+	assert(ald_count(ar) == 5);
+	for (int i = 0; i < 5; i++) {
+		char expected[20];
+		sprintf(expected, "%d.txt", i);
+		e = ald_get(ar, i);
+		assert(e->volume == i % 2 + 1);
+		assert(!strcmp(e->name, expected));
+	}
+	assert(ald_find(ar, "3.TXT") == 3);
+	assert(ald_find(ar, "5.txt") == -1);
+	ald_close(ar);
+}
+
+static void test_find(void) {
+	AldEntry e1 = { .volume = 1, .name = "\x83\x41" "bc.txt", .data = (const uint8_t *)"", };
+	AldEntry e2 = { .volume = 1, .name = "\x87\x90" "Ab.txt", .data = (const uint8_t *)"", };
+	Vector *es = new_vec();
+	vec_push(es, &e1);
+	vec_push(es, &e2);
+	const char outfile[] = "testdata/actual.ald";
+	FILE *fp = checked_fopen(outfile, "wb");
+	ald_write(es, 1, fp);
+	fclose(fp);
+
+	AldArchive *ar = new_ald_archive();
+	assert(ald_add_volume(ar, outfile));
+	assert(ald_find(ar, "\x83\x41" "BC.TXT") == 0);
+	// The trail byte 0x61 is not a lowercase 'A'.
+	assert(ald_find(ar, "\x83\x61" "bc.txt") == -1);
+	// NEC and JIS codes of the same character
+	assert(ald_find(ar, "\x81\xe0" "aB.txt") == 1);
+	ald_close(ar);
+	remove(outfile);
 }
 
 void ald_test(void) {
 	test_read();
 	test_write();
+	test_write_from_file();
 	test_multivolume_read();
 	test_multivolume_write();
+	test_update();
+	test_compact();
+	test_dedup();
+	test_archive();
+	test_find();
 }
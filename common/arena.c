@@ -0,0 +1,122 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+#include "common.h"
+#include <pthread.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct ArenaChunk {
+	struct ArenaChunk *next;
+	size_t size;
+	size_t used;
+	alignas(max_align_t) uint8_t data[];
+};
+
+// All arenas, for arena_print_stats().
+static Vector *arenas;
+static pthread_mutex_t arenas_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+Arena *new_arena(const char *name) {
+	Arena *a = calloc(1, sizeof(Arena));
+	a->name = name;
+	pthread_mutex_lock(&arenas_mutex);
+	if (!arenas)
+		arenas = new_vec();
+	vec_push(arenas, a);
+	pthread_mutex_unlock(&arenas_mutex);
+	return a;
+}
+
+void *arena_alloc(Arena *a, size_t size) {
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	ArenaChunk *c = a->chunk;
+	if (!c || c->size - c->used < size) {
+		size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+		c = malloc(sizeof(ArenaChunk) + chunk_size);
+		if (!c)
+			error("out of memory");
+		c->next = a->chunk;
+		c->size = chunk_size;
+		c->used = 0;
+		a->chunk = c;
+	}
+	void *p = c->data + c->used;
+	c->used += size;
+	memset(p, 0, size);
+
+	a->count++;
+	a->bytes += size;
+	if (a->bytes > a->peak)
+		a->peak = a->bytes;
+	return p;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t n) {
+	char *p = arena_alloc(a, n + 1);
+	memcpy(p, s, n);
+	return p;
+}
+
+// Frees all objects in the arena. The last chunk is kept for reuse.
+void arena_reset(Arena *a) {
+	ArenaChunk *c = a->chunk;
+	if (!c)
+		return;
+	while (c->next) {
+		ArenaChunk *next = c->next->next;
+		free(c->next);
+		c->next = next;
+	}
+	if (c->size > ARENA_CHUNK_SIZE) {
+		free(c);
+		a->chunk = NULL;
+	} else {
+		c->used = 0;
+	}
+	a->bytes = 0;
+}
+
+// Prints allocation statistics of all arenas, summed up by name.
+void arena_print_stats(FILE *fp) {
+	pthread_mutex_lock(&arenas_mutex);
+	Map *sums = new_map();
+	for (int i = 0; arenas && i < arenas->len; i++) {
+		Arena *a = arenas->data[i];
+		Arena *sum = map_get(sums, a->name);
+		if (!sum) {
+			sum = calloc(1, sizeof(Arena));
+			map_put(sums, a->name, sum);
+		}
+		sum->count += a->count;
+		sum->bytes += a->bytes;
+		sum->peak += a->peak;
+	}
+	pthread_mutex_unlock(&arenas_mutex);
+
+	fprintf(fp, "%-12s %12s %14s %14s\n", "arena", "allocs", "bytes", "peak bytes");
+	for (int i = 0; i < sums->keys->len; i++) {
+		Arena *sum = sums->vals->data[i];
+		fprintf(fp, "%-12s %12zu %14zu %14zu\n", (char *)sums->keys->data[i], sum->count, sum->bytes, sum->peak);
+	}
+}
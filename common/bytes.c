@@ -0,0 +1,244 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // for copy_file_range()
+#endif
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _POSIX_MAPPED_FILES
+#include <sys/mman.h>
+#endif
+#ifndef _O_BINARY
+#define _O_BINARY 0
+#endif
+
+#define WRITER_BUFFER_SIZE 65536
+
+const uint8_t *map_file(const char *path, size_t *size) {
+	int fd;
+	const uint8_t *p = map_file_fd(path, size, &fd);
+	close(fd);
+	return p;
+}
+
+const uint8_t *map_file_fd(const char *path, size_t *size, int *pfd) {
+	int fd = checked_open(path, O_RDONLY | _O_BINARY);
+	*pfd = fd;
+
+	struct stat sbuf;
+	if (fstat(fd, &sbuf) < 0)
+		error("%s: %s", path, strerror(errno));
+	*size = sbuf.st_size;
+	if (!*size)
+		return (const uint8_t *)"";
+
+#ifdef _POSIX_MAPPED_FILES
+	uint8_t *p = mmap(NULL, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		error("%s: %s", path, strerror(errno));
+#else
+	uint8_t *p = malloc(sbuf.st_size);
+	if (!p)
+		error("cannot read %s: out of memory", path);
+	size_t bytes = 0;
+	while (bytes < sbuf.st_size) {
+		ssize_t ret = read(fd, p + bytes, sbuf.st_size - bytes);
+		if (ret <= 0)
+			error("%s: %s", path, strerror(errno));
+		bytes += ret;
+	}
+#endif
+	return p;
+}
+
+void unmap_file(const uint8_t *data, size_t size) {
+	if (!size)
+		return;
+#ifdef _POSIX_MAPPED_FILES
+	munmap((void *)data, size);
+#else
+	free((void *)data);
+#endif
+}
+
+void write_fd(int fd, const void *data, size_t size, int src_fd, int64_t src_offset) {
+	const uint8_t *p = data;
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+	if (src_fd != -1) {
+		off_t off = src_offset;
+		while (size > 0) {
+			ssize_t n = copy_file_range(src_fd, &off, fd, NULL, size, 0);
+			if (n <= 0)
+				break;  // not supported for these files; use write()
+			p += n;
+			size -= n;
+		}
+	}
+#endif
+	while (size > 0) {
+		// Windows' write() takes an unsigned int.
+		ssize_t n = write(fd, p, size < 0x40000000 ? size : 0x40000000);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error("write error: %s", strerror(errno));
+		}
+		p += n;
+		size -= n;
+	}
+}
+
+void copy_fd(int fd, int src_fd, size_t size) {
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+	while (size > 0) {
+		ssize_t n = copy_file_range(src_fd, NULL, fd, NULL, size, 0);
+		if (n <= 0)
+			break;  // not supported for these files; use read() and write()
+		size -= n;
+	}
+#endif
+	if (!size)
+		return;
+	size_t bufsize = size < 0x100000 ? size : 0x100000;
+	uint8_t *buf = malloc(bufsize);
+	while (size > 0) {
+		ssize_t n = read(src_fd, buf, size < bufsize ? size : bufsize);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			error("read error: %s", strerror(errno));
+		if (n == 0)
+			error("read error: unexpected end of file");
+		write_fd(fd, buf, n, -1, 0);
+		size -= n;
+	}
+	free(buf);
+}
+
+void br_init(ByteReader *r, const void *data, size_t size) {
+	r->data = r->p = data;
+	r->end = r->data + size;
+	r->error = false;
+}
+
+const uint8_t *br_bytes(ByteReader *r, size_t n) {
+	if (!br_has(r, n))
+		return NULL;
+	const uint8_t *p = r->p;
+	r->p += n;
+	return p;
+}
+
+const char *br_str(ByteReader *r) {
+	const uint8_t *nul = r->error ? NULL : memchr(r->p, 0, r->end - r->p);
+	if (!nul) {
+		r->error = true;
+		r->p = r->end;
+		return "";
+	}
+	return (const char *)br_bytes(r, nul - r->p + 1);
+}
+
+void br_seek(ByteReader *r, size_t pos) {
+	if (pos > (size_t)(r->end - r->data)) {
+		r->error = true;
+		r->p = r->end;
+		return;
+	}
+	r->p = r->data + pos;
+}
+
+ByteWriter *new_byte_writer(FILE *fp) {
+	ByteWriter *w = calloc(1, sizeof(ByteWriter));
+	w->fp = fp;
+	w->cap = WRITER_BUFFER_SIZE;
+	w->buf = malloc(w->cap);
+	return w;
+}
+
+void bw_flush(ByteWriter *w) {
+	if (!w->fp || !w->len)
+		return;
+	if (fwrite(w->buf, w->len, 1, w->fp) != 1)
+		error("write error: %s", strerror(errno));
+	w->flushed += w->len;
+	w->len = 0;
+}
+
+void free_byte_writer(ByteWriter *w) {
+	bw_flush(w);
+	free(w->buf);
+	free(w);
+}
+
+uint8_t *bw_reserve_slow(ByteWriter *w, size_t n) {
+	bw_flush(w);
+	if (w->len + n > w->cap) {
+		while (w->len + n > w->cap)
+			w->cap *= 2;
+		w->buf = realloc(w->buf, w->cap);
+	}
+	uint8_t *p = w->buf + w->len;
+	w->len += n;
+	return p;
+}
+
+void bw_bytes(ByteWriter *w, const void *data, size_t n) {
+	if (w->fp && n >= w->cap / 2) {
+		// Large blocks bypass the buffer.
+		bw_flush(w);
+		if (n && fwrite(data, n, 1, w->fp) != 1)
+			error("write error: %s", strerror(errno));
+		w->flushed += n;
+		return;
+	}
+	if (n)
+		memcpy(bw_reserve(w, n), data, n);
+}
+
+void bw_str(ByteWriter *w, const char *s) {
+	bw_bytes(w, s, strlen(s) + 1);
+}
+
+void bw_zeros(ByteWriter *w, size_t n) {
+	while (n > 0) {
+		size_t len = n < w->cap ? n : w->cap;
+		memset(bw_reserve(w, len), 0, len);
+		n -= len;
+	}
+}
+
+void bw_align(ByteWriter *w, size_t alignment) {
+	size_t pos = bw_tell(w);
+	bw_zeros(w, (pos + alignment - 1) / alignment * alignment - pos);
+}
+
+void bw_patch(ByteWriter *w, size_t pos, const void *data, size_t n) {
+	if (pos >= w->flushed) {
+		memcpy(w->buf + (pos - w->flushed), data, n);
+		return;
+	}
+	bw_flush(w);
+	if (fseek(w->fp, pos, SEEK_SET) != 0 || fwrite(data, n, 1, w->fp) != 1 || fseek(w->fp, 0, SEEK_END) != 0)
+		error("write error: %s", strerror(errno));
+}
@@ -0,0 +1,110 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+#undef NDEBUG
+#include "common.h"
+#include <assert.h>
+#include <string.h>
+
+static void test_reader(void) {
+	static const uint8_t data[] = {
+		0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c,
+		0x0d, 0x0e, 0x0f, 'a', 'b', 0, 0xff,
+	};
+	ByteReader r;
+	br_init(&r, data, sizeof(data));
+	assert(br_u8(&r) == 0x01);
+	assert(br_u16(&r) == 0x0302);
+	assert(br_u32(&r) == 0x07060504);
+	assert(br_u64(&r) == 0x0f0e0d0c0b0a0908ULL);
+	assert(!strcmp(br_str(&r), "ab"));
+	assert(br_tell(&r) == 18 && !br_eof(&r) && !r.error);
+
+	// Unterminated string
+	assert(!strcmp(br_str(&r), ""));
+	assert(r.error && br_eof(&r));
+
+	br_init(&r, data, sizeof(data));
+	br_seek(&r, 17);
+	assert(br_u16(&r) == 0xff00);
+	assert(br_eof(&r) && !r.error);
+	assert(br_u8(&r) == 0 && r.error);
+
+	br_init(&r, data, sizeof(data));
+	assert(!br_bytes(&r, sizeof(data) + 1) && r.error);
+
+	br_init(&r, data, sizeof(data));
+	br_seek(&r, sizeof(data) + 1);
+	assert(r.error);
+}
+
+static void test_memory_writer(void) {
+	ByteWriter *w = new_byte_writer(NULL);
+	bw_u8(w, 0x01);
+	bw_u16(w, 0x0302);
+	bw_u32(w, 0x07060504);
+	bw_u64(w, 0x0f0e0d0c0b0a0908ULL);
+	bw_str(w, "ab");
+	assert(bw_tell(w) == 18);
+	bw_align(w, 8);
+	assert(bw_tell(w) == 24);
+	bw_align(w, 8);
+	assert(bw_tell(w) == 24);
+	bw_patch(w, 1, "xy", 2);
+	assert(!memcmp(w->buf, "\x01xy\x04\x05\x06\x07\x08", 8));
+	assert(!memcmp(w->buf + 15, "ab\0\0\0\0\0\0\0", 9));
+
+	// Grows beyond the initial buffer size.
+	size_t n = w->cap * 3;
+	bw_zeros(w, n);
+	assert(bw_tell(w) == 24 + n && w->len == 24 + n);
+	free_byte_writer(w);
+}
+
+static void test_file_writer(void) {
+	FILE *fp = tmpfile();
+	assert(fp);
+	ByteWriter *w = new_byte_writer(fp);
+	bw_u32(w, 0);
+	size_t n = w->cap;  // large enough to bypass the buffer
+	uint8_t *block = malloc(n);
+	for (size_t i = 0; i < n; i++)
+		block[i] = i;
+	bw_bytes(w, block, n);
+	bw_u32(w, 0xdeadbeef);
+	bw_patch(w, 0, "\x11\x22\x33\x44", 4);      // flushed region
+	bw_patch(w, n + 4, "\x55\x66\x77\x88", 4);  // buffered region
+	bw_u8(w, 0x99);
+	free_byte_writer(w);
+
+	assert(ftell(fp) == (long)n + 9);
+	rewind(fp);
+	uint8_t *buf = malloc(n + 9);
+	assert(fread(buf, n + 9, 1, fp) == 1);
+	assert(!memcmp(buf, "\x11\x22\x33\x44", 4));
+	assert(!memcmp(buf + 4, block, n));
+	assert(!memcmp(buf + n + 4, "\x55\x66\x77\x88\x99", 5));
+	fclose(fp);
+	free(buf);
+	free(block);
+}
+
+void bytes_test(void) {
+	test_reader();
+	test_memory_writer();
+	test_file_writer();
+}
@@ -0,0 +1,203 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+
+// Argument signatures (see arguments() in the compiler and the decompiler):
+//  e: expression
+//  n: number
+//  N: same as n, but no preceding space in decompiled code
+//  o: obfuscated string
+//  s: string (colon-terminated)
+//  v: variable
+//  z: string (zero-terminated)
+//  F: function name
+const CommandInfo commands_2f[NR_COMMANDS_2F] = {
+	[0x00] = {"TOC", "", SYSTEM38},
+	[0x01] = {"TOS", "", SYSTEM38},
+	[0x02] = {"TPC", "e", SYSTEM38},
+	[0x03] = {"TPS", "e", SYSTEM38},
+	[0x04] = {"TOP", "", SYSTEM38},
+	[0x05] = {"TPP", "", SYSTEM38},
+	[0x06] = {"inc", "v", SYSTEM35},
+	[0x07] = {"dec", "v", SYSTEM35},
+	[0x08] = {"TAA", "e", SYSTEM35},
+	[0x09] = {"TAB", "v", SYSTEM35},
+	[0x0a] = {"wavLoad", "ee", SYSTEM35},
+	[0x0b] = {"wavPlay", "ee", SYSTEM35},
+	[0x0c] = {"wavStop", "e", SYSTEM35},
+	[0x0d] = {"wavUnload", "e", SYSTEM35},
+	[0x0e] = {"wavIsPlay", "ev", SYSTEM35},
+	[0x0f] = {"wavFade", "eeee", SYSTEM35},
+	[0x10] = {"wavIsFade", "ev", SYSTEM35},
+	[0x11] = {"wavStopFade", "e", SYSTEM35},
+	[0x12] = {"trace", "z", SYSTEM35},
+	[0x13] = {"wav3DSetPos", "eeee", SYSTEM35},
+	[0x14] = {"wav3DCommit", "", SYSTEM35},
+	[0x15] = {"wav3DGetPos", "evvv", SYSTEM35},
+	[0x16] = {"wav3DSetPosL", "eee", SYSTEM35},
+	[0x17] = {"wav3DGetPosL", "vvv", SYSTEM35},
+	[0x18] = {"wav3DFadePos", "eeeee", SYSTEM35},
+	[0x19] = {"wav3DIsFadePos", "ev", SYSTEM35},
+	[0x1a] = {"wav3DStopFadePos", "e", SYSTEM35},
+	[0x1b] = {"wav3DFadePosL", "eeee", SYSTEM35},
+	[0x1c] = {"wav3DIsFadePosL", "v", SYSTEM35},
+	[0x1d] = {"wav3DStopFadePosL", "", SYSTEM35},
+	[0x1e] = {"sndPlay", "ee", SYSTEM35},
+	[0x1f] = {"sndStop", "", SYSTEM35},
+	[0x20] = {"sndIsPlay", "v", SYSTEM35},
+	[0x21] = {"msg", "z", SYSTEM35},
+	[0x22] = {"HH", "ne", SYSTEM38},
+	[0x23] = {"LC", "eez", SYSTEM38},
+	[0x24] = {"LE", "nzee", SYSTEM38},
+	[0x25] = {"LXG", "ezz", SYSTEM38},
+	[0x26] = {"MI", "eez", SYSTEM38},
+	[0x27] = {"MS", "ez", SYSTEM38},
+	[0x28] = {"MT", "z", SYSTEM38},
+	[0x29] = {"NT", "z", SYSTEM38},
+	[0x2a] = {"QE", "nzee", SYSTEM38},
+	[0x2b] = {"UP", NULL, SYSTEM38},
+	[0x2c] = {"F", "Nee", SYSTEM38},
+	[0x2d] = {"wavWaitTime", "ee", SYSTEM35},
+	[0x2e] = {"wavGetPlayPos", "ev", SYSTEM35},
+	[0x2f] = {"wavWaitEnd", "e", SYSTEM35},
+	[0x30] = {"wavGetWaveTime", "ev", SYSTEM35},
+	[0x31] = {"menuSetCbkSelect", "F", SYSTEM35},
+	[0x32] = {"menuSetCbkCancel", "F", SYSTEM35},
+	[0x33] = {"menuClearCbkSelect", "", SYSTEM35},
+	[0x34] = {"menuClearCbkCancel", "", SYSTEM35},
+	[0x35] = {"wav3DSetMode", "ee", SYSTEM35},
+	[0x36] = {"grCopyStretch", "eeeeeeeee", SYSTEM35},
+	[0x37] = {"grFilterRect", "eeeee", SYSTEM35},
+	[0x38] = {"iptClearWheelCount", "", SYSTEM35},
+	[0x39] = {"iptGetWheelCount", "vv", SYSTEM35},
+	[0x3a] = {"menuGetFontSize", "v", SYSTEM35},
+	[0x3b] = {"msgGetFontSize", "v", SYSTEM35},
+	[0x3c] = {"strGetCharType", "eev", SYSTEM35},
+	[0x3d] = {"strGetLengthASCII", "ev", SYSTEM35},
+	[0x3e] = {"sysWinMsgLock", "", SYSTEM35},
+	[0x3f] = {"sysWinMsgUnlock", "", SYSTEM35},
+	[0x40] = {"aryCmpCount", "veev", SYSTEM35},
+	[0x41] = {"aryCmpTrans", "veeeev", SYSTEM35},
+	[0x42] = {"grBlendColorRect", "eeeeeeeee", SYSTEM35},
+	[0x43] = {"grDrawFillCircle", "eeee", SYSTEM35},
+	[0x44] = {"MHH", "eee", SYSTEM38},
+	[0x45] = {"menuSetCbkInit", "F", SYSTEM35},
+	[0x46] = {"menuClearCbkInit", "", SYSTEM35},
+	[0x47] = {NULL, NULL, SYSTEM35},
+	[0x48] = {"sysOpenShell", "z", SYSTEM35},
+	[0x49] = {"sysAddWebMenu", "zz", SYSTEM35},
+	[0x4a] = {"iptSetMoveCursorTime", "e", SYSTEM35},
+	[0x4b] = {"iptGetMoveCursorTime", "v", SYSTEM35},
+	[0x4c] = {"grBlt", "eeeeee", SYSTEM35},
+	[0x4d] = {"LXWT", "ez", SYSTEM38},
+	[0x4e] = {"LXWS", "ee", SYSTEM38},
+	[0x4f] = {"LXWE", "ee", SYSTEM38},
+	[0x50] = {"LXWH", "ene", SYSTEM38},
+	[0x51] = {"LXWHH", "ene", SYSTEM38},
+	[0x52] = {"sysGetOSName", "e", SYSTEM35},
+	[0x53] = {"patchEC", "e", SYSTEM35},
+	[0x54] = {"mathSetClipWindow", "eeee", SYSTEM35},
+	[0x55] = {"mathClip", "vvvvvv", SYSTEM35},
+	[0x56] = {"LXF", "ezz", SYSTEM38},
+	[0x57] = {"strInputDlg", "zeev", SYSTEM35},
+	[0x58] = {"strCheckASCII", "ev", SYSTEM35},
+	[0x59] = {"strCheckSJIS", "ev", SYSTEM35},
+	[0x5a] = {"strMessageBox", "z", SYSTEM35},
+	[0x5b] = {"strMessageBoxStr", "e", SYSTEM35},
+	[0x5c] = {"grCopyUseAMapUseA", "eeeeeee", SYSTEM35},
+	[0x5d] = {"grSetCEParam", "ee", SYSTEM35},
+	[0x5e] = {"grEffectMoveView", "eeee", SYSTEM35},
+	[0x5f] = {"cgSetCacheSize", "e", SYSTEM35},
+	[0x60] = {NULL, NULL, SYSTEM39},
+	[0x61] = {"gaijiSet", "ee", SYSTEM35},
+	[0x62] = {"gaijiClearAll", "", SYSTEM35},
+	[0x63] = {"menuGetLatestSelect", "v", SYSTEM35},
+	[0x64] = {"lnkIsLink", "eev", SYSTEM35},
+	[0x65] = {"lnkIsData", "eev", SYSTEM35},
+	[0x66] = {"fncSetTable", "eF", SYSTEM35},
+	[0x67] = {"fncSetTableFromStr", "eev", SYSTEM35},
+	[0x68] = {"fncClearTable", "e", SYSTEM35},
+	[0x69] = {"fncCall", "e", SYSTEM35},
+	[0x6a] = {"fncSetReturnCode", "e", SYSTEM35},
+	[0x6b] = {"fncGetReturnCode", "v", SYSTEM35},
+	[0x6c] = {"msgSetOutputFlag", "e", SYSTEM35},
+	[0x6d] = {"saveDeleteFile", "ev", SYSTEM35},
+	[0x6e] = {"wav3DSetUseFlag", "e", SYSTEM35},
+	[0x6f] = {"wavFadeVolume", "eeee", SYSTEM35},
+	[0x70] = {"patchEMEN", "e", SYSTEM35},
+	[0x71] = {"wmenuEnableMsgSkip", "e", SYSTEM35},
+	[0x72] = {"winGetFlipFlag", "v", SYSTEM35},
+	[0x73] = {"cdGetMaxTrack", "v", SYSTEM35},
+	[0x74] = {"dlgErrorOkCancel", "zv", SYSTEM35},
+	[0x75] = {"menuReduce", "e", SYSTEM35},
+	[0x76] = {"menuGetNumof", "v", SYSTEM35},
+	[0x77] = {"menuGetText", "ee", SYSTEM35},
+	[0x78] = {"menuGoto", "ee", SYSTEM35},
+	[0x79] = {"menuReturnGoto", "ee", SYSTEM35},
+	[0x7a] = {"menuFreeShelterDIB", "", SYSTEM35},
+	[0x7b] = {"msgFreeShelterDIB", "", SYSTEM35},
+	[0x7c] = {NULL, NULL, SYSTEM39},
+	[0x7d] = {NULL, "ne", SYSTEM39},
+	[0x7e] = {NULL, "ne", SYSTEM39},
+	[0x7f] = {NULL, "e", SYSTEM39},
+	[0x80] = {"dataSetPointer", "F", SYSTEM35},
+	[0x81] = {"dataGetWORD", "ve", SYSTEM35},
+	[0x82] = {"dataGetString", "ee", SYSTEM35},
+	[0x83] = {"dataSkipWORD", "e", SYSTEM35},
+	[0x84] = {"dataSkipString", "e", SYSTEM35},
+	[0x85] = {"varGetNumof", "v", SYSTEM35},
+	[0x86] = {"patchG0", "e", SYSTEM35},
+	[0x87] = {"regReadString", "eeev", SYSTEM35},
+	[0x88] = {"fileCheckExist", "ev", SYSTEM35},
+	[0x89] = {"timeCheckCurDate", "eeev", SYSTEM35},
+	[0x8a] = {"dlgManualProtect", "oo", SYSTEM35},
+	[0x8b] = {"fileCheckDVD", "oeeov", SYSTEM35},
+	[0x8c] = {"sysReset", "", SYSTEM35},
+};
+
+#define COMMAND_HASH_BITS 10
+
+// FNV-1a, mixed with a seed. gen_cmdhash.c finds a seed with which this has no
+// collisions for the command names.
+static inline unsigned command_hash(const char *name, int len, uint64_t seed) {
+	uint64_t h = FNV64_INIT;
+	for (int i = 0; i < len; i++) {
+		h ^= (uint8_t)name[i];
+		h *= 0x100000001b3ULL;
+	}
+	h = (h ^ h >> 32) * (0x9e3779b97f4a7c15ULL + seed * 2);
+	return h >> (64 - COMMAND_HASH_BITS);
+}
+
+#ifndef GEN_CMDHASH
+
+#include "cmdhash.h"  // generated by gen_cmdhash.c
+
+int lookup_command(const char *name, int len, SysVer sys_ver) {
+	int i = command_hash_table[command_hash(name, len, COMMAND_HASH_SEED)];
+	if (i == 0xff)
+		return 0;
+	const CommandInfo *info = &commands_2f[i];
+	if (strncmp(info->name, name, len) || info->name[len] || info->sys_ver > sys_ver)
+		return 0;
+	return CMD2F(i);
+}
+
+#endif  // GEN_CMDHASH
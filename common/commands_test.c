@@ -0,0 +1,50 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+#undef NDEBUG
+#include "common.h"
+#include <assert.h>
+#include <string.h>
+
+static void test_lookup_command(void) {
+	for (int i = 0; i < NR_COMMANDS_2F; i++) {
+		const char *name = commands_2f[i].name;
+		if (name)
+			assert(lookup_command(name, strlen(name), SYSTEM39) == CMD2F(i));
+	}
+	assert(lookup_command("inc", 3, SYSTEM35) == COMMAND_inc);
+	assert(lookup_command("increment", 2, SYSTEM35) == 0);
+	assert(lookup_command("inc", 2, SYSTEM35) == 0);
+	assert(lookup_command("incr", 4, SYSTEM35) == 0);
+	assert(lookup_command("menu", 4, SYSTEM39) == 0);
+	assert(lookup_command("TAA", 3, SYSTEM35) == COMMAND_TAA);
+	assert(lookup_command("TOC", 3, SYSTEM36) == 0);
+	assert(lookup_command("TOC", 3, SYSTEM38) == COMMAND_TOC);
+}
+
+static void test_command_info(void) {
+	assert(command_info(COMMAND_wavLoad) == &commands_2f[0x0a]);
+	assert(!strcmp(command_info(COMMAND_wavLoad)->args, "ee"));
+	assert(command_info(CMD2('Z', 'Z')) == NULL);
+	assert(command_info(CMD2F(NR_COMMANDS_2F)) == NULL);
+}
+
+void commands_test(void) {
+	test_lookup_command();
+	test_command_info();
+}
@@ -19,11 +19,17 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdnoreturn.h>
+#include <string.h>
 #include <time.h>
 
 #define VERSION "1.13.0"
 
+static inline uint16_t le16(const uint8_t *p) {
+	return p[0] | p[1] << 8;
+}
+
 static inline uint32_t le32(const uint8_t *p) {
 	return p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24;
 }
@@ -32,6 +38,23 @@ static inline uint64_t le64(const uint8_t *p) {
 	return le32(p) | (uint64_t)le32(p + 4) << 32;
 }
 
+static inline void put_le16(uint8_t *p, uint16_t n) {
+	p[0] = n;
+	p[1] = n >> 8;
+}
+
+static inline void put_le32(uint8_t *p, uint32_t n) {
+	p[0] = n;
+	p[1] = n >> 8;
+	p[2] = n >> 16;
+	p[3] = n >> 24;
+}
+
+static inline void put_le64(uint8_t *p, uint64_t n) {
+	put_le32(p, n);
+	put_le32(p + 4, n >> 32);
+}
+
 typedef enum {
 	SCO_S350,
 	SCO_S351,
@@ -40,6 +63,13 @@ typedef enum {
 	SCO_S380
 } ScoVer;
 
+typedef enum {
+	SYSTEM35,
+	SYSTEM36,
+	SYSTEM38,
+	SYSTEM39,
+} SysVer;
+
 // util.c
 
 void init(int *argc, char ***argv);
@@ -47,10 +77,14 @@ char *strndup_(const char *s, size_t n);
 noreturn void error(char *fmt, ...);
 FILE *checked_fopen(const char *path_utf8, const char *mode);
 int checked_open(const char *path_utf8, int oflag);
+int checked_create(const char *path_utf8);  // opens a new file for writing
 
 char *basename_utf8(const char *path);
 char *dirname_utf8(const char *path);
 char *path_join(const char *dir, const char *path);
+// Same as path_join(), but the result is written to `buf` if it fits in `size`
+// bytes. Otherwise it is allocated.
+const char *path_join_buf(const char *dir, const char *path, char *buf, size_t size);
 int make_dir(const char *path_utf8);
 void mkdir_p(const char *path_utf8);
 
@@ -66,31 +100,74 @@ UDIR *opendir_utf8(const char *path);
 int closedir_utf8(UDIR *dir);
 char *readdir_utf8(UDIR *dir);
 int stat_utf8(const char *path, ustat *st);
+void checked_rename(const char *from_utf8, const char *to_utf8);  // replaces to_utf8
 
-extern uint16_t fgetw(FILE *fp);
-extern uint32_t fgetdw(FILE *fp);
-extern uint64_t fget64(FILE *fp);
-extern void fputw(uint16_t n, FILE *fp);
-extern void fputdw(uint32_t n, FILE *fp);
-extern void fput64(uint64_t n, FILE *fp);
+#define FNV64_INIT 0xcbf29ce484222325ULL
+uint64_t fnv1a64(const void *data, size_t len, uint64_t h);
 
 time_t win_filetime_to_time_t(uint64_t filetime);
 uint64_t time_t_to_win_filetime(time_t t);
 
+int nr_cpus(void);
+// Calls func(data, i) for each 0 <= i < n, using up to `jobs` threads.
+void parallel_for(int n, int jobs, void (*func)(void *data, int i), void *data);
+
 // sjisutf.c
 
 #define sjis2utf(s) sjis2utf_sub((s), -1)
 #define utf2sjis(s) utf2sjis_sub((s), -1)
 char *sjis2utf_sub(const char *str, int substitution_char);
 char *utf2sjis_sub(const char *str, int substitution_char);
-uint8_t compact_sjis(uint8_t c1, uint8_t c2);
+// Streaming conversions. Convert up to *src_len bytes of `src` into `dst`,
+// which has room for `dst_cap` bytes, and return the number of bytes written
+// (without a NUL terminator). *src_len is set to the number of bytes consumed.
+// Conversion stops early when `dst` is full or `src` ends in the middle of a
+// character; call again with the rest of the input to resume.
+size_t sjis2utf_conv(const char *src, size_t *src_len, char *dst, size_t dst_cap, int substitution_char);
+size_t utf2sjis_conv(const char *src, size_t *src_len, char *dst, size_t dst_cap, int substitution_char);
+// Same as sjis2utf(), but the result is written to `buf` if it fits in `size`
+// bytes. Otherwise it is allocated.
+const char *sjis2utf_buf(const char *str, char *buf, size_t size);
 uint16_t expand_sjis(uint8_t c);
-bool is_valid_sjis(uint8_t c1, uint8_t c2);
-bool is_unicode_safe(uint8_t c1, uint8_t c2);
+
+// Properties of 2-byte Shift_JIS characters, indexed by the 16-bit code. The
+// lowest 8 bits hold the half-width form of SJIS_COMPACTABLE characters.
+// Generated by gen_sjistbl.c.
+enum {
+	SJIS_VALID        = 0x100,
+	SJIS_UNICODE_SAFE = 0x200,  // maps to a Unicode code point no other code maps to
+	SJIS_GAIJI        = 0x400,  // maps to the Private Use Area
+	SJIS_COMPACTABLE  = 0x800,
+};
+extern const uint16_t sjis_props[0x10000];
+
+static inline uint16_t sjis_prop(uint8_t c1, uint8_t c2) {
+	return sjis_props[c1 << 8 | c2];
+}
+
+static inline bool is_valid_sjis(uint8_t c1, uint8_t c2) {
+	return sjis_prop(c1, c2) & SJIS_VALID;
+}
+
+// Returns true if (c1, c2) can be converted to Unicode and back without loss.
+static inline bool is_unicode_safe(uint8_t c1, uint8_t c2) {
+	return sjis_prop(c1, c2) & SJIS_UNICODE_SAFE;
+}
+
+// Returns the half-width form of (c1, c2), or 0 if there is none.
+static inline uint8_t compact_sjis(uint8_t c1, uint8_t c2) {
+	return sjis_prop(c1, c2) & 0xff;
+}
 
 // Returns NULL if s is a valid UTF-8 string. Otherwise, returns the first
 // invalid character.
 const char *validate_utf8(const char *s);
+// Same as validate_utf8(), for Shift_JIS strings.
+const char *validate_sjis(const char *s);
+// Returns the code that a valid 2-byte character (c1, c2) is converted to by
+// a round trip through Unicode. This differs from (c1, c2) for characters
+// that have more than one code, such as NEC and IBM extensions.
+uint16_t canonical_sjis(uint8_t c1, uint8_t c2);
 
 static inline bool is_sjis_half_kana(uint8_t c) {
 	return 0xa1 <= c && c <= 0xdf;
@@ -126,18 +203,57 @@ void stack_push(Vector *stack, uintptr_t n);
 void stack_pop(Vector *stack);
 uintptr_t stack_top(Vector *stack);
 
-typedef struct {
-	Vector *keys;
-	Vector *vals;
-} Map;
-
-Map *new_map(void);
-void map_put(Map *m, const char *key, void *val);
-void *map_get(Map *m, const char *key);
+// Grows the array `data` of `elem_size`-byte elements to hold at least n
+// elements, and returns the (possibly moved) array.
+void *grow_array(void *data, int *cap, int n, size_t elem_size);
+
+// DEFINE_VECTOR(Name, T, prefix) defines Name, a vector that stores elements
+// of type T inline, and the following functions. A zero-filled Name is an
+// empty vector.
+//
+//   T *prefix_push(Name *v)  appends a zero-filled element and returns it
+//   void prefix_append(Name *v, const T *elems, int n)
+//   void prefix_reserve(Name *v, int n)
+//   void prefix_sort(Name *v, int (*compare)(const T *, const T *))
+//   T *prefix_bsearch(Name *v, const T *key, int (*compare)(const T *, const T *))
+//
+// Pointers to elements are invalidated when the vector grows.
+#define DEFINE_VECTOR(Name, T, prefix) \
+	typedef struct { \
+		T *data; \
+		int len; \
+		int cap; \
+	} Name; \
+	static inline void prefix##_reserve(Name *v, int n) { \
+		if (n > v->cap) \
+			v->data = grow_array(v->data, &v->cap, n, sizeof(T)); \
+	} \
+	static inline T *prefix##_push(Name *v) { \
+		prefix##_reserve(v, v->len + 1); \
+		T *e = &v->data[v->len++]; \
+		memset(e, 0, sizeof(T)); \
+		return e; \
+	} \
+	static inline void prefix##_append(Name *v, const T *elems, int n) { \
+		prefix##_reserve(v, v->len + n); \
+		if (n > 0) \
+			memcpy(v->data + v->len, elems, n * sizeof(T)); \
+		v->len += n; \
+	} \
+	static inline void prefix##_sort(Name *v, int (*compare)(const T *, const T *)) { \
+		if (v->len > 1) \
+			qsort(v->data, v->len, sizeof(T), (int (*)(const void *, const void *))compare); \
+	} \
+	static inline T *prefix##_bsearch(Name *v, const T *key, int (*compare)(const T *, const T *)) { \
+		if (!v->len) \
+			return NULL; \
+		return bsearch(key, v->data, v->len, sizeof(T), (int (*)(const void *, const void *))compare); \
+	}
 
 typedef struct {
-	const void *key;
+	const void *key;  // NULL for empty slots
 	void *val;
+	uint32_t hash;    // cached result of the hash function
 } HashItem;
 
 typedef uint32_t (*HashFunc)(const void *key);
@@ -152,24 +268,229 @@ typedef struct {
 	HashKeyCompare compare;
 } HashMap;
 
+uint32_t hash_bytes(const void *data, size_t n);
 HashMap *new_hash(HashFunc hash, HashKeyCompare compare);
 HashMap *new_string_hash(void);
+void free_hash(HashMap *m);  // keys and values are not freed
+// Makes room for n items in total, so that they can be put without rehashing.
+void hash_reserve(HashMap *m, uint32_t n);
 void hash_put(HashMap *m, const void *key, const void *val);
 void *hash_get(HashMap *m, const void *key);
+// Removes key from m, and returns its value (NULL if it was not in m). Items
+// must not be removed while iterating over m.
+void *hash_remove(HashMap *m, const void *key);
 HashItem *hash_iterate(HashMap *m, HashItem *item);
 
+// An insertion-ordered string map. `keys` and `vals` can be iterated directly.
+// If a key is put more than once, map_get() returns the last value.
+typedef struct {
+	Vector *keys;
+	Vector *vals;
+	HashMap *index;  // key -> position in vals + 1
+	int indexed;     // number of keys in `index`
+} Map;
+
+Map *new_map(void);
+void map_put(Map *m, const char *key, void *val);
+void *map_get(Map *m, const char *key);
+
+// bytes.c
+
+// Maps the whole file into memory (or reads it, where mmap is not available).
+const uint8_t *map_file(const char *path_utf8, size_t *size);
+// Same as map_file(), but leaves the file open and stores its descriptor in
+// *fd. The caller closes it.
+const uint8_t *map_file_fd(const char *path_utf8, size_t *size, int *fd);
+void unmap_file(const uint8_t *data, size_t size);
+// Writes `size` bytes of `data` to fd. If src_fd is not -1, `data` must be the
+// contents of src_fd at src_offset (e.g. a part of its mapping); the kernel
+// then copies the bytes file-to-file where it can.
+void write_fd(int fd, const void *data, size_t size, int src_fd, int64_t src_offset);
+// Copies `size` bytes from the current position of src_fd to fd, through a
+// buffer of at most 1 MiB.
+void copy_fd(int fd, int src_fd, size_t size);
+
+// Bounds-checked little-endian reader over a memory region. Reading past the
+// end sets `error` and returns zeros.
+typedef struct {
+	const uint8_t *data;
+	const uint8_t *p;  // current position
+	const uint8_t *end;
+	bool error;
+} ByteReader;
+
+void br_init(ByteReader *r, const void *data, size_t size);
+const uint8_t *br_bytes(ByteReader *r, size_t n);  // NULL if fewer than n bytes remain
+const char *br_str(ByteReader *r);  // a NUL-terminated string, or "" on error
+void br_seek(ByteReader *r, size_t pos);
+
+static inline size_t br_tell(ByteReader *r) {
+	return r->p - r->data;
+}
+
+static inline bool br_eof(ByteReader *r) {
+	return r->p >= r->end;
+}
+
+static inline bool br_has(ByteReader *r, size_t n) {
+	if ((size_t)(r->end - r->p) >= n)
+		return true;
+	r->error = true;
+	r->p = r->end;
+	return false;
+}
+
+static inline uint8_t br_u8(ByteReader *r) {
+	return br_has(r, 1) ? *r->p++ : 0;
+}
+
+static inline uint16_t br_u16(ByteReader *r) {
+	if (!br_has(r, 2))
+		return 0;
+	r->p += 2;
+	return le16(r->p - 2);
+}
+
+static inline uint32_t br_u32(ByteReader *r) {
+	if (!br_has(r, 4))
+		return 0;
+	r->p += 4;
+	return le32(r->p - 4);
+}
+
+static inline uint64_t br_u64(ByteReader *r) {
+	if (!br_has(r, 8))
+		return 0;
+	r->p += 8;
+	return le64(r->p - 8);
+}
+
+// Buffered little-endian writer. If `fp` is NULL, everything is kept in
+// `buf`; otherwise the buffer is flushed to fp when it fills up.
+typedef struct {
+	uint8_t *buf;
+	size_t len;      // bytes in buf
+	size_t cap;
+	FILE *fp;
+	size_t flushed;  // bytes already written to fp
+} ByteWriter;
+
+ByteWriter *new_byte_writer(FILE *fp);
+void free_byte_writer(ByteWriter *w);  // flushes w and frees it, but does not close fp
+void bw_flush(ByteWriter *w);
+uint8_t *bw_reserve_slow(ByteWriter *w, size_t n);
+void bw_bytes(ByteWriter *w, const void *data, size_t n);
+void bw_str(ByteWriter *w, const char *s);  // including the NUL terminator
+void bw_zeros(ByteWriter *w, size_t n);
+void bw_align(ByteWriter *w, size_t alignment);  // pads with zeros
+// Overwrites n bytes at offset pos, which must have been written already.
+// Patching a flushed region seeks fp, so fp must be a seekable file that was
+// at offset 0 when w was created.
+void bw_patch(ByteWriter *w, size_t pos, const void *data, size_t n);
+
+static inline size_t bw_tell(ByteWriter *w) {
+	return w->flushed + w->len;
+}
+
+// Appends n bytes to w and returns a pointer to them.
+static inline uint8_t *bw_reserve(ByteWriter *w, size_t n) {
+	if (w->len + n > w->cap)
+		return bw_reserve_slow(w, n);
+	uint8_t *p = w->buf + w->len;
+	w->len += n;
+	return p;
+}
+
+static inline void bw_u8(ByteWriter *w, uint8_t n) {
+	*bw_reserve(w, 1) = n;
+}
+
+static inline void bw_u16(ByteWriter *w, uint16_t n) {
+	put_le16(bw_reserve(w, 2), n);
+}
+
+static inline void bw_u32(ByteWriter *w, uint32_t n) {
+	put_le32(bw_reserve(w, 4), n);
+}
+
+static inline void bw_u64(ByteWriter *w, uint64_t n) {
+	put_le64(bw_reserve(w, 8), n);
+}
+
+// arena.c
+
+typedef struct ArenaChunk ArenaChunk;
+
+// A region allocator. An arena must not be used by multiple threads at the
+// same time.
+typedef struct {
+	const char *name;  // arenas with the same name are summed up in statistics
+	ArenaChunk *chunk;
+	size_t count;      // number of allocations
+	size_t bytes;      // bytes currently allocated
+	size_t peak;       // maximum of `bytes`
+} Arena;
+
+Arena *new_arena(const char *name);
+void *arena_alloc(Arena *a, size_t size);  // returns zero-filled memory
+char *arena_strndup(Arena *a, const char *s, size_t n);
+void arena_reset(Arena *a);
+void arena_print_stats(FILE *fp);
+
+// intern.c
+
+// Returns the canonical copy of s[0..n). Equal strings are interned to the
+// same address, so they can be compared by pointer. Interned strings live
+// until the program exits. Thread-safe.
+const char *intern(const char *s, size_t n);
+const char *intern_str(const char *s);
+uint32_t intern_hash(const char *s);  // precomputed hash of an interned string
+// Returns a HashMap keyed by interned strings. Lookup needs no string
+// comparison, but keys must be interned.
+HashMap *new_interned_hash(void);
+
 // ald.c
 
+#define ALD_MAX_VOLUMES 26
+
 typedef struct {
 	const char *name;  // in SJIS
 	time_t timestamp;
-	const uint8_t *data;
+	const uint8_t *data;  // if NULL, the contents are read from `path` on write
 	int size;
 	int volume;  // volume id (1 for *A.ALD, 2 for *B.ALD, ...)
+	const char *path;
 } AldEntry;
 
 void ald_write(Vector *entries, int volume, FILE *fp);
+// Writes each volume v for which paths[v] is not NULL, using up to `jobs`
+// threads. If dedup is true, entries with the same name, timestamp and contents
+// in a volume are stored once and share a pointer. Returns the number of bytes
+// saved by that.
+int64_t ald_write_volumes(Vector *entries, char *paths[ALD_MAX_VOLUMES + 1], int jobs, bool dedup);
 Vector *ald_read(Vector *entries, const char *path);
+// Replaces the contents and timestamps of the entries in the volume file at
+// `path` that have the same names (ignoring case) as `entries`. An entry that
+// still fits in its sectors is overwritten in place; others are moved to the
+// end of the volume. Returns the number of moved entries.
+int ald_update(const char *path, Vector *entries);
+// Rewrites the volume file at `path` without the space left by moved entries.
+void ald_compact(const char *path);
+
+// A set of ALD volumes. Only the link tables are read when volumes are added;
+// a volume is mapped when one of its entries is first requested.
+typedef struct AldArchive AldArchive;
+AldArchive *new_ald_archive(void);
+bool ald_add_volume(AldArchive *ar, const char *path);  // false if not an ALD file
+int ald_count(AldArchive *ar);  // number of entry slots
+AldEntry *ald_get(AldArchive *ar, int index);  // NULL if there is no such entry
+// Returns the index of the first entry whose name matches sjis_name, ignoring
+// ASCII case, or -1. The name index is built on the first call.
+int ald_find(AldArchive *ar, const char *sjis_name);
+// Returns the descriptor of the volume file that holds e, and the offset of
+// e->data in it. See write_fd().
+int ald_entry_fd(AldArchive *ar, const AldEntry *e, int64_t *offset);
+void ald_close(AldArchive *ar);  // invalidates all entries returned by ald_get
 
 // System39.ain
 
@@ -373,3 +694,28 @@ enum {
 	COMMAND_CONST = 0x82,
 	COMMAND_PRAGMA = 0x83,
 };
+
+// commands.c
+
+#define NR_COMMANDS_2F 0x8d
+
+typedef struct {
+	const char *name;  // name in the source code, or NULL
+	const char *args;  // argument signature, or NULL if it has a special syntax
+	SysVer sys_ver;    // the first version in which `name` compiles to this command
+} CommandInfo;
+
+// Indexed by the second byte of the 2F-prefixed commands.
+extern const CommandInfo commands_2f[NR_COMMANDS_2F];
+
+// Returns the CommandInfo for a 2F-prefixed command, or NULL if `cmd` is not
+// one.
+static inline const CommandInfo *command_info(int cmd) {
+	if ((cmd & 0xff) != 0x2f || cmd >> 8 >= NR_COMMANDS_2F)
+		return NULL;
+	return &commands_2f[cmd >> 8];
+}
+
+// Returns the 2F-prefixed command (COMMAND_*) that `name` is compiled to, or
+// 0 if not found.
+int lookup_command(const char *name, int len, SysVer sys_ver);
@@ -17,11 +17,17 @@
 */
 
 void ald_test(void);
+void bytes_test(void);
+void commands_test(void);
+void container_test(void);
 void sjisutf_test(void);
 void util_test(void);
 
 int main() {
 	ald_test();
+	bytes_test();
+	commands_test();
+	container_test();
 	sjisutf_test();
 	util_test();
 }
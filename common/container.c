@@ -43,6 +43,14 @@ void vec_set(Vector *v, int index, void *e) {
 	v->data[index] = e;
 }
 
+void *grow_array(void *data, int *cap, int n, size_t elem_size) {
+	int new_cap = *cap ? *cap : 16;
+	while (new_cap < n)
+		new_cap *= 2;
+	*cap = new_cap;
+	return realloc(data, new_cap * elem_size);
+}
+
 void stack_push(Vector *stack, uintptr_t n) {
 	vec_push(stack, (void *)n);
 }
@@ -63,19 +71,32 @@ Map *new_map(void) {
 	Map *m = malloc(sizeof(Map));
 	m->keys = new_vec();
 	m->vals = new_vec();
+	m->index = NULL;
+	m->indexed = 0;
 	return m;
 }
 
+// Adds keys that are not indexed yet (e.g. pushed to m->keys directly).
+static void map_update_index(Map *m) {
+	if (!m->index || m->keys->len < m->indexed) {
+		m->index = new_string_hash();
+		m->indexed = 0;
+	}
+	hash_reserve(m->index, m->keys->len);
+	for (; m->indexed < m->keys->len; m->indexed++)
+		hash_put(m->index, m->keys->data[m->indexed], (void *)(intptr_t)(m->indexed + 1));
+}
+
 void map_put(Map *m, const char *key, void *val) {
 	vec_push(m->keys, (void *)key);
 	vec_push(m->vals, val);
+	map_update_index(m);
 }
 
 void *map_get(Map *m, const char *key) {
-	for (int i = m->keys->len - 1; i >= 0; i--)
-		if (!strcmp(m->keys->data[i], key))
-			return m->vals->data[i];
-	return NULL;
+	map_update_index(m);
+	intptr_t i = (intptr_t)hash_get(m->index, key);
+	return i ? m->vals->data[i - 1] : NULL;
 }
 
 HashMap *new_hash(HashFunc hash, HashKeyCompare compare) {
@@ -87,59 +108,127 @@ HashMap *new_hash(HashFunc hash, HashKeyCompare compare) {
 	return m;
 }
 
-static uint32_t string_hash(const char *p) {
-	// FNV hash
-	uint32_t r = 2166136261;
-	for (; *p; p++) {
-		r ^= *p;
-		r *= 16777619;
+void free_hash(HashMap *m) {
+	free(m->table);
+	free(m);
+}
+
+uint32_t hash_bytes(const void *data, size_t n) {
+	// Mixes 8 bytes at a time, with the finalizer of MurmurHash3.
+	const uint8_t *p = data;
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ n;
+	for (; n >= 8; p += 8, n -= 8) {
+		uint64_t w;
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
 	}
-	return r;
+	uint64_t w = 0;
+	for (size_t i = 0; i < n; i++)
+		w |= (uint64_t)p[i] << (i * 8);
+	h = (h ^ w) * 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint32_t string_hash(const char *p) {
+	return hash_bytes(p, strlen(p));
 }
 
 HashMap *new_string_hash(void) {
 	return new_hash((HashFunc)string_hash, (HashKeyCompare)strcmp);
 }
 
-static void maybe_rehash(HashMap *m) {
-	if (m->occupied * 4 < m->size * 3)
-		return;
-	HashMap old = *m;
-	m->size *= 2;
-	m->table = calloc(m->size, sizeof(HashItem));
+// Distance of the item in slot i from the slot it hashes to.
+static inline uint32_t probe_distance(HashMap *m, uint32_t i) {
+	return (i - m->table[i].hash) & (m->size - 1);
+}
+
+// Robin Hood insertion: an item that is further from its home slot takes the
+// place of one that is closer. This keeps probe sequences short, and lets
+// lookups stop early. `item.key` must not be in m.
+static void insert_item(HashMap *m, HashItem item) {
+	uint32_t mask = m->size - 1;
+	uint32_t i = item.hash & mask;
+	for (uint32_t dist = 0; m->table[i].key; i = (i + 1) & mask, dist++) {
+		uint32_t d = probe_distance(m, i);
+		if (d < dist) {
+			HashItem tmp = m->table[i];
+			m->table[i] = item;
+			item = tmp;
+			dist = d;
+		}
+	}
+	m->table[i] = item;
+	m->occupied++;
+}
+
+static void resize(HashMap *m, uint32_t size) {
+	HashItem *old = m->table;
+	uint32_t old_size = m->size;
+	m->size = size;
+	m->table = calloc(size, sizeof(HashItem));
 	m->occupied = 0;
-	for (uint32_t i = 0; i < old.size; i++) {
-		if (old.table[i].key)
-			hash_put(m, old.table[i].key, old.table[i].val);
+	for (uint32_t i = 0; i < old_size; i++) {
+		if (old[i].key)
+			insert_item(m, old[i]);
+	}
+	free(old);
+}
+
+void hash_reserve(HashMap *m, uint32_t n) {
+	uint32_t size = m->size;
+	while (n * 4 >= size * 3)
+		size *= 2;
+	if (size != m->size)
+		resize(m, size);
+}
+
+static HashItem *find_item(HashMap *m, const void *key, uint32_t hash) {
+	uint32_t mask = m->size - 1;
+	for (uint32_t i = hash & mask, dist = 0; m->table[i].key; i = (i + 1) & mask, dist++) {
+		if (probe_distance(m, i) < dist)
+			break;  // key would have displaced this item
+		if (m->table[i].hash == hash && !m->compare(key, m->table[i].key))
+			return &m->table[i];
 	}
-	free(old.table);
+	return NULL;
 }
 
 void hash_put(HashMap *m, const void *key, const void *val) {
-	maybe_rehash(m);
-	uint32_t h = m->hash(key) & (m->size - 1);
-	while (m->table[h].key) {
-		if (!m->compare(key, m->table[h].key)) {
-			m->table[h].val = (void *)val;
-			return;
-		}
-		if (++h == m->size)
-			h = 0;
+	uint32_t hash = m->hash(key);
+	HashItem *item = find_item(m, key, hash);
+	if (item) {
+		item->val = (void *)val;
+		return;
 	}
-	m->table[h].key = key;
-	m->table[h].val = (void *)val;
-	m->occupied++;
+	if (m->occupied * 4 >= m->size * 3)
+		resize(m, m->size * 2);
+	insert_item(m, (HashItem){ .key = key, .val = (void *)val, .hash = hash });
 }
 
 void *hash_get(HashMap *m, const void *key) {
-	uint32_t h = m->hash(key) & (m->size - 1);
-	while (m->table[h].key) {
-		if (!m->compare(key, m->table[h].key))
-			return m->table[h].val;
-		if (++h == m->size)
-			h = 0;
+	HashItem *item = find_item(m, key, m->hash(key));
+	return item ? item->val : NULL;
+}
+
+void *hash_remove(HashMap *m, const void *key) {
+	HashItem *item = find_item(m, key, m->hash(key));
+	if (!item)
+		return NULL;
+	void *val = item->val;
+	// Shift the following items back, so that no tombstone is needed.
+	uint32_t mask = m->size - 1;
+	uint32_t i = item - m->table;
+	for (uint32_t next = (i + 1) & mask; m->table[next].key && probe_distance(m, next); next = (next + 1) & mask) {
+		m->table[i] = m->table[next];
+		i = next;
 	}
-	return NULL;
+	m->table[i] = (HashItem){0};
+	m->occupied--;
+	return val;
 }
 
 HashItem *hash_iterate(HashMap *m, HashItem *item) {
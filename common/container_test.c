@@ -0,0 +1,148 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+#undef NDEBUG
+#include "common.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static void test_map(void) {
+	Map *m = new_map();
+	assert(map_get(m, "a") == NULL);
+
+	char keys[100][8];
+	for (int i = 0; i < 100; i++) {
+		sprintf(keys[i], "k%d", i);
+		map_put(m, keys[i], (void *)(intptr_t)(i + 1));
+	}
+	for (int i = 0; i < 100; i++)
+		assert(map_get(m, keys[i]) == (void *)(intptr_t)(i + 1));
+	assert(map_get(m, "k100") == NULL);
+
+	// The last value wins, and the insertion order is kept.
+	map_put(m, "k3", "new");
+	assert(!strcmp(map_get(m, "k3"), "new"));
+	assert(m->keys->len == 101);
+	assert(!strcmp(m->keys->data[100], "k3"));
+
+	// Keys pushed directly are found too.
+	vec_push(m->keys, "direct");
+	vec_push(m->vals, "val");
+	assert(!strcmp(map_get(m, "direct"), "val"));
+
+	// So are keys in replaced vectors.
+	m->keys = new_vec();
+	m->vals = new_vec();
+	vec_push(m->keys, "x");
+	vec_push(m->vals, "y");
+	assert(!strcmp(map_get(m, "x"), "y"));
+	assert(map_get(m, "k0") == NULL);
+}
+
+static void test_intern(void) {
+	char buf[] = "foobar";
+	const char *foo = intern(buf, 3);
+	assert(!strcmp(foo, "foo"));
+	assert(intern_str("foo") == foo);
+	assert(intern(buf + 3, 3) != foo);
+	assert(intern_hash(intern_str("bar")) == intern_hash(intern(buf + 3, 3)));
+	assert(intern(buf, 0)[0] == '\0');
+
+	HashMap *h = new_interned_hash();
+	char keys[10000][8];
+	for (int i = 0; i < 10000; i++) {
+		sprintf(keys[i], "s%d", i);
+		hash_put(h, intern_str(keys[i]), (void *)(intptr_t)(i + 1));
+	}
+	for (int i = 0; i < 10000; i++)
+		assert(hash_get(h, intern_str(keys[i])) == (void *)(intptr_t)(i + 1));
+	assert(hash_get(h, intern_str("s10000")) == NULL);
+}
+
+typedef struct {
+	int key;
+	int val;
+} Pair;
+DEFINE_VECTOR(PairVec, Pair, pairvec)
+
+static int pair_compare(const Pair *a, const Pair *b) {
+	return a->key - b->key;
+}
+
+static void test_typed_vector(void) {
+	PairVec v = {0};
+	assert(!pairvec_bsearch(&v, &(Pair){ .key = 1 }, pair_compare));
+	for (int i = 0; i < 1000; i++) {
+		Pair *p = pairvec_push(&v);
+		assert(p->key == 0 && p->val == 0);
+		p->key = (i * 7) % 1000;
+		p->val = i;
+	}
+	assert(v.len == 1000 && v.cap >= 1000);
+
+	Pair extra[] = { { 1000, -1 }, { 1001, -2 } };
+	pairvec_append(&v, extra, 2);
+	assert(v.len == 1002 && v.data[1001].val == -2);
+
+	pairvec_sort(&v, pair_compare);
+	for (int i = 0; i < v.len; i++)
+		assert(v.data[i].key == i);
+	Pair *found = pairvec_bsearch(&v, &(Pair){ .key = 7 }, pair_compare);
+	assert(found && found->val == 1);
+	assert(!pairvec_bsearch(&v, &(Pair){ .key = 2000 }, pair_compare));
+}
+
+static void test_hash(void) {
+	HashMap *h = new_string_hash();
+	hash_reserve(h, 1000);
+	char keys[1000][8];
+	for (int i = 0; i < 1000; i++) {
+		sprintf(keys[i], "h%d", i);
+		hash_put(h, keys[i], (void *)(intptr_t)(i + 1));
+	}
+	assert(h->occupied == 1000);
+
+	// Remove every third key, then check that the rest are still found.
+	for (int i = 0; i < 1000; i += 3)
+		assert(hash_remove(h, keys[i]) == (void *)(intptr_t)(i + 1));
+	assert(hash_remove(h, "h0") == NULL);
+	for (int i = 0; i < 1000; i++)
+		assert(hash_get(h, keys[i]) == (i % 3 ? (void *)(intptr_t)(i + 1) : NULL));
+
+	int n = 0;
+	for (HashItem *i = hash_iterate(h, NULL); i; i = hash_iterate(h, i))
+		n++;
+	assert(n == h->occupied && n == 666);
+
+	// Removed keys can be put again.
+	for (int i = 0; i < 1000; i += 3)
+		hash_put(h, keys[i], "again");
+	assert(!strcmp(hash_get(h, "h999"), "again"));
+	assert(h->occupied == 1000);
+
+	assert(hash_bytes("abcdefghi", 9) != hash_bytes("abcdefghj", 9));
+	assert(hash_bytes("abc", 3) != hash_bytes("abc", 4));
+}
+
+void container_test(void) {
+	test_map();
+	test_typed_vector();
+	test_hash();
+	test_intern();
+}
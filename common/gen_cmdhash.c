@@ -0,0 +1,72 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// Generates cmdhash.h, the hash table used by lookup_command():
+//
+// - COMMAND_HASH_SEED: the smallest seed with which command_hash() has no
+//   collisions for the names in commands_2f.
+// - command_hash_table: the index in commands_2f for each hash value, or 0xff.
+
+#define GEN_CMDHASH
+#include "commands.c"
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: gen_cmdhash <output>\n");
+		return 1;
+	}
+
+	uint8_t table[1 << COMMAND_HASH_BITS];
+	uint64_t seed;
+	for (seed = 0;; seed++) {
+		memset(table, 0xff, sizeof(table));
+		bool ok = true;
+		for (int i = 0; i < NR_COMMANDS_2F && ok; i++) {
+			const char *name = commands_2f[i].name;
+			if (!name)
+				continue;
+			unsigned h = command_hash(name, strlen(name), seed);
+			if (table[h] != 0xff)
+				ok = false;
+			table[h] = i;
+		}
+		if (ok)
+			break;
+	}
+
+	FILE *fp = fopen(argv[1], "w");
+	if (!fp) {
+		perror(argv[1]);
+		return 1;
+	}
+	fprintf(fp, "// Generated by gen_cmdhash.c. Do not edit.\n");
+	fprintf(fp, "#define COMMAND_HASH_SEED %lu\n", (unsigned long)seed);
+	fprintf(fp, "static const uint8_t command_hash_table[] = {");
+	for (int i = 0; i < 1 << COMMAND_HASH_BITS; i++) {
+		if (i % 16 == 0)
+			fprintf(fp, "\n\t");
+		fprintf(fp, "0x%02x,", table[i]);
+	}
+	fprintf(fp, "\n};\n");
+
+	if (fclose(fp)) {
+		perror(argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,203 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// Generates sjistbl.h, the lookup tables derived from s2utbl.h:
+//
+// - s2u8: Shift_JIS to UTF-8. Each entry holds the UTF-8 bytes of the
+//   character (first byte in the lowest 8 bits) and the byte count in the
+//   highest 8 bits. Zero for invalid characters.
+// - u2s: Unicode (BMP) to Shift_JIS, in pages of 256 code points. Pages
+//   without any Shift_JIS character are NULL. If a code point has more than
+//   one Shift_JIS code, the smallest one is used.
+// - sjis_props: properties of 2-byte characters, indexed by the 16-bit code.
+//   See SJIS_VALID etc. in common.h.
+// - sjis_expand: the full-width characters for compacted (half-width) ones.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "s2utbl.h"
+
+// Keep in sync with common.h.
+#define SJIS_VALID        0x100
+#define SJIS_UNICODE_SAFE 0x200
+#define SJIS_GAIJI        0x400
+#define SJIS_COMPACTABLE  0x800
+
+// Full-width characters for the half-width codes 0xa0-0xdf. Codes 0xa1-0xdd
+// and the space are compacted by the compiler.
+static const uint16_t kanatbl[] = {
+	0x8140, 0x8142, 0x8175, 0x8176, 0x8141, 0x8145, 0x82f0, 0x829f,
+	0x82a1, 0x82a3, 0x82a5, 0x82a7, 0x82e1, 0x82e3, 0x82e5, 0x82c1,
+	0x815b, 0x82a0, 0x82a2, 0x82a4, 0x82a6, 0x82a8, 0x82a9, 0x82ab,
+	0x82ad, 0x82af, 0x82b1, 0x82b3, 0x82b5, 0x82b7, 0x82b9, 0x82bb,
+	0x82bd, 0x82bf, 0x82c2, 0x82c4, 0x82c6, 0x82c8, 0x82c9, 0x82ca,
+	0x82cb, 0x82cc, 0x82cd, 0x82d0, 0x82d3, 0x82d6, 0x82d9, 0x82dc,
+	0x82dd, 0x82de, 0x82df, 0x82e0, 0x82e2, 0x82e4, 0x82e6, 0x82e7,
+	0x82e8, 0x82e9, 0x82ea, 0x82eb, 0x82ed, 0x82f1, 0x814a, 0x814b
+};
+
+static uint16_t u2s[0x10000];
+static uint8_t nr_sjis[0x10000];  // number of Shift_JIS codes for each code point
+static uint16_t expand[256];
+static uint16_t props[0x10000];
+
+static uint32_t utf8_entry(uint16_t u) {
+	if (u <= 0x7f)
+		return 1 << 24 | u;
+	if (u <= 0x7ff)
+		return 2 << 24 | (0x80 | (u & 0x3f)) << 8 | (0xc0 | u >> 6);
+	return 3 << 24 | (0x80 | (u & 0x3f)) << 16 | (0x80 | (u >> 6 & 0x3f)) << 8 | (0xe0 | u >> 12);
+}
+
+static int is_lead_byte(int b1) {
+	return (0x81 <= b1 && b1 <= 0x9f) || (0xe0 <= b1 && b1 <= 0xfc);
+}
+
+static int is_trail_byte(int b2) {
+	return 0x40 <= b2 && b2 <= 0xfc && b2 != 0x7f;
+}
+
+static void compute_props(void) {
+	for (int b1 = 0x81; b1 <= 0xfc; b1++) {
+		if (!is_lead_byte(b1))
+			continue;
+		for (int b2 = 0x40; b2 <= 0xfc; b2++) {
+			uint16_t u = s2u[b1 - 0x80][b2 - 0x40];
+			if (u && is_trail_byte(b2))
+				nr_sjis[u]++;
+		}
+	}
+	for (int b1 = 0x81; b1 <= 0xfc; b1++) {
+		if (!is_lead_byte(b1))
+			continue;
+		for (int b2 = 0x40; b2 <= 0xfc; b2++) {
+			uint16_t u = s2u[b1 - 0x80][b2 - 0x40];
+			if (!u || !is_trail_byte(b2))
+				continue;
+			uint16_t p = SJIS_VALID;
+			if ((u & 0xf000) == 0xe000)
+				p |= SJIS_GAIJI;
+			else if (nr_sjis[u] == 1)
+				p |= SJIS_UNICODE_SAFE;
+			props[b1 << 8 | b2] = p;
+		}
+	}
+	// Half-width space and katakana (0xa1-0xdd).
+	expand[' '] = 0x8140;
+	for (int c = 0xa1; c <= 0xdd; c++)
+		expand[c] = kanatbl[c - 0xa0];
+	for (int c = 0; c < 256; c++) {
+		if (expand[c])
+			props[expand[c]] |= SJIS_COMPACTABLE | c;
+	}
+}
+
+static void print_table(FILE *fp, const char *decl, const uint16_t *tbl, int from, int to) {
+	fprintf(fp, "%s = {", decl);
+	for (int i = from; i < to; i++) {
+		if ((i - from) % 8 == 0)
+			fprintf(fp, "\n\t");
+		fprintf(fp, "0x%04x,", tbl[i]);
+	}
+	fprintf(fp, "\n};\n");
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: gen_sjistbl <output>\n");
+		return 1;
+	}
+	FILE *fp = fopen(argv[1], "w");
+	if (!fp) {
+		perror(argv[1]);
+		return 1;
+	}
+	fprintf(fp, "// Generated by gen_sjistbl.c. Do not edit.\n");
+
+	for (int b1 = 0x81; b1 <= 0xfc; b1++) {
+		if (!is_lead_byte(b1))
+			continue;
+		fprintf(fp, "static const uint32_t s2u8_%02x[] = {", b1);
+		for (int b2 = 0x40; b2 <= 0xff; b2++) {
+			uint16_t u = s2u[b1 - 0x80][b2 - 0x40];
+			if ((b2 - 0x40) % 8 == 0)
+				fprintf(fp, "\n\t");
+			fprintf(fp, "0x%08x,", u ? utf8_entry(u) : 0);
+			if (u && !u2s[u])
+				u2s[u] = b1 << 8 | b2;
+		}
+		fprintf(fp, "\n};\n");
+	}
+	fprintf(fp, "static const uint32_t *const s2u8[] = {");
+	for (int b1 = 0x80; b1 <= 0xff; b1++) {
+		if ((b1 - 0x80) % 8 == 0)
+			fprintf(fp, "\n\t");
+		if (is_lead_byte(b1))
+			fprintf(fp, "s2u8_%02x,", b1);
+		else
+			fprintf(fp, "NULL,");
+	}
+	fprintf(fp, "\n};\n");
+
+	for (int hi = 0; hi < 256; hi++) {
+		int used = 0;
+		for (int lo = 0; lo < 256; lo++)
+			used |= u2s[hi << 8 | lo];
+		if (!used)
+			continue;
+		char decl[40];
+		sprintf(decl, "static const uint16_t u2s_%02x[]", hi);
+		print_table(fp, decl, u2s, hi << 8, (hi + 1) << 8);
+	}
+	fprintf(fp, "static const uint16_t *const u2s[] = {");
+	for (int hi = 0; hi < 256; hi++) {
+		int used = 0;
+		for (int lo = 0; lo < 256; lo++)
+			used |= u2s[hi << 8 | lo];
+		if (hi % 8 == 0)
+			fprintf(fp, "\n\t");
+		if (used)
+			fprintf(fp, "u2s_%02x,", hi);
+		else
+			fprintf(fp, "NULL,");
+	}
+	fprintf(fp, "\n};\n");
+
+	compute_props();
+	// Only the rows of lead bytes are non-zero.
+	fprintf(fp, "const uint16_t sjis_props[0x10000] = {");
+	for (int b1 = 0x81; b1 <= 0xfc; b1++) {
+		if (!is_lead_byte(b1))
+			continue;
+		fprintf(fp, "\n\t[0x%02x40] =", b1);
+		for (int b2 = 0x40; b2 <= 0xff; b2++) {
+			if ((b2 - 0x40) % 8 == 0)
+				fprintf(fp, "\n\t");
+			fprintf(fp, "0x%04x,", props[b1 << 8 | b2]);
+		}
+	}
+	fprintf(fp, "\n};\n");
+	print_table(fp, "static const uint16_t sjis_expand[256]", expand, 0, 256);
+
+	if (fclose(fp)) {
+		perror(argv[1]);
+		return 1;
+	}
+	return 0;
+}
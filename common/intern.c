@@ -0,0 +1,97 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+#include "common.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_INIT_SIZE 4096
+
+typedef struct {
+	uint32_t hash;
+	uint32_t len;
+	char str[];
+} InternedString;
+
+// Open addressing table of all interned strings. Shared by all threads.
+static InternedString **table;
+static uint32_t table_size;
+static uint32_t occupied;
+static Arena *intern_arena;
+static pthread_mutex_t intern_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline InternedString *header(const char *s) {
+	return (InternedString *)(s - offsetof(InternedString, str));
+}
+
+static void grow_table(void) {
+	InternedString **old = table;
+	uint32_t old_size = table_size;
+	table_size = table_size ? table_size * 2 : INTERN_INIT_SIZE;
+	table = calloc(table_size, sizeof(InternedString *));
+	for (uint32_t i = 0; i < old_size; i++) {
+		if (!old[i])
+			continue;
+		uint32_t h = old[i]->hash & (table_size - 1);
+		while (table[h])
+			h = (h + 1) & (table_size - 1);
+		table[h] = old[i];
+	}
+	free(old);
+}
+
+const char *intern(const char *s, size_t n) {
+	uint32_t hash = hash_bytes(s, n);
+	pthread_mutex_lock(&intern_mutex);
+	if (occupied * 4 >= table_size * 3)
+		grow_table();
+	uint32_t h = hash & (table_size - 1);
+	for (InternedString *is; (is = table[h]); h = (h + 1) & (table_size - 1)) {
+		if (is->hash == hash && is->len == n && !memcmp(is->str, s, n)) {
+			pthread_mutex_unlock(&intern_mutex);
+			return is->str;
+		}
+	}
+	if (!intern_arena)
+		intern_arena = new_arena("intern");
+	InternedString *is = arena_alloc(intern_arena, sizeof(InternedString) + n + 1);
+	is->hash = hash;
+	is->len = n;
+	memcpy(is->str, s, n);
+	table[h] = is;
+	occupied++;
+	pthread_mutex_unlock(&intern_mutex);
+	return is->str;
+}
+
+const char *intern_str(const char *s) {
+	return intern(s, strlen(s));
+}
+
+uint32_t intern_hash(const char *s) {
+	return header(s)->hash;
+}
+
+static int pointer_compare(const void *k1, const void *k2) {
+	return k1 != k2;
+}
+
+HashMap *new_interned_hash(void) {
+	return new_hash((HashFunc)intern_hash, pointer_compare);
+}
@@ -18,6 +18,7 @@
 #include "common.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static void test_compaction(void) {
 	for (int c = 0; c < 256; c++) {
@@ -53,6 +54,134 @@ static void test_compaction(void) {
 	}
 }
 
+static void test_canonical_sjis(void) {
+	for (int c1 = 0x81; c1 <= 0xfc; c1++) {
+		for (int c2 = 0x40; c2 <= 0xfc; c2++) {
+			if (!is_valid_sjis(c1, c2))
+				continue;
+			char sjis[3] = { c1, c2, 0 };
+			char *utf = sjis2utf(sjis);
+			char *roundtrip = utf2sjis(utf);
+			uint16_t expected = (uint8_t)roundtrip[0] << 8 | (uint8_t)roundtrip[1];
+			uint16_t actual = canonical_sjis(c1, c2);
+			if (actual != expected) {
+				printf("[FAIL] canonical_sjis(0x%02x, 0x%02x): expected 0x%04x, got 0x%04x\n", c1, c2, expected, actual);
+				exit(1);
+			}
+			free(utf);
+			free(roundtrip);
+		}
+	}
+	const char *s = "abc\x82\xa0\xb1\x82";
+	if (validate_sjis("abc\x82\xa0\xb1") || validate_sjis(s) != s + 6 || !validate_sjis("\xa0")) {
+		printf("[FAIL] validate_sjis\n");
+		exit(1);
+	}
+}
+
+static void test_props(void) {
+	struct { uint16_t code; uint16_t props; } tests[] = {
+		{ 0x82a0, SJIS_VALID | SJIS_UNICODE_SAFE | SJIS_COMPACTABLE | 0xb1 },  // あ
+		{ 0x8754, SJIS_VALID },  // NEC Roman numeral one, also at 0xfa4a
+		{ 0xfa4a, SJIS_VALID },
+		{ 0xeb9f, SJIS_VALID | SJIS_GAIJI },
+		{ 0x827f, 0 },
+		{ 0x8130, 0 },
+		{ 0xa0a0, 0 },
+	};
+	for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		uint16_t actual = sjis_prop(tests[i].code >> 8, tests[i].code & 0xff);
+		if (actual != tests[i].props) {
+			printf("[FAIL] sjis_prop(0x%04x): expected 0x%04x, got 0x%04x\n", tests[i].code, tests[i].props, actual);
+			exit(1);
+		}
+	}
+}
+
+// ASCII runs of various lengths around multibyte characters.
+static void test_conversion(void) {
+	char utf[200], sjis[200];
+	for (int n = 0; n < 70; n++) {
+		memset(utf, 'a', n);
+		strcpy(utf + n, "\xe3\x81\x82\xef\xbd\xb1" "b");  // あｱb
+		memset(sjis, 'a', n);
+		strcpy(sjis + n, "\x82\xa0\xb1" "b");
+		char *s = utf2sjis(utf);
+		char *u = sjis2utf(sjis);
+		if (strcmp(s, sjis) || strcmp(u, utf) || validate_utf8(utf) || validate_sjis(sjis)) {
+			printf("[FAIL] conversion with %d ASCII characters\n", n);
+			exit(1);
+		}
+		free(s);
+		free(u);
+	}
+}
+
+// Converts src in chunks of at most `chunk` input bytes into an output buffer
+// of `cap` bytes, carrying unconsumed bytes over to the next call.
+static void conv_in_chunks(size_t (*conv)(const char *, size_t *, char *, size_t, int),
+						   const char *src, size_t chunk, size_t cap, char *out) {
+	size_t pos = 0, len = strlen(src), out_len = 0;
+	char buf[16];
+	while (pos < len) {
+		size_t n = len - pos < chunk ? len - pos : chunk;
+		size_t produced = conv(src + pos, &n, buf, cap, -1);
+		if (!n && !produced && pos + chunk >= len) {
+			printf("[FAIL] conversion stalled at %zu (chunk %zu, cap %zu)\n", pos, chunk, cap);
+			exit(1);
+		}
+		memcpy(out + out_len, buf, produced);
+		out_len += produced;
+		pos += n;
+		if (!n)
+			chunk++;  // need more input to complete a character
+	}
+	out[out_len] = '\0';
+}
+
+static void test_streaming(void) {
+	const char *utf = "a\xe3\x81\x82\xef\xbd\xb1" "bc\xe6\xbc\xa2\xe5\xad\x97";  // aあｱbc漢字
+	const char *sjis = "a\x82\xa0\xb1" "bc\x8a\xbf\x8e\x9a";
+	char out[100];
+	for (size_t chunk = 1; chunk < 8; chunk++) {
+		for (size_t cap = 3; cap < 8; cap++) {
+			conv_in_chunks(sjis2utf_conv, sjis, chunk, cap, out);
+			if (strcmp(out, utf)) {
+				printf("[FAIL] sjis2utf_conv (chunk %zu, cap %zu)\n", chunk, cap);
+				exit(1);
+			}
+			conv_in_chunks(utf2sjis_conv, utf, chunk, cap, out);
+			if (strcmp(out, sjis)) {
+				printf("[FAIL] utf2sjis_conv (chunk %zu, cap %zu)\n", chunk, cap);
+				exit(1);
+			}
+		}
+	}
+
+	// A truncated character is left unconsumed.
+	size_t len = 2;
+	if (sjis2utf_conv("a\x82", &len, out, sizeof(out), -1) != 1 || len != 1) {
+		printf("[FAIL] sjis2utf_conv with a truncated character\n");
+		exit(1);
+	}
+
+	char small[4];
+	const char *r = sjis2utf_buf("\x82\xa0", small, sizeof(small));
+	if (r != small || strcmp(r, "\xe3\x81\x82")) {
+		printf("[FAIL] sjis2utf_buf into a caller buffer\n");
+		exit(1);
+	}
+	r = sjis2utf_buf("a\x82\xa0", small, sizeof(small));
+	if (r == small || strcmp(r, "a\xe3\x81\x82")) {
+		printf("[FAIL] sjis2utf_buf fallback\n");
+		exit(1);
+	}
+}
+
 void sjisutf_test(void) {
 	test_compaction();
+	test_canonical_sjis();
+	test_props();
+	test_conversion();
+	test_streaming();
 }
@@ -18,10 +18,13 @@
 #include "common.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #ifdef _WIN32
 #include <windows.h>
 #include <direct.h>
@@ -118,6 +121,17 @@ int checked_open(const char *path_utf8, int oflag) {
 	return fd;
 }
 
+int checked_create(const char *path_utf8) {
+#ifdef _WIN32
+	int fd = _wopen(utf8_to_wchar(path_utf8), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	int fd = open(path_utf8, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+#endif
+	if (fd == -1)
+		error("cannot open %s: %s", path_utf8, strerror(errno));
+	return fd;
+}
+
 static inline bool is_path_separator(char c) {
 #ifdef _WIN32
 	return c == '/' || c == '\\';
@@ -192,6 +206,14 @@ char *path_join(const char *dir, const char *path) {
 	return buf;
 }
 
+const char *path_join_buf(const char *dir, const char *path, char *buf, size_t size) {
+	if (!dir || is_absolute_path(path))
+		return path;
+	if (snprintf(buf, size, "%s/%s", dir, path) >= size)
+		return path_join(dir, path);
+	return buf;
+}
+
 int make_dir(const char *path_utf8) {
 #if defined(_WIN32)
 	return _wmkdir(utf8_to_wchar(path_utf8));
@@ -254,45 +276,78 @@ int stat_utf8(const char *path, ustat *st) {
 #endif
 }
 
-uint16_t fgetw(FILE *fp) {
-	int lo = fgetc(fp);
-	int hi = fgetc(fp);
-	return lo | hi << 8;
+void checked_rename(const char *from_utf8, const char *to_utf8) {
+#ifdef _WIN32
+	if (!MoveFileExW(utf8_to_wchar(from_utf8), utf8_to_wchar(to_utf8), MOVEFILE_REPLACE_EXISTING))
+		error("cannot rename %s to %s", from_utf8, to_utf8);
+#else
+	if (rename(from_utf8, to_utf8) != 0)
+		error("cannot rename %s to %s: %s", from_utf8, to_utf8, strerror(errno));
+#endif
 }
 
-uint32_t fgetdw(FILE *fp) {
-	int lo = fgetw(fp);
-	int hi = fgetw(fp);
-	return lo | hi << 16;
+uint64_t fnv1a64(const void *data, size_t len, uint64_t h) {
+	const uint8_t *p = data;
+	for (size_t i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
 }
 
-uint64_t fget64(FILE *fp) {
-	uint32_t lo = fgetdw(fp);
-	uint32_t hi = fgetdw(fp);
-	return lo | (uint64_t)hi << 32;
+time_t win_filetime_to_time_t(uint64_t t) {
+	return (t - EPOCH_DIFF_100NS) / 10000000LL;
 }
 
-void fputw(uint16_t n, FILE *fp) {
-	fputc(n, fp);
-	fputc(n >> 8, fp);
+uint64_t time_t_to_win_filetime(time_t t) {
+	return t * 10000000LL + EPOCH_DIFF_100NS;
 }
 
-void fputdw(uint32_t n, FILE *fp) {
-	fputc(n, fp);
-	fputc(n >> 8, fp);
-	fputc(n >> 16, fp);
-	fputc(n >> 24, fp);
+int nr_cpus(void) {
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+#else
+	return 1;
+#endif
 }
 
-void fput64(uint64_t n, FILE *fp) {
-	fputdw(n, fp);
-	fputdw(n >> 32, fp);
-}
+typedef struct {
+	void (*func)(void *data, int i);
+	void *data;
+	int n;
+	atomic_int next;
+} ParallelFor;
 
-time_t win_filetime_to_time_t(uint64_t t) {
-	return (t - EPOCH_DIFF_100NS) / 10000000LL;
+static void *parallel_for_worker(void *arg) {
+	ParallelFor *pf = arg;
+	int i;
+	while ((i = atomic_fetch_add(&pf->next, 1)) < pf->n)
+		pf->func(pf->data, i);
+	return NULL;
 }
 
-uint64_t time_t_to_win_filetime(time_t t) {
-	return t * 10000000LL + EPOCH_DIFF_100NS;
+void parallel_for(int n, int jobs, void (*func)(void *data, int i), void *data) {
+	ParallelFor pf = { .func = func, .data = data, .n = n };
+	atomic_init(&pf.next, 0);
+	if (jobs > n)
+		jobs = n;
+
+	// The calling thread works as one of the workers.
+	pthread_t *threads = calloc(jobs > 1 ? jobs - 1 : 1, sizeof(pthread_t));
+	int nr_threads = 0;
+	while (nr_threads < jobs - 1) {
+		// If a thread cannot be created, the existing ones do the rest.
+		if (pthread_create(&threads[nr_threads], NULL, parallel_for_worker, &pf))
+			break;
+		nr_threads++;
+	}
+	parallel_for_worker(&pf);
+	for (int i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
 }
@@ -108,18 +108,19 @@ static void ain_emit_MSGI_head(Buffer *out, int msg_count) {
 	emit_dword(out, msg_count);
 }
 
-static void ain_write_buf(Buffer *buf, FILE *fp) {
-	uint8_t *end = buf->buf + buf->len;
-	for (uint8_t *p = buf->buf; p < end; p++)
-		fputc(*p >> 2 | *p << 6, fp);
+static void ain_write_buf(Buffer *buf, ByteWriter *w) {
+	uint8_t *dst = bw_reserve(w, buf->len);
+	for (int i = 0; i < buf->len; i++)
+		dst[i] = buf->buf[i] >> 2 | buf->buf[i] << 6;
 }
 
 void ain_write(Compiler *compiler, FILE *fp) {
+	ByteWriter *w = new_byte_writer(fp);
 	switch (config.ain_magic) {
-	case MAGIC_AINI: fputs("AINI", fp); break;
-	case MAGIC_AIN2: fputs("AIN2", fp); break;
+	case MAGIC_AINI: bw_bytes(w, "AINI", 4); break;
+	case MAGIC_AIN2: bw_bytes(w, "AIN2", 4); break;
 	}
-	fputdw(config.ain_version, fp);
+	bw_u32(w, config.ain_version);
 	Buffer *out = new_buf();
 	ain_emit_HEL0(out, compiler->dlls);
 	ain_emit_FUNC(out, compiler->functions);
@@ -127,7 +128,8 @@ void ain_write(Compiler *compiler, FILE *fp) {
 		ain_emit_VARI(out, compiler->variables);
 	if (compiler->msg_count > 0)
 		ain_emit_MSGI_head(out, compiler->msg_count);
-	ain_write_buf(out, fp);
+	ain_write_buf(out, w);
 	if (compiler->msg_count > 0)
-		ain_write_buf(compiler->msg_buf, fp);
+		ain_write_buf(compiler->msg_buf, w);
+	free_byte_writer(w);
 }
@@ -0,0 +1,454 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// Build cache. For each page, the cache stores the declarations made in the
+// first pass and the compiled SCO of the second pass.
+//
+// The first pass of a page depends only on its source and the global symbols
+// defined by the preceding pages, so its result is reused if the source hash
+// and the digest of the symbols defined so far are unchanged. The second pass
+// depends on the source and all global symbols. Function addresses and
+// message IDs are not part of the SCO until link_scos(), so changes to other
+// pages do not invalidate it unless they change the global symbols.
+
+#include "xsys35c.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_MAGIC "XCCH"
+#define CACHE_VERSION 1
+
+typedef struct {
+	uint32_t addr;
+	const char *name;
+} CachedFuncRef;
+
+typedef struct {
+	const char *path;
+	uint64_t source_hash;
+	uint64_t symbols_before;  // digest of global symbols before this page
+	int msg_count;
+	Vector *decls;
+
+	// Second pass
+	uint64_t symbols;  // digest of all global symbols
+	int ald_volume;
+	Buffer *buf;
+	Vector *func_addrs;  // addresses of DECL_FUNCTIONs in decls
+	Vector *func_refs;   // CachedFuncRef*
+	Vector *msg_refs;
+	Buffer *msg_buf;
+	LineVec lines;
+	FuncVec functions;
+} CacheEntry;
+
+typedef struct BuildCache {
+	Compiler *compiler;
+	Vector *entries;  // CacheEntry* indexed by page, NULL if unusable
+	uint64_t *source_hashes;
+	uint64_t *symbols_before;
+	uint64_t symbols;  // digest of global symbols defined so far
+} BuildCache;
+
+static uint64_t digest_int(uint64_t h, uint32_t n) {
+	uint8_t buf[4] = { n, n >> 8, n >> 16, n >> 24 };
+	return fnv1a64(buf, 4, h);
+}
+
+static uint64_t digest_str(uint64_t h, const char *s) {
+	return fnv1a64(s, strlen(s) + 1, h);
+}
+
+static uint64_t digest_initial_state(Compiler *comp) {
+	uint64_t h = digest_str(FNV64_INIT, VERSION);
+	h = digest_int(h, config.sys_ver);
+	h = digest_int(h, config.sco_ver);
+	h = digest_int(h, config.debug);
+	h = digest_int(h, config.unicode);
+	h = digest_int(h, config.utf8);
+	h = digest_int(h, config.disable_else);
+	h = digest_int(h, config.disable_ain_message);
+	h = digest_int(h, config.old_SR);
+
+	h = digest_int(h, comp->src_paths->len);
+	for (int i = 0; i < comp->src_paths->len; i++)
+		h = digest_str(h, comp->src_paths->data[i]);
+	h = digest_int(h, comp->variables->len);
+	for (int i = 0; i < comp->variables->len; i++)
+		h = digest_str(h, comp->variables->data[i]);
+	h = digest_int(h, comp->dlls->keys->len);
+	for (int i = 0; i < comp->dlls->keys->len; i++) {
+		h = digest_str(h, comp->dlls->keys->data[i]);
+		Vector *funcs = comp->dlls->vals->data[i];
+		h = digest_int(h, funcs->len);
+		for (int j = 0; j < funcs->len; j++) {
+			DLLFunc *f = funcs->data[j];
+			h = digest_str(h, f->name);
+			h = digest_int(h, f->argc);
+			for (uint32_t k = 0; k < f->argc; k++)
+				h = digest_int(h, f->argtypes[k]);
+		}
+	}
+	return h;
+}
+
+static uint64_t digest_decls(uint64_t h, Vector *decls) {
+	h = digest_int(h, decls->len);
+	for (int i = 0; i < decls->len; i++) {
+		Declaration *d = decls->data[i];
+		h = digest_int(h, d->type);
+		h = digest_str(h, d->name);
+		switch (d->type) {
+		case DECL_VARIABLE:
+			break;
+		case DECL_CONST:
+			h = digest_int(h, d->value);
+			break;
+		case DECL_FUNCTION:
+			h = digest_int(h, d->func->params->len);
+			for (int j = 0; j < d->func->params->len; j++)
+				h = digest_str(h, d->func->params->data[j]);
+			break;
+		}
+	}
+	return h;
+}
+
+// Symbol tables are keyed by interned strings.
+static const char *read_symbol(ByteReader *r) {
+	return intern_str(br_str(r));
+}
+
+static Buffer *read_buf(ByteReader *r) {
+	uint32_t len = br_u32(r);
+	const uint8_t *data = br_bytes(r, len);
+	if (!data)
+		return NULL;
+	Buffer *b = malloc(sizeof(Buffer));
+	b->buf = malloc(len ? len : 1);
+	memcpy(b->buf, data, len);
+	b->len = b->cap = len;
+	return b;
+}
+
+static CacheEntry *read_entry(ByteReader *r, int pageno) {
+	CacheEntry *e = calloc(1, sizeof(CacheEntry));
+	e->path = br_str(r);
+	e->source_hash = br_u64(r);
+	e->symbols_before = br_u64(r);
+	e->msg_count = br_u32(r);
+
+	e->decls = new_vec();
+	for (uint32_t n = br_u32(r); n > 0 && !r->error; n--) {
+		Declaration *d = calloc(1, sizeof(Declaration));
+		d->type = br_u32(r);
+		d->name = read_symbol(r);
+		switch (d->type) {
+		case DECL_VARIABLE:
+			break;
+		case DECL_CONST:
+			d->value = br_u32(r);
+			break;
+		case DECL_FUNCTION:
+			d->func = calloc(1, sizeof(Function));
+			d->func->name = d->name;
+			d->func->page = pageno + 1;
+			d->func->params = new_vec();
+			for (uint32_t i = br_u32(r); i > 0 && !r->error; i--)
+				vec_push(d->func->params, (char *)read_symbol(r));
+			break;
+		default:
+			r->error = true;
+			break;
+		}
+		vec_push(e->decls, d);
+	}
+
+	e->symbols = br_u64(r);
+	e->ald_volume = br_u32(r);
+	e->buf = read_buf(r);
+	e->func_addrs = new_vec();
+	for (uint32_t n = br_u32(r); n > 0 && !r->error; n--)
+		stack_push(e->func_addrs, br_u32(r));
+	e->func_refs = new_vec();
+	for (uint32_t n = br_u32(r); n > 0 && !r->error; n--) {
+		CachedFuncRef *ref = calloc(1, sizeof(CachedFuncRef));
+		ref->addr = br_u32(r);
+		ref->name = read_symbol(r);
+		vec_push(e->func_refs, ref);
+	}
+	e->msg_refs = new_vec();
+	for (uint32_t n = br_u32(r); n > 0 && !r->error; n--)
+		stack_push(e->msg_refs, br_u32(r));
+	if (br_u32(r))
+		e->msg_buf = read_buf(r);
+	for (uint32_t n = br_u32(r); n > 0 && !r->error; n--) {
+		LineInfo *li = linevec_push(&e->lines);
+		li->line = br_u32(r);
+		li->addr = br_u32(r);
+	}
+	for (uint32_t n = br_u32(r); n > 0 && !r->error; n--) {
+		FuncInfo *fi = funcvec_push(&e->functions);
+		fi->name = br_str(r);
+		fi->page = pageno;
+		fi->addr = br_u32(r);
+		fi->is_local = true;
+	}
+	return e;
+}
+
+static void free_vector(Vector *v) {
+	if (!v)
+		return;
+	free(v->data);
+	free(v);
+}
+
+static void free_buffer(Buffer *b) {
+	if (!b)
+		return;
+	free(b->buf);
+	free(b);
+}
+
+// Frees an entry that read_entry() returned. Strings are not freed; they are
+// interned or point into the cache file data.
+static void free_entry(CacheEntry *e) {
+	for (int i = 0; i < e->decls->len; i++) {
+		Declaration *d = e->decls->data[i];
+		if (d->type == DECL_FUNCTION) {
+			free_vector(d->func->params);
+			free(d->func);
+		}
+		free(d);
+	}
+	free_vector(e->decls);
+	free_buffer(e->buf);
+	free_vector(e->func_addrs);
+	for (int i = 0; i < e->func_refs->len; i++)
+		free(e->func_refs->data[i]);
+	free_vector(e->func_refs);
+	free_vector(e->msg_refs);
+	free_buffer(e->msg_buf);
+	free(e->lines.data);
+	free(e->functions.data);
+	free(e);
+}
+
+static Vector *read_cache_file(const char *path) {
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	uint8_t *data = malloc(size > 0 ? size : 1);
+	if (size <= 0 || fread(data, size, 1, fp) != 1) {
+		fclose(fp);
+		free(data);
+		return NULL;
+	}
+	fclose(fp);
+
+	ByteReader r;
+	br_init(&r, data, size);
+	const uint8_t *magic = br_bytes(&r, 4);
+	if (!magic || memcmp(magic, CACHE_MAGIC, 4)) {
+		fprintf(stderr, "Warning: %s: not a build cache, ignored\n", path);
+		free(data);
+		return NULL;
+	}
+	if (br_u32(&r) != CACHE_VERSION) {
+		fprintf(stderr, "Warning: %s: build cache is from a different version, ignored\n", path);
+		free(data);
+		return NULL;
+	}
+	Vector *entries = new_vec();
+	for (uint32_t n = br_u32(&r); n > 0 && !r.error; n--)
+		vec_push(entries, read_entry(&r, entries->len));
+	if (r.error || !br_eof(&r)) {
+		fprintf(stderr, "Warning: %s: broken build cache, ignored\n", path);
+		for (int i = 0; i < entries->len; i++)
+			free_entry(entries->data[i]);
+		free_vector(entries);
+		free(data);
+		return NULL;
+	}
+	return entries;
+}
+
+struct BuildCache *cache_load(const char *path, Compiler *comp) {
+	BuildCache *cache = calloc(1, sizeof(BuildCache));
+	cache->compiler = comp;
+	int nr_pages = comp->src_paths->len;
+	Vector *entries = read_cache_file(path);
+	cache->entries = new_vec();
+	for (int i = 0; i < nr_pages; i++)
+		vec_push(cache->entries, entries && i < entries->len ? entries->data[i] : NULL);
+	cache->source_hashes = calloc(nr_pages, sizeof(uint64_t));
+	cache->symbols_before = calloc(nr_pages, sizeof(uint64_t));
+	cache->symbols = digest_initial_state(comp);
+	return cache;
+}
+
+// Runs the first pass for the page, or replays its declarations from the
+// cache if the page and the preceding global symbols are unchanged.
+void cache_preprocess(BuildCache *cache, const char *source, int pageno) {
+	Compiler *comp = cache->compiler;
+	Sco *sco = &comp->scos[pageno];
+	uint64_t hash = fnv1a64(source, strlen(source), FNV64_INIT);
+	cache->source_hashes[pageno] = hash;
+	cache->symbols_before[pageno] = cache->symbols;
+
+	CacheEntry *e = cache->entries->data[pageno];
+	if (e && e->source_hash == hash && e->symbols_before == cache->symbols &&
+		!strcmp(e->path, comp->src_paths->data[pageno])) {
+		sco->decls = e->decls;
+		sco->msg_count = e->msg_count;
+		replay_declarations(comp, pageno);
+	} else {
+		cache->entries->data[pageno] = NULL;
+		preprocess(comp, source, pageno);
+	}
+	cache->symbols = digest_decls(cache->symbols, sco->decls);
+}
+
+// Restores the compiled SCO of the page, if all global symbols are unchanged.
+// Must be called after all pages are preprocessed.
+bool cache_restore_sco(BuildCache *cache, int pageno) {
+	Compiler *comp = cache->compiler;
+	Sco *sco = &comp->scos[pageno];
+	CacheEntry *e = cache->entries->data[pageno];
+	if (!e || e->symbols != cache->symbols)
+		return false;
+
+	sco->buf = e->buf;
+	sco->ald_volume = e->ald_volume;
+	sco->func_refs = new_vec();
+	for (int i = 0; i < e->func_refs->len; i++) {
+		CachedFuncRef *cref = e->func_refs->data[i];
+		FuncRef *ref = calloc(1, sizeof(FuncRef));
+		ref->addr = cref->addr;
+		ref->func = hash_get(comp->functions, cref->name);
+		if (!ref->func)
+			error("BUG: function '%s' not found in cache", cref->name);
+		vec_push(sco->func_refs, ref);
+	}
+	sco->msg_refs = e->msg_refs;
+	sco->msg_buf = e->msg_buf;
+
+	int n = 0;
+	for (int i = 0; i < sco->decls->len; i++) {
+		Declaration *d = sco->decls->data[i];
+		if (d->type != DECL_FUNCTION)
+			continue;
+		d->func->addr = (uintptr_t)e->func_addrs->data[n++];
+		d->func->resolved = true;
+	}
+
+	if (comp->dbg_info) {
+		debug_init_page(comp->dbg_info, pageno);
+		linevec_append(debug_page_lines(comp->dbg_info, pageno), e->lines.data, e->lines.len);
+		funcvec_append(debug_page_functions(comp->dbg_info, pageno), e->functions.data, e->functions.len);
+	}
+	return true;
+}
+
+static void write_buf(Buffer *b, ByteWriter *w) {
+	bw_u32(w, b->len);
+	bw_bytes(w, b->buf, b->len);
+}
+
+static void write_entry(BuildCache *cache, int pageno, ByteWriter *w) {
+	Compiler *comp = cache->compiler;
+	Sco *sco = &comp->scos[pageno];
+
+	bw_str(w, comp->src_paths->data[pageno]);
+	bw_u64(w, cache->source_hashes[pageno]);
+	bw_u64(w, cache->symbols_before[pageno]);
+	bw_u32(w, sco->msg_count);
+	bw_u32(w, sco->decls->len);
+	int nr_funcs = 0;
+	for (int i = 0; i < sco->decls->len; i++) {
+		Declaration *d = sco->decls->data[i];
+		bw_u32(w, d->type);
+		bw_str(w, d->name);
+		switch (d->type) {
+		case DECL_VARIABLE:
+			break;
+		case DECL_CONST:
+			bw_u32(w, d->value);
+			break;
+		case DECL_FUNCTION:
+			bw_u32(w, d->func->params->len);
+			for (int j = 0; j < d->func->params->len; j++)
+				bw_str(w, d->func->params->data[j]);
+			nr_funcs++;
+			break;
+		}
+	}
+
+	bw_u64(w, cache->symbols);
+	bw_u32(w, sco->ald_volume);
+	write_buf(sco->buf, w);
+	bw_u32(w, nr_funcs);
+	for (int i = 0; i < sco->decls->len; i++) {
+		Declaration *d = sco->decls->data[i];
+		if (d->type == DECL_FUNCTION)
+			bw_u32(w, d->func->addr);
+	}
+	bw_u32(w, sco->func_refs->len);
+	for (int i = 0; i < sco->func_refs->len; i++) {
+		FuncRef *ref = sco->func_refs->data[i];
+		bw_u32(w, ref->addr);
+		bw_str(w, ref->func->name);
+	}
+	bw_u32(w, sco->msg_refs->len);
+	for (int i = 0; i < sco->msg_refs->len; i++)
+		bw_u32(w, (uintptr_t)sco->msg_refs->data[i]);
+	bw_u32(w, sco->msg_buf != NULL);
+	if (sco->msg_buf)
+		write_buf(sco->msg_buf, w);
+
+	LineVec *lines = comp->dbg_info ? debug_page_lines(comp->dbg_info, pageno) : NULL;
+	bw_u32(w, lines ? lines->len : 0);
+	for (int i = 0; lines && i < lines->len; i++) {
+		LineInfo *li = &lines->data[i];
+		bw_u32(w, li->line);
+		bw_u32(w, li->addr);
+	}
+	FuncVec *functions = comp->dbg_info ? debug_page_functions(comp->dbg_info, pageno) : NULL;
+	bw_u32(w, functions ? functions->len : 0);
+	for (int i = 0; functions && i < functions->len; i++) {
+		FuncInfo *fi = &functions->data[i];
+		bw_str(w, fi->name);
+		bw_u32(w, fi->addr);
+	}
+}
+
+void cache_save(BuildCache *cache, const char *path) {
+	FILE *fp = checked_fopen(path, "wb");
+	ByteWriter *w = new_byte_writer(fp);
+	bw_bytes(w, CACHE_MAGIC, 4);
+	bw_u32(w, CACHE_VERSION);
+	bw_u32(w, cache->compiler->src_paths->len);
+	for (int i = 0; i < cache->compiler->src_paths->len; i++)
+		write_entry(cache, i, w);
+	free_byte_writer(w);
+	fclose(fp);
+}
@@ -21,10 +21,11 @@
 #include <stdlib.h>
 #include <string.h>
 
-static Compiler *compiler;
-static const char *menu_item_start;
-static bool compiling;
-static Vector *branch_end_stack;
+// Per-page state is thread-local, since pages are compiled in parallel.
+static _Thread_local Compiler *compiler;
+static _Thread_local const char *menu_item_start;
+static _Thread_local bool compiling;
+static _Thread_local Vector *branch_end_stack;
 
 typedef enum {
 	VARIABLE,
@@ -36,18 +37,59 @@ typedef struct {
 	int value;  // variable index or constant value
 } Symbol;
 
+// Objects created while processing the current page are allocated from
+// `arena`: Compiler.arena in the first pass and Sco.arena in the second pass.
+// `page_arena` is for objects that are not needed after the page is compiled.
+static _Thread_local Arena *arena;
+static _Thread_local Arena *page_arena;
+
 static Symbol *new_symbol(SymbolType type, int value) {
-	Symbol *s = calloc(1, sizeof(Symbol));
+	Symbol *s = arena_alloc(arena, sizeof(Symbol));
 	s->type = type;
 	s->value = value;
 	return s;
 }
 
-static Map *labels;
+static _Thread_local Map *labels;
+
+static _Thread_local Sco *sco;
+static _Thread_local Buffer *out;
+
+static void add_declaration(Compiler *comp, Declaration *d) {
+	switch (d->type) {
+	case DECL_VARIABLE:
+		hash_put(comp->symbols, d->name, new_symbol(VARIABLE, comp->variables->len));
+		vec_push(comp->variables, (char *)d->name);
+		break;
+	case DECL_CONST:
+		hash_put(comp->symbols, d->name, new_symbol(CONST, d->value));
+		break;
+	case DECL_FUNCTION:
+		hash_put(comp->functions, d->func->name, d->func);
+		break;
+	}
+}
+
+// Defines a global symbol and records it so that the page's first pass can
+// be replayed from the build cache.
+static void declare(DeclType type, const char *name, int value, Function *func) {
+	Declaration *d = arena_alloc(arena, sizeof(Declaration));
+	d->type = type;
+	d->name = name;
+	d->value = value;
+	d->func = func;
+	add_declaration(compiler, d);
+	vec_push(sco->decls, d);
+}
 
-static Buffer *out;
+void replay_declarations(Compiler *comp, int pageno) {
+	Vector *decls = comp->scos[pageno].decls;
+	arena = comp->arena;
+	for (int i = 0; i < decls->len; i++)
+		add_declaration(comp, decls->data[i]);
+}
 
-static int lookup_var(char *var, bool create) {
+static int lookup_var(const char *var, bool create) {
 	Symbol *sym = hash_get(compiler->symbols, var);
 	if (sym) {
 		switch (sym->type) {
@@ -55,27 +97,26 @@ static int lookup_var(char *var, bool create) {
 			return sym->value;
 		case CONST:
 			if (create)
-				error_at(input - strlen(var), "'%s' is already defined as a constant", var);
+				error_at(name_top, "'%s' is already defined as a constant", var);
 			return -1;
 		}
 	}
 
 	if (!create)
 		return -1;
-	sym = new_symbol(VARIABLE, compiler->variables->len);
-	vec_push(compiler->variables, var);
-	hash_put(compiler->symbols, var, sym);
-	return sym->value;
+	assert(!compiling);
+	declare(DECL_VARIABLE, var, 0, NULL);
+	return compiler->variables->len - 1;
 }
 
 static void expr(void);
 static void expr_equal(void);
 static void commands(void);
 
-static void variable(char *id, bool create) {
+static void variable(const char *id, bool create) {
 	int var = lookup_var(id, create);
 	if (compiling && var < 0)
-		error_at(input - strlen(id), "Undefined variable '%s'", id);
+		error_at(name_top, "Undefined variable '%s'", id);
 	if (consume('[')) {
 		emit(out, 0xc0);
 		emit(out, OP_C0_INDEX);
@@ -100,7 +141,7 @@ static void expr_prim(void) {
 		number();
 	} else if (consume('#')) {
 		const char *top = input;
-		char *fname = get_filename();
+		const char *fname = get_filename();
 		for (int i = 0; i < compiler->src_paths->len; i++) {
 			if (!strcasecmp(fname, basename_utf8(compiler->src_paths->data[i]))) {
 				emit_number(out, i);
@@ -109,7 +150,7 @@ static void expr_prim(void) {
 		}
 		error_at(top, "reference to unknown source file: '%s'", fname);
 	} else {
-		char *id = get_identifier();
+		const char *id = get_identifier();
 		if (!strcmp(id, "__LINE__")) {
 			emit_number(out, input_line);
 		} else {
@@ -230,7 +271,7 @@ static void define_const(void) {
 		error_at(input, "unknown const type");
 	do {
 		const char *top = input;
-		char *id = get_identifier();
+		const char *id = get_identifier();
 		consume('=');
 		int val = get_number();  // TODO: Allow expressions
 		if (!compiling) {
@@ -243,29 +284,29 @@ static void define_const(void) {
 					error_at(top, "constant '%s' redefined", id);
 				}
 			}
-			hash_put(compiler->symbols, id, new_symbol(CONST, val));
+			declare(DECL_CONST, id, val, NULL);
 		}
 	} while (consume(','));
 	expect(':');
 }
 
-static Label *lookup_label(char *id) {
+static Label *lookup_label(const char *id) {
 	Label *l = map_get(labels, id);
 	if (!l) {
-		l = calloc(1, sizeof(Label));
-		l->source_loc = input - strlen(id);
+		l = arena_alloc(page_arena, sizeof(Label));
+		l->source_loc = name_top;
 		map_put(labels, id, l);
 	}
 	return l;
 }
 
 static void add_label(void) {
-	char *id = get_label();
+	const char *id = get_label();
 	if (!compiling)
 		return;
 	Label *l = lookup_label(id);
 	if (l->addr)
-		error_at(input - strlen(id), "label '%s' redefined", id);
+		error_at(name_top, "label '%s' redefined", id);
 	l->addr = current_address(out);
 
 	while (l->hole_addr)
@@ -273,7 +314,7 @@ static void add_label(void) {
 }
 
 static Label *label(void) {
-	char *id = get_label();
+	const char *id = get_label();
 	if (!compiling)
 		return NULL;
 	Label *l = lookup_label(id);
@@ -287,17 +328,30 @@ static Label *label(void) {
 	return l;
 }
 
+// Emits a placeholder for the page and address of func. Functions may be
+// defined in pages that are being compiled concurrently, so the actual
+// values are filled in after the pages are compiled.
+static void emit_func_ref(Function *func) {
+	FuncRef *ref = arena_alloc(arena, sizeof(FuncRef));
+	ref->addr = current_address(out);
+	ref->func = func;
+	vec_push(sco->func_refs, ref);
+	emit_word(out, 0);
+	emit_dword(out, 0);
+}
+
 // defun ::= '**' name (var (',' var)*)? ':'
 static void defun(void) {
 	const char *top = input;
-	char *name = get_label();
+	const char *name = get_label();
 
 	if (!compiling) {
 		// First pass - create a function record and store parameter info
 		if (hash_get(compiler->functions, name))
 			error_at(top, "function '%s' redefined", name);
-		Function *func = calloc(1, sizeof(Function));
+		Function *func = arena_alloc(arena, sizeof(Function));
 		func->name = name;
+		func->page = input_page + 1;
 		func->params = new_vec();
 
 		bool needs_comma = false;
@@ -305,48 +359,28 @@ static void defun(void) {
 			if (needs_comma)
 				expect(',');
 			needs_comma = true;
-			vec_push(func->params, get_identifier());
+			vec_push(func->params, (char *)get_identifier());
 		}
-		hash_put(compiler->functions, name, func);
+		declare(DECL_FUNCTION, name, 0, func);
 		return;
 	}
 
-	// Second pass - resolve function address
+	// Second pass - resolve function address. References to this function
+	// are filled in at the end of compile() or by link_scos().
 	Function *func = hash_get(compiler->functions, name);
 	assert(func);
 	assert(!func->resolved);
-
-	const int page = input_page + 1;
-	const uint32_t addr = current_address(out);
-	while (func->addr) {
-		if (func->page == page) {
-			func->page = swap_word(out, func->addr, page);
-			func->addr = swap_dword(out, func->addr + 2, addr);
-		} else {
-			Buffer *sco = compiler->scos[func->page - 1].buf;
-			assert(sco);
-			uint8_t *p = sco->buf + func->addr;
-			func->page = p[0] | p[1] << 8;
-			func->addr = p[2] | p[3] << 8 | p[4] << 16 | p[5] << 24;
-			p[0] = page & 0xff;
-			p[1] = page >> 8;
-			p[2] = addr & 0xff;
-			p[3] = addr >> 8 & 0xff;
-			p[4] = addr >> 16 & 0xff;
-			p[5] = addr >> 24 & 0xff;
-		}
-	}
-	func->page = page;
-	func->addr = addr;
+	assert(func->page == input_page + 1);
+	func->addr = current_address(out);
 	func->resolved = true;
 
 	// Check if all parameters are defined as variables.
 	for (int i = 0; i < func->params->len; i++) {
 		if (i != 0)
 			expect(',');
-		char *id = get_identifier();
+		const char *id = get_identifier();
 		if (lookup_var(id, false) < 0)
-			error_at(input - strlen(id), "Undefined variable '%s'", id);
+			error_at(name_top, "Undefined variable '%s'", id);
 	}
 	expect(':');
 }
@@ -364,7 +398,7 @@ static void funcall(void) {
 		return;
 	}
 	const char *top = input;
-	char *name = get_label();
+	const char *name = get_label();
 	if (!strcmp(name, "0")) {
 		emit(out, '~');
 		emit_word(out, 0);
@@ -402,12 +436,7 @@ static void funcall(void) {
 	expect(':');
 
 	emit(out, '~');
-	emit_word(out, func->page);
-	emit_dword(out, func->addr);
-	if (!func->resolved) {
-		func->page = input_page + 1;
-		func->addr = current_address(out) - 6;
-	}
+	emit_func_ref(func);
 }
 
 // numarray ::= '[' ']' | '[' number (',' number)* ']'
@@ -484,7 +513,7 @@ static int hel_index(const char *dllname) {
 static void dll_call(void) {
 	const char *dot = strchr(input, '.');
 	assert(dot);
-	const char *dllname = strndup_(input, dot - input);
+	const char *dllname = arena_strndup(arena, input, dot - input);
 	int dll_index = hel_index(dllname);
 	if (dll_index < 0)
 		error_at(input, "unknown DLL name '%s'", dllname);
@@ -506,12 +535,13 @@ static void dll_call(void) {
 // Compile command arguments. Directives:
 //  e: expression
 //  n: number (ascii digits)
+//  N: same as n
 //  s: string (colon-terminated)
 //  v: variable
 //  z: string (zero-terminated)
 //  F: function name
 static void arguments(const char *sig) {
-	if (*sig == 'n') {
+	if (*sig == 'n' || *sig == 'N') {
 		emit(out, get_number());
 		if (*++sig)
 			consume(',');  // comma between subcommand num and next argument is optional
@@ -524,6 +554,7 @@ static void arguments(const char *sig) {
 			expr();
 			break;
 		case 'n':
+		case 'N':
 			emit(out, get_number());
 			break;
 		case 's':
@@ -557,17 +588,12 @@ static void arguments(const char *sig) {
 			break;
 		case 'F':
 			{
-				char *name = get_label();
+				const char *name = get_label();
 				if (compiling) {
 					Function *func = hash_get(compiler->functions, name);
 					if (!func)
 						error_at(top, "undefined function '%s'", name);
-					emit_word(out, func->page);
-					emit_dword(out, func->addr);
-					if (!func->resolved) {
-						func->page = input_page + 1;
-						func->addr = current_address(out) - 6;
-					}
+					emit_func_ref(func);
 				}
 			}
 			break;
@@ -707,7 +733,7 @@ static void for_loop(void) {
 
 static void pragma(void) {
 	if (consume_keyword("ald_volume")) {
-		compiler->scos[input_page].ald_volume = get_number();
+		sco->ald_volume = get_number();
 		expect(':');
 	} else if (consume_keyword("address")) {
 		int address = get_number();
@@ -720,7 +746,7 @@ static void pragma(void) {
 			// but address pragma breaks this condition. So clear the LINE info
 			// for this page.
 			if (compiler->dbg_info)
-				debug_line_reset(compiler->dbg_info);
+				debug_line_reset(compiler->dbg_info, input_page);
 		}
 		expect(':');
 	} else {
@@ -728,6 +754,13 @@ static void pragma(void) {
 	}
 }
 
+// Emits a page-local message ID. link_scos() rebases it to the global ID.
+static void emit_msg_id(void) {
+	if (out)
+		stack_push(sco->msg_refs, current_address(out));
+	emit_dword(out, sco->msg_count++);
+}
+
 static int subcommand_num(void) {
 	int n = get_number();
 	emit(out, n);
@@ -738,7 +771,7 @@ static int subcommand_num(void) {
 static bool command(void) {
 	skip_whitespaces();
 	if (out && compiler->dbg_info)
-		debug_line_add(compiler->dbg_info, input_line, current_address(out));
+		debug_line_add(compiler->dbg_info, input_page, input_line, current_address(out));
 
 	const char *command_top = input;
 	int cmd = get_command(out);
@@ -755,8 +788,8 @@ static bool command(void) {
 		case SYSTEM39:
 			if (use_ain_message()) {
 				emit_command(out, COMMAND_ainMsg);
-				compile_message(compiler->msg_buf);
-				emit_dword(out, compiler->msg_count++);
+				compile_message(sco->msg_buf);
+				emit_msg_id();
 				break;
 			}
 			// fall through
@@ -1211,7 +1244,7 @@ static bool command(void) {
 		get_number();
 		expect(':');
 		if (!compiling)
-			warn_at(command_top, "Warning: The ZU command is deprecated. Now it is not needed.");
+			warn_at(command_top, "The ZU command is deprecated. Now it is not needed.");
 		break;
 	case CMD2('Z', 'W'): arguments("e"); break;
 	case CMD2('Z', 'Z'): arguments("ne"); break;
@@ -1229,49 +1262,6 @@ static bool command(void) {
 		pragma();
 		break;
 
-	case COMMAND_TOC: arguments(""); break;
-	case COMMAND_TOS: arguments(""); break;
-	case COMMAND_TPC: arguments("e"); break;
-	case COMMAND_TPS: arguments("e"); break;
-	case COMMAND_TOP: arguments(""); break;
-	case COMMAND_TPP: arguments(""); break;
-	case COMMAND_inc: arguments("v"); break;
-	case COMMAND_dec: arguments("v"); break;
-	case COMMAND_TAA: arguments("e"); break;
-	case COMMAND_TAB: arguments("v"); break;
-	case COMMAND_wavLoad: arguments("ee"); break;
-	case COMMAND_wavPlay: arguments("ee"); break;
-	case COMMAND_wavStop: arguments("e"); break;
-	case COMMAND_wavUnload: arguments("e"); break;
-	case COMMAND_wavIsPlay: arguments("ev"); break;
-	case COMMAND_wavFade: arguments("eeee"); break;
-	case COMMAND_wavIsFade: arguments("ev"); break;
-	case COMMAND_wavStopFade: arguments("e"); break;
-	case COMMAND_trace: arguments("z"); break;
-	case COMMAND_wav3DSetPos: arguments("eeee"); break;
-	case COMMAND_wav3DCommit: arguments(""); break;
-	case COMMAND_wav3DGetPos: arguments("evvv"); break;
-	case COMMAND_wav3DSetPosL: arguments("eee"); break;
-	case COMMAND_wav3DGetPosL: arguments("vvv"); break;
-	case COMMAND_wav3DFadePos: arguments("eeeee"); break;
-	case COMMAND_wav3DIsFadePos: arguments("ev"); break;
-	case COMMAND_wav3DStopFadePos: arguments("e"); break;
-	case COMMAND_wav3DFadePosL: arguments("eeee"); break;
-	case COMMAND_wav3DIsFadePosL: arguments("v"); break;
-	case COMMAND_wav3DStopFadePosL: arguments(""); break;
-	case COMMAND_sndPlay: arguments("ee"); break;
-	case COMMAND_sndStop: arguments(""); break;
-	case COMMAND_sndIsPlay: arguments("v"); break;
-	case COMMAND_msg: arguments("z"); break;
-	case COMMAND_newHH: arguments("ne"); break;
-	case COMMAND_newLC: arguments("eez"); break;
-	case COMMAND_newLE: arguments("nzee"); break;
-	case COMMAND_newLXG: arguments("ezz"); break;
-	case COMMAND_newMI: arguments("eez"); break;
-	case COMMAND_newMS: arguments("ez"); break;
-	case COMMAND_newMT: arguments("z"); break;
-	case COMMAND_newNT: arguments("z"); break;
-	case COMMAND_newQE: arguments("nzee"); break;
 	case COMMAND_newUP:
 		switch (subcommand_num()) {
 		case 0:
@@ -1285,112 +1275,23 @@ static bool command(void) {
 			goto unknown_command;
 		}
 		break;
-	case COMMAND_newF: arguments("nee"); break;
-	case COMMAND_wavWaitTime: arguments("ee"); break;
-	case COMMAND_wavGetPlayPos: arguments("ev"); break;
-	case COMMAND_wavWaitEnd: arguments("e"); break;
-	case COMMAND_wavGetWaveTime: arguments("ev"); break;
-	case COMMAND_menuSetCbkSelect: arguments("F"); break;
-	case COMMAND_menuSetCbkCancel: arguments("F"); break;
-	case COMMAND_menuClearCbkSelect: arguments(""); break;
-	case COMMAND_menuClearCbkCancel: arguments(""); break;
-	case COMMAND_wav3DSetMode: arguments("ee"); break;
-	case COMMAND_grCopyStretch: arguments("eeeeeeeee"); break;
-	case COMMAND_grFilterRect: arguments("eeeee"); break;
-	case COMMAND_iptClearWheelCount: arguments(""); break;
-	case COMMAND_iptGetWheelCount: arguments("vv"); break;
-	case COMMAND_menuGetFontSize: arguments("v"); break;
-	case COMMAND_msgGetFontSize: arguments("v"); break;
-	case COMMAND_strGetCharType: arguments("eev"); break;
-	case COMMAND_strGetLengthASCII: arguments("ev"); break;
-	case COMMAND_sysWinMsgLock: arguments(""); break;
-	case COMMAND_sysWinMsgUnlock: arguments(""); break;
-	case COMMAND_aryCmpCount: arguments("veev"); break;
-	case COMMAND_aryCmpTrans: arguments("veeeev"); break;
-	case COMMAND_grBlendColorRect: arguments("eeeeeeeee"); break;
-	case COMMAND_grDrawFillCircle: arguments("eeee"); break;
-	case COMMAND_MHH: arguments("eee"); break;
-	case COMMAND_menuSetCbkInit: arguments("F"); break;
-	case COMMAND_menuClearCbkInit: arguments(""); break;
-	case COMMAND_sysOpenShell: arguments("z"); break;
-	case COMMAND_sysAddWebMenu: arguments("zz"); break;
-	case COMMAND_iptSetMoveCursorTime: arguments("e"); break;
-	case COMMAND_iptGetMoveCursorTime: arguments("v"); break;
-	case COMMAND_grBlt: arguments("eeeeee"); break;
-	case COMMAND_LXWT: arguments("ez"); break;
-	case COMMAND_LXWS: arguments("ee"); break;
-	case COMMAND_LXWE: arguments("ee"); break;
-	case COMMAND_LXWH: arguments("ene"); break;
-	case COMMAND_LXWHH: arguments("ene"); break;
-	case COMMAND_sysGetOSName: arguments("e"); break;
-	case COMMAND_patchEC: arguments("e"); break;
-	case COMMAND_mathSetClipWindow: arguments("eeee"); break;
-	case COMMAND_mathClip: arguments("vvvvvv"); break;
-	case COMMAND_LXF: arguments("ezz"); break;
-	case COMMAND_strInputDlg: arguments("zeev"); break;
-	case COMMAND_strCheckASCII: arguments("ev"); break;
-	case COMMAND_strCheckSJIS: arguments("ev"); break;
-	case COMMAND_strMessageBox: arguments("z"); break;
-	case COMMAND_strMessageBoxStr: arguments("e"); break;
-	case COMMAND_grCopyUseAMapUseA: arguments("eeeeeee"); break;
-	case COMMAND_grSetCEParam: arguments("ee"); break;
-	case COMMAND_grEffectMoveView: arguments("eeee"); break;
-	case COMMAND_cgSetCacheSize: arguments("e"); break;
 	case COMMAND_dllCall: dll_call(); break;
-	case COMMAND_gaijiSet: arguments("ee"); break;
-	case COMMAND_gaijiClearAll: arguments(""); break;
-	case COMMAND_menuGetLatestSelect: arguments("v"); break;
-	case COMMAND_lnkIsLink: arguments("eev"); break;
-	case COMMAND_lnkIsData: arguments("eev"); break;
-	case COMMAND_fncSetTable: arguments("eF"); break;
-	case COMMAND_fncSetTableFromStr: arguments("eev"); break;
-	case COMMAND_fncClearTable: arguments("e"); break;
-	case COMMAND_fncCall: arguments("e"); break;
-	case COMMAND_fncSetReturnCode: arguments("e"); break;
-	case COMMAND_fncGetReturnCode: arguments("v"); break;
-	case COMMAND_msgSetOutputFlag: arguments("e"); break;
-	case COMMAND_saveDeleteFile: arguments("ev"); break;
-	case COMMAND_wav3DSetUseFlag: arguments("e"); break;
-	case COMMAND_wavFadeVolume: arguments("eeee"); break;
-	case COMMAND_patchEMEN: arguments("e"); break;
-	case COMMAND_wmenuEnableMsgSkip: arguments("e"); break;
-	case COMMAND_winGetFlipFlag: arguments("v"); break;
-	case COMMAND_cdGetMaxTrack: arguments("v"); break;
-	case COMMAND_dlgErrorOkCancel: arguments("zv"); break;
-	case COMMAND_menuReduce: arguments("e"); break;
-	case COMMAND_menuGetNumof: arguments("v"); break;
-	case COMMAND_menuGetText: arguments("ee"); break;
-	case COMMAND_menuGoto: arguments("ee"); break;
-	case COMMAND_menuReturnGoto: arguments("ee"); break;
-	case COMMAND_menuFreeShelterDIB: arguments(""); break;
-	case COMMAND_msgFreeShelterDIB: arguments(""); break;
 	case COMMAND_ainH: // fall through
-	case COMMAND_ainHH:
-		emit(compiler->msg_buf, 0);
-		emit_dword(out, compiler->msg_count++);
-		arguments("ne");
-		break;
+	case COMMAND_ainHH: // fall through
 	case COMMAND_ainX:
-		emit(compiler->msg_buf, 0);
-		emit_dword(out, compiler->msg_count++);
-		arguments("e");
+		emit(sco->msg_buf, 0);
+		emit_msg_id();
+		arguments(command_info(cmd)->args);
 		break;
-	case COMMAND_dataSetPointer: arguments("F"); break;
-	case COMMAND_dataGetWORD: arguments("ve"); break;
-	case COMMAND_dataGetString: arguments("ee"); break;
-	case COMMAND_dataSkipWORD: arguments("e"); break;
-	case COMMAND_dataSkipString: arguments("e"); break;
-	case COMMAND_varGetNumof: arguments("v"); break;
-	case COMMAND_patchG0: arguments("e"); break;
-	case COMMAND_regReadString: arguments("eeev"); break;
-	case COMMAND_fileCheckExist: arguments("ev"); break;
-	case COMMAND_timeCheckCurDate: arguments("eeev"); break;
-	case COMMAND_dlgManualProtect: arguments("oo"); break;
-	case COMMAND_fileCheckDVD: arguments("oeeov"); break;
-	case COMMAND_sysReset: arguments(""); break;
 
 	default:
-		goto unknown_command;
+		{
+			const CommandInfo *info = command_info(cmd);
+			if (!info || !info->args)
+				goto unknown_command;
+			arguments(info->args);
+		}
+		break;
 	}
 	return true;
  unknown_command:
@@ -1403,42 +1304,68 @@ static void commands(void) {
 		;
 }
 
+// Skips the rest of the line after an error, so that the next command can be
+// parsed. Makes progress even if the error was at the end of the line.
+static void recover(const char *last_recovery) {
+	if (input == last_recovery && *input) {
+		if (*input == '\n')
+			input_line++;
+		input++;
+	}
+	while (*input && *input != '\n')
+		input++;
+}
+
 // toplevel ::= commands
 static void toplevel(void) {
 	if (config.unicode && input_page == 0) {
 		// Inject "ZU 1:" command.
 		skip_whitespaces();
 		if (out && compiler->dbg_info)
-			debug_line_add(compiler->dbg_info, input_line, current_address(out));
+			debug_line_add(compiler->dbg_info, input_page, input_line, current_address(out));
 		emit(out, 'Z');
 		emit(out, 'U');
 		emit(out, 0x41);
 		emit(out, 0x7f);
 	}
 
+	jmp_buf env;
+	const char *volatile last_recovery = NULL;
+	if (setjmp(env)) {
+		recover(last_recovery);
+		last_recovery = input;
+	}
+	error_recovery = &env;
 	commands();
 	if (*input)
 		error_at(input, "unexpected '%c'", *input);
+	error_recovery = NULL;
 }
 
 Compiler *new_compiler(Vector *src_paths, Vector *variables, Map *dlls) {
 	Compiler *comp = calloc(1, sizeof(Compiler));
 	comp->src_paths = src_paths;
 	comp->variables = variables ? variables : new_vec();
-	comp->symbols = new_string_hash();
-	comp->functions = new_string_hash();
+	comp->symbols = new_interned_hash();
+	comp->functions = new_interned_hash();
 	comp->dlls = dlls ? dlls : new_map();
 	comp->scos = calloc(src_paths->len, sizeof(Sco));
+	comp->arena = new_arena("compiler");
 
+	arena = comp->arena;
+	hash_reserve(comp->symbols, comp->variables->len);
 	for (int i = 0; i < comp->variables->len; i++)
-		hash_put(comp->symbols, comp->variables->data[i], new_symbol(VARIABLE, i));
+		hash_put(comp->symbols, intern_str(comp->variables->data[i]), new_symbol(VARIABLE, i));
 
 	return comp;
 }
 
-static void prepare(Compiler *comp, const char *source, int pageno) {
+static void prepare(Compiler *comp, const char *source, int pageno, Arena *a) {
 	compiler = comp;
-	lexer_init(source, comp->src_paths->data[pageno], pageno);
+	sco = &comp->scos[pageno];
+	sco->msg_count = 0;
+	arena = a;
+	lexer_init(source, comp->src_paths->data[pageno], pageno, sjis_passthrough());
 	menu_item_start = NULL;
 	branch_end_stack = (config.sys_ver == SYSTEM35) ? new_vec() : NULL;
 }
@@ -1447,50 +1374,111 @@ static void check_undefined_labels(void) {
 	for (int i = 0; i < labels->vals->len; i++) {
 		Label *l = labels->vals->data[i];
 		if (l->hole_addr)
-			error_at(l->source_loc, "undefined label '%s'", labels->keys->data[i]);
+			report_error_at(l->source_loc, "undefined label '%s'", labels->keys->data[i]);
 	}
 }
 
 void preprocess(Compiler *comp, const char *source, int pageno) {
-	prepare(comp, source, pageno);
+	prepare(comp, source, pageno, comp->arena);
 	compiling = false;
 	labels = NULL;
+	sco->decls = new_vec();
+	sco->tokens = calloc(1, sizeof(TokenList));
+	lexer_record_tokens(sco->tokens);
 
 	toplevel();
 
 	if (menu_item_start)
-		error_at(menu_item_start, "unfinished menu item");
+		report_error_at(menu_item_start, "unfinished menu item");
 	if (branch_end_stack && branch_end_stack->len > 0)
-		error_at(input, "'}' expected");
+		report_error_at(input, "'}' expected");
 }
 
 void preprocess_done(Compiler *comp) {
 	if (config.sys_ver == SYSTEM39)
 		comp->msg_buf = new_buf();
+
+	// Message IDs are numbered sequentially across pages.
 	comp->msg_count = 0;
+	for (int i = 0; i < comp->src_paths->len; i++) {
+		comp->scos[i].msg_base = comp->msg_count;
+		comp->msg_count += comp->scos[i].msg_count;
+	}
+}
+
+static void resolve_func_ref(Buffer *b, FuncRef *ref) {
+	swap_word(b, ref->addr, ref->func->page);
+	swap_dword(b, ref->addr + 2, ref->func->addr);
+}
+
+// Fills in references to functions defined in the current page.
+static void resolve_local_func_refs(void) {
+	Vector *refs = sco->func_refs;
+	int n = 0;
+	for (int i = 0; i < refs->len; i++) {
+		FuncRef *ref = refs->data[i];
+		if (ref->func->page == input_page + 1)
+			resolve_func_ref(out, ref);
+		else
+			refs->data[n++] = ref;
+	}
+	refs->len = n;
 }
 
 Sco *compile(Compiler *comp, const char *source, int pageno) {
-	prepare(comp, source, pageno);
+	comp->scos[pageno].arena = new_arena("sco");
+	prepare(comp, source, pageno, comp->scos[pageno].arena);
+	if (!page_arena)
+		page_arena = new_arena("page");
 	compiling = true;
 	labels = new_map();
 
-	comp->scos[pageno].ald_volume = 1;
-	out = new_buf();
+	sco->ald_volume = 1;
+	sco->func_refs = new_vec();
+	sco->msg_refs = new_vec();
+	if (config.sys_ver == SYSTEM39)
+		sco->msg_buf = new_buf();
+	// Compiled code is usually smaller than the source.
+	out = new_buf_with_capacity(strlen(source) / 2 + 4096);
 	sco_init(out, comp->src_paths->data[pageno], pageno);
 	if (comp->dbg_info)
 		debug_init_page(comp->dbg_info, pageno);
+	// Tokens are not available if the first pass was restored from the cache.
+	if (sco->tokens)
+		lexer_replay_tokens(sco->tokens);
 
 	toplevel();
 
+	if (sco->tokens) {
+		free(sco->tokens->tokens);
+		free(sco->tokens);
+		sco->tokens = NULL;
+	}
 	if (menu_item_start)
-		error_at(menu_item_start, "unfinished menu item");
+		report_error_at(menu_item_start, "unfinished menu item");
 	check_undefined_labels();
+	resolve_local_func_refs();
 
 	sco_finalize(out);
 	if (comp->dbg_info)
-		debug_finish_page(comp->dbg_info, labels);
-	comp->scos[pageno].buf = out;
+		debug_finish_page(comp->dbg_info, pageno, labels);
+	arena_reset(page_arena);
+	labels = NULL;
+	sco->buf = out;
 	out = NULL;
-	return &comp->scos[pageno];
+	return sco;
+}
+
+// Resolves cross-page function references and message IDs, and collects
+// messages, after all pages are compiled.
+void link_scos(Compiler *comp) {
+	for (int i = 0; i < comp->src_paths->len; i++) {
+		Sco *s = &comp->scos[i];
+		for (int j = 0; j < s->func_refs->len; j++)
+			resolve_func_ref(s->buf, s->func_refs->data[j]);
+		for (int j = 0; j < s->msg_refs->len; j++)
+			swap_dword(s->buf, (uintptr_t)s->msg_refs->data[j], s->msg_base + j);
+		if (s->msg_buf)
+			emit_bytes(comp->msg_buf, s->msg_buf->buf, s->msg_buf->len);
+	}
 }
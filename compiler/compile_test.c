@@ -122,6 +122,11 @@ void compile_test(void) {
 		 "'<0x8356>'",
 		 "ZU\x41\x7f\xE3\x82\xB7");
 	config.unicode = false;
+	config.utf8 = false;
+	TEST("sjis-space",
+		 "!\x81\x40V:\x81\x40" "1!\x81\x40'\x83\x56'",
+		 "\x21\x80\x41\x7f\x83\x56");
+	config.utf8 = true;
 
 	TEST("menu-item",
 		 "$l$シィル$ *l:",
@@ -26,6 +26,7 @@ Config config = {
 	.sys_ver = SYSTEM39,
 	.sco_ver = SCO_S380,
 	.utf8 = true,
+	.max_errors = 20,
 };
 
 typedef struct {
@@ -93,6 +94,9 @@ void load_config(FILE *fp, const char *cfg_dir) {
 			config.hed = path_join(cfg_dir, val);
 		} else if (sscanf(line, "variables = %s", val)) {
 			config.var_list = path_join(cfg_dir, val);
+		} else if (sscanf(line, "cache = %s", val)) {
+			if (!config.cache)
+				config.cache = path_join(cfg_dir, val);
 		} else if (sscanf(line, "disable_else = %s", val)) {
 			config.disable_else = to_bool(val);
 		} else if (sscanf(line, "disable_ain_message = %s", val)) {
@@ -120,6 +124,8 @@ void load_config(FILE *fp, const char *cfg_dir) {
 			config.unicode = to_bool(val);
 		} else if (sscanf(line, "debug = %s", val)) {
 			config.debug = to_bool(val);
+		} else if (sscanf(line, "dedup = %s", val)) {
+			config.dedup = to_bool(val);
 		}
 	}
 }
@@ -23,82 +23,62 @@
 
 #define DSYM_VERSION 0
 
-typedef struct {
-	int line;
-	int addr;
-} LineInfo;
-
-typedef struct {
-	const char *name;
-	int page;
-	int addr;
-	bool is_local;
-} FuncInfo;
-
+// Pages may be compiled in parallel, so line maps and local functions are
+// kept per page and serialized in debug_info_write().
 typedef struct DebugInfo {
 	Map *srcs;
-	Buffer *line_section;
-	Vector *linemap;
-	int nr_files;
-	Vector *functions;
+	LineVec *linemaps;
+	FuncVec *local_functions;
 } DebugInfo;
 
 struct DebugInfo *new_debug_info(Map *srcs) {
 	DebugInfo *di = calloc(1, sizeof(DebugInfo));
 	di->srcs = new_map();
-	for (int i = 0; i < srcs->keys->len; i++)
-		map_put(di->srcs, srcs->keys->data[i], srcs->vals->data[i]);
-	di->functions = new_vec();
+	// Source contents in debug info are always in UTF-8.
+	for (int i = 0; i < srcs->keys->len; i++) {
+		const char *src = srcs->vals->data[i];
+		map_put(di->srcs, srcs->keys->data[i], sjis_passthrough() ? sjis2utf(src) : (char *)src);
+	}
+	di->linemaps = calloc(srcs->keys->len, sizeof(LineVec));
+	di->local_functions = calloc(srcs->keys->len, sizeof(FuncVec));
 	return di;
 }
 
-static void add_local_functions(struct DebugInfo *di, Map *labels, int page) {
+static void add_local_functions(FuncVec *functions, Map *labels, int page) {
 	for (int i = 0; i < labels->keys->len; i++) {
 		Label *label = labels->vals->data[i];
 		if (!label->is_function)
 			continue;
-		FuncInfo *fi = calloc(1, sizeof(FuncInfo));
+		FuncInfo *fi = funcvec_push(functions);
 		fi->name = labels->keys->data[i];
 		fi->page = page;
 		fi->addr = label->addr;
 		fi->is_local = true;
-		vec_push(di->functions, fi);
 	}
 }
 
-static void add_global_functions(struct DebugInfo *di, HashMap *functions) {
+static void add_global_functions(FuncVec *vec, HashMap *functions) {
+	funcvec_reserve(vec, vec->len + functions->occupied);
 	for (HashItem *i = hash_iterate(functions, NULL); i; i = hash_iterate(functions, i)) {
 		Function *f = i->val;
-		FuncInfo *fi = calloc(1, sizeof(FuncInfo));
+		FuncInfo *fi = funcvec_push(vec);
 		fi->name = f->name;
 		fi->page = f->page - 1;  // 1-based to 0-based index
 		fi->addr = f->addr;
 		fi->is_local = false;
-		vec_push(di->functions, fi);
 	}
 }
 
 void debug_init_page(DebugInfo *di, int page) {
-	if (!di->line_section) {
-		di->line_section = new_buf();
-		emit(di->line_section, 'L');
-		emit(di->line_section, 'I');
-		emit(di->line_section, 'N');
-		emit(di->line_section, 'E');
-		emit_dword(di->line_section, 0);  // section length (to be filled later)
-		emit_dword(di->line_section, 0);  // nr_files (to be filled later)
-	}
-
-	assert(page == di->nr_files);
-	assert(!di->linemap);
-	di->linemap = new_vec();
+	assert(!di->linemaps[page].data);
+	linevec_reserve(&di->linemaps[page], 256);
 }
 
-void debug_line_add(DebugInfo *di, int line, int addr) {
-	Vector *linemap = di->linemap;
+void debug_line_add(DebugInfo *di, int page, int line, int addr) {
+	LineVec *linemap = &di->linemaps[page];
 
 	if (linemap->len > 0) {
-		LineInfo *last = linemap->data[linemap->len - 1];
+		LineInfo *last = &linemap->data[linemap->len - 1];
 		assert(addr >= last->addr);
 		assert(line >= last->line);
 		if (addr == last->addr) {
@@ -108,97 +88,110 @@ void debug_line_add(DebugInfo *di, int line, int addr) {
 		if (line == last->line)
 			return;
 	}
-	LineInfo *li = calloc(1, sizeof(LineInfo));
+	LineInfo *li = linevec_push(linemap);
 	li->line = line;
 	li->addr = addr;
-	vec_push(linemap, li);
-	return;
 }
 
-void debug_line_reset(DebugInfo *di) {
-	di->linemap->len = 0;
+LineVec *debug_page_lines(DebugInfo *di, int page) {
+	return &di->linemaps[page];
+}
+
+FuncVec *debug_page_functions(DebugInfo *di, int page) {
+	return &di->local_functions[page];
+}
+
+void debug_line_reset(DebugInfo *di, int page) {
+	di->linemaps[page].len = 0;
 }
 
-void debug_finish_page(DebugInfo *di, Map *labels) {
-	add_local_functions(di, labels, di->nr_files);
+void debug_finish_page(DebugInfo *di, int page, Map *labels) {
+	add_local_functions(&di->local_functions[page], labels, page);
 
-	Vector *linemap = di->linemap;
-	assert(linemap);
+	LineVec *linemap = &di->linemaps[page];
+	assert(linemap->data);
 
 	// Drop the last entry because it points to the end address of the SCO.
 	if (linemap->len > 0)
 		linemap->len--;
+}
 
-	emit_dword(di->line_section, linemap->len);
-	for (int i = 0; i < linemap->len; i++) {
-		LineInfo *li = linemap->data[i];
-		emit_dword(di->line_section, li->line);
-		emit_dword(di->line_section, li->addr);
+static void write_line_section(DebugInfo *di, ByteWriter *w) {
+	int nr_files = di->srcs->keys->len;
+	int section_len = 12;
+	for (int i = 0; i < nr_files; i++)
+		section_len += 4 + di->linemaps[i].len * 8;
+
+	bw_bytes(w, "LINE", 4);
+	bw_u32(w, section_len);
+	bw_u32(w, nr_files);
+	for (int i = 0; i < nr_files; i++) {
+		LineVec *linemap = &di->linemaps[i];
+		bw_u32(w, linemap->len);
+		for (int j = 0; j < linemap->len; j++) {
+			LineInfo *li = &linemap->data[j];
+			bw_u32(w, li->line);
+			bw_u32(w, li->addr);
+		}
 	}
-	di->linemap = NULL;
-	di->nr_files++;
-
-	swap_dword(di->line_section, 4, di->line_section->len);
-	swap_dword(di->line_section, 8, di->nr_files);
 }
 
-static void write_string_array_section(const char *tag, Vector *vec, FILE *fp) {
+static void write_string_array_section(const char *tag, Vector *vec, ByteWriter *w) {
 	int section_len = 12;
 	for (int i = 0; i < vec->len; i++)
 		section_len += strlen(vec->data[i]) + 1;
 
-	fputs(tag, fp);
-	fputdw(section_len, fp);
-	fputdw(vec->len, fp);
-	for (int i = 0; i < vec->len; i++) {
-		fputs(vec->data[i], fp);
-		fputc('\0', fp);
-	}
+	bw_bytes(w, tag, 4);
+	bw_u32(w, section_len);
+	bw_u32(w, vec->len);
+	for (int i = 0; i < vec->len; i++)
+		bw_str(w, vec->data[i]);
 }
 
-int funcinfo_compare(const void *a, const void *b) {
-	const FuncInfo *fa = *(const FuncInfo **)a;
-	const FuncInfo *fb = *(const FuncInfo **)b;
+static int funcinfo_compare(const FuncInfo *fa, const FuncInfo *fb) {
 	if (fa->page != fb->page)
 		return fa->page - fb->page;
 	else
 		return fa->addr - fb->addr;
 }
 
-static void write_func_section(Vector *functions, FILE *fp) {
-	fputs("FUNC", fp);
-	long section_length_offset = ftell(fp);
-	fputdw(0, fp);
+static void write_func_section(FuncVec *functions, ByteWriter *w) {
+	bw_bytes(w, "FUNC", 4);
+	size_t section_length_offset = bw_tell(w);
+	bw_u32(w, 0);
 
 	// Sort by address.
-	qsort(functions->data, functions->len, sizeof(void *), funcinfo_compare);
+	funcvec_sort(functions, funcinfo_compare);
 
-	fputdw(functions->len, fp);
+	bw_u32(w, functions->len);
 	for (int i = 0; i < functions->len; i++) {
-		FuncInfo *fi = functions->data[i];
-		fputs(fi->name, fp);
-		fputc(0, fp);
-		fputw(fi->page, fp);
-		fputdw(fi->addr, fp);
-		fputc(fi->is_local, fp);
+		FuncInfo *fi = &functions->data[i];
+		bw_str(w, fi->name);
+		bw_u16(w, fi->page);
+		bw_u32(w, fi->addr);
+		bw_u8(w, fi->is_local);
 	}
 
-	long section_length = ftell(fp) - section_length_offset + 4;
-	fseek(fp, section_length_offset, SEEK_SET);
-	fputdw(section_length, fp);
-	fseek(fp, 0, SEEK_END);
+	uint8_t section_length[4];
+	put_le32(section_length, bw_tell(w) - section_length_offset + 4);
+	bw_patch(w, section_length_offset, section_length, 4);
 }
 
 void debug_info_write(struct DebugInfo *di, Compiler *compiler, FILE *fp) {
-	add_global_functions(di, compiler->functions);
-
-	fputs("DSYM", fp);
-	fputdw(DSYM_VERSION, fp);
-	fputdw(5, fp);  // nr_sections
-
-	write_string_array_section("SRCS", di->srcs->keys, fp);
-	write_string_array_section("SCNT", di->srcs->vals, fp);
-	fwrite(di->line_section->buf, di->line_section->len, 1, fp);
-	write_func_section(di->functions, fp);
-	write_string_array_section("VARI", compiler->variables, fp);
+	FuncVec functions = {0};
+	for (int i = 0; i < di->srcs->keys->len; i++)
+		funcvec_append(&functions, di->local_functions[i].data, di->local_functions[i].len);
+	add_global_functions(&functions, compiler->functions);
+
+	ByteWriter *w = new_byte_writer(fp);
+	bw_bytes(w, "DSYM", 4);
+	bw_u32(w, DSYM_VERSION);
+	bw_u32(w, 5);  // nr_sections
+
+	write_string_array_section("SRCS", di->srcs->keys, w);
+	write_string_array_section("SCNT", di->srcs->vals, w);
+	write_line_section(di, w);
+	write_func_section(&functions, w);
+	write_string_array_section("VARI", compiler->variables, w);
+	free_byte_writer(w);
 }
@@ -62,7 +62,7 @@ static HELType param_type_from_name(const char *name) {
 		if (!strcmp(e->name, name))
 			return e->type;
 	}
-	error_at(input - strlen(name), "invalid type");
+	error_at(name_top, "invalid type");
 }
 
 // params ::= 'void' | type identifier [',' type identifier]*
@@ -94,7 +94,7 @@ static DLLFunc *fundecl(void) {
 
 // hel ::= fundecl*
 Vector *parse_hel(const char* hel, const char* name) {
-	lexer_init(hel, name, -1);
+	lexer_init(hel, name, -1, false);
 	Vector *funcs = new_vec();
 	while (skip_whitespaces(), *input)
 		vec_push(funcs, fundecl());
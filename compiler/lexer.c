@@ -17,54 +17,247 @@
 */
 #include "xsys35c.h"
 #include <ctype.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
-const char *input_name;
-int input_page;
-const char *input_buf;
-const char *input;
-int input_line;
+_Thread_local const char *input_name;
+_Thread_local int input_page;
+_Thread_local const char *input_buf;
+_Thread_local const char *input;
+_Thread_local int input_line;
+_Thread_local const char *name_top;
+static _Thread_local bool input_sjis;
+// skip_whitespaces() has nothing to skip at this position.
+static _Thread_local const char *skipped_to;
+
+// The first pass records the results of the lexer functions in `tokens`, and
+// the second pass reuses them instead of scanning the source again.
+static _Thread_local TokenList *tokens;
+static _Thread_local bool replaying;
+static _Thread_local int cursor;
+
+
+_Thread_local jmp_buf *error_recovery;
+
+static pthread_mutex_t diag_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int error_count;
+
+// Start offsets of the lines in `line_index_buf`. Built on the first
+// diagnostic for the current source.
+static _Thread_local const char *line_index_buf;
+static _Thread_local uint32_t *line_starts;
+static _Thread_local int nr_lines;
+
+static void build_line_index(void) {
+	int cap = 256;
+	line_starts = realloc(line_starts, cap * sizeof(uint32_t));
+	nr_lines = 0;
+	line_starts[nr_lines++] = 0;
+	for (const char *p = input_buf; (p = strchr(p, '\n')); p++) {
+		if (nr_lines == cap) {
+			cap *= 2;
+			line_starts = realloc(line_starts, cap * sizeof(uint32_t));
+		}
+		line_starts[nr_lines++] = p + 1 - input_buf;
+	}
+	line_index_buf = input_buf;
+}
 
-void warn_at(const char *pos, char *fmt, ...) {
-	int line = 1;
-	for (const char *begin = input_buf;; line++) {
-		const char *end = strchr(begin, '\n');
-		if (!end)  // last line
-			end = strchr(begin, '\0');
-		if (pos <= end) {
-			int col = pos - begin;
-			fprintf(stderr, "%s line %d column %d: ", input_name, line, col + 1);
-			va_list args;
-			va_start(args, fmt);
-			vfprintf(stderr, fmt, args);
-			fputc('\n', stderr);
+// Returns the 0-based line number of `pos`.
+static int line_of(const char *pos) {
+	if (line_index_buf != input_buf)
+		build_line_index();
+	uint32_t offset = pos - input_buf;
+	int lo = 0, hi = nr_lines;  // line_starts[lo] <= offset < line_starts[hi]
+	while (hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+		if (line_starts[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void diagnose(bool is_error, const char *pos, char *fmt, va_list args) {
+	if (pos < input_buf)
+		error("BUG: cannot find error location");
+	int line = line_of(pos);
+	const char *begin = input_buf + line_starts[line];
+	const char *end = strchr(begin, '\n');
+	if (!end)  // last line
+		end = strchr(begin, '\0');
+	if (pos > end)
+		error("BUG: cannot find error location");
+	int col = pos - begin;
+
+	pthread_mutex_lock(&diag_mutex);
+	if (config.error_format == ERROR_FORMAT_GCC) {
+		fprintf(stderr, "%s:%d:%d: %s: ", input_name, line + 1, col + 1, is_error ? "error" : "warning");
+		vfprintf(stderr, fmt, args);
+		fputc('\n', stderr);
+	} else {
+		fprintf(stderr, "%s line %d column %d: %s", input_name, line + 1, col + 1, is_error ? "" : "Warning: ");
+		vfprintf(stderr, fmt, args);
+		fputc('\n', stderr);
+		if (input_sjis) {
+			char *line = strndup_(begin, end - begin);
+			char *utf = sjis2utf_sub(line, 0xfffd);  // U+FFFD REPLACEMENT CHARACTER
+			fprintf(stderr, "%s\n", utf);
+			free(line);
+			free(utf);
+		} else {
 			fprintf(stderr, "%.*s\n", (int)(end - begin), begin);
-			for (const char *p = begin; p < pos; p++)
-				fputc(*p == '\t' ? '\t' : ' ', stderr);
-			fprintf(stderr, "^\n");
-			break;
 		}
-		if (!*end)
-			error("BUG: cannot find error location");
-		begin = end + 1;
+		for (const char *p = begin; p < pos; p++)
+			fputc(*p == '\t' ? '\t' : ' ', stderr);
+		fprintf(stderr, "^\n");
 	}
+	if (is_error && ++error_count == config.max_errors) {
+		// Exit with the lock held, so that other threads print nothing more.
+		fprintf(stderr, "Too many errors, stopping.\n");
+		exit(1);
+	}
+	pthread_mutex_unlock(&diag_mutex);
+}
+
+void warn_at(const char *pos, char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	diagnose(false, pos, fmt, args);
+	va_end(args);
+}
+
+void report_error_at(const char *pos, char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	diagnose(true, pos, fmt, args);
+	va_end(args);
+}
+
+noreturn void error_at(const char *pos, char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	diagnose(true, pos, fmt, args);
+	va_end(args);
+	if (error_recovery)
+		longjmp(*error_recovery, 1);
+	exit(1);
+}
+
+int nr_errors(void) {
+	pthread_mutex_lock(&diag_mutex);
+	int n = error_count;
+	pthread_mutex_unlock(&diag_mutex);
+	return n;
 }
 
-void lexer_init(const char *source, const char *name, int pageno) {
+void lexer_init(const char *source, const char *name, int pageno, bool sjis) {
 	input_buf = input = source;
 	input_name = name;
 	input_page = pageno;
 	input_line = 1;
+	tokens = NULL;
+	skipped_to = NULL;
+	line_index_buf = NULL;
+	input_sjis = sjis;
 }
 
+void lexer_record_tokens(TokenList *list) {
+	tokens = list;
+	replaying = false;
+}
+
+void lexer_replay_tokens(TokenList *list) {
+	tokens = list;
+	replaying = true;
+	cursor = 0;
+}
+
+static Token *add_token(TokenType type, const char *top, int value, const char *str) {
+	if (!tokens || replaying)
+		return NULL;
+	if (tokens->len == tokens->cap) {
+		tokens->cap = tokens->cap ? tokens->cap * 2 : 1024;
+		tokens->tokens = realloc(tokens->tokens, tokens->cap * sizeof(Token));
+	}
+	Token *t = &tokens->tokens[tokens->len++];
+	t->start = top - input_buf;
+	t->end = input - input_buf;
+	t->type = type;
+	t->emit = false;
+	t->value = value;
+	t->str = str;
+	return t;
+}
+
+// Returns the token of `type` recorded at the current position, and advances
+// the input to its end.
+static Token *replay_token(TokenType type) {
+	if (!tokens || !replaying)
+		return NULL;
+	uint32_t pos = input - input_buf;
+	while (cursor < tokens->len && tokens->tokens[cursor].start < pos)
+		cursor++;
+	for (int i = cursor; i < tokens->len && tokens->tokens[i].start == pos; i++) {
+		Token *t = &tokens->tokens[i];
+		if (t->type == type) {
+			input = input_buf + t->end;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+// Character classes, independent of the locale.
+enum {
+	CC_SPACE = 1 << 0,  // isspace()
+	CC_SKIP  = 1 << 1,  // may start whitespace or a comment
+	CC_WORD  = 1 << 2,  // isalnum() or '_'
+	CC_IDENT = 1 << 3,  // identifier character
+	CC_LABEL = 1 << 4,  // label character
+};
+
+static const uint8_t char_class[256] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x03, 0x03, 0x03, 0x03, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x03, 0x10, 0x10, 0x10, 0x00, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00, 0x10, 0x18, 0x12,
+	0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x00, 0x02, 0x10, 0x10, 0x10, 0x10,
+	0x10, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c,
+	0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x10, 0x10, 0x10, 0x10, 0x1c,
+	0x10, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c,
+	0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x10, 0x10, 0x10, 0x10, 0x00,
+	0x18, 0x1a, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,
+	0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,
+	0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,
+	0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,
+	0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,
+	0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,
+	0x18, 0x18, 0x18, 0x1a, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,
+	0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,
+};
+
+#define CHAR_CLASS(c, cls) (char_class[(uint8_t)(c)] & (cls))
+
 void skip_whitespaces(void) {
+	if (!CHAR_CLASS(*input, CC_SKIP) || input == skipped_to)
+		return;
+	Token *t = replay_token(TOK_SPACE);
+	if (t) {
+		input_line += t->value;
+		skipped_to = input;
+		return;
+	}
+
+	const char *top = input;
+	int top_line = input_line;
 	while (*input) {
 		if (*input == '\n') {
 			input++;
 			input_line++;
-		} else if (isspace(*input)) {
+		} else if (CHAR_CLASS(*input, CC_SPACE)) {
 			input++;
 		} else if (*input == ';' || (*input == '/' && *(input+1) == '/')) {
 			// This is safe because the input is guaranteed to end with "\n\0".
@@ -77,13 +270,17 @@ void skip_whitespaces(void) {
 					error_at(top, "unfinished comment");
 			} while (*++input != '/');
 			input++;
-		} else if (input[0] == (char)0xe3 && input[1] == (char)0x80 && input[2] == (char)0x80) {  // CJK IDEOGRAPHIC SPACE
-			input += 3;
+		} else if (input_sjis ? input[0] == (char)0x81 && input[1] == (char)0x40 :
+				   input[0] == (char)0xe3 && input[1] == (char)0x80 && input[2] == (char)0x80) {
+			input += input_sjis ? 2 : 3;  // CJK IDEOGRAPHIC SPACE
 		} else {
 			break;
 		}
 	}
-	return;
+	skipped_to = input;
+	// Short runs of whitespace are faster to scan again than to look up.
+	if (input - top >= 8)
+		add_token(TOK_SPACE, top, input_line - top_line, NULL);
 }
 
 char next_char(void) {
@@ -109,7 +306,7 @@ bool consume_keyword(const char *keyword) {
 	if (*input != *keyword)
 		return false;
 	int len = strlen(keyword);
-	if (!strncmp(input, keyword, len) && !isalnum(input[len]) && input[len] != '_') {
+	if (!strncmp(input, keyword, len) && !CHAR_CLASS(input[len], CC_WORD)) {
 		input += len;
 		return true;
 	}
@@ -122,52 +319,109 @@ uint8_t echo(Buffer *b) {
 	return c;
 }
 
+// Echoes the current character and the printable ASCII characters that
+// follow it, up to `terminator`, '<' or '\\'.
+static void echo_ascii_run(Buffer *b, char terminator) {
+	const char *top = input++;
+	while (' ' <= *input && *input <= '~' && *input != terminator && *input != '<' && *input != '\\')
+		input++;
+	emit_bytes(b, top, input - top);
+}
+
 static bool is_identifier(uint8_t c) {
-	return isalnum(c) || !isascii(c) || c == '_' || c == '.';
+	return CHAR_CLASS(c, CC_IDENT);
 }
 
 static bool is_label(uint8_t c) {
-	return !isascii(c) || (isgraph(c) && c != '$' && c != ',' && c != ';' && c != ':');
+	return CHAR_CLASS(c, CC_LABEL);
 }
 
 static void advance_to_next_char(void) {
+	if (input_sjis) {
+		// Trail bytes of Shift_JIS may be in the ASCII range.
+		input += is_sjis_byte1(*input) && input[1] ? 2 : 1;
+		return;
+	}
 	while (UTF8_TRAIL_BYTE(*++input))
 		;
 }
 
-char *get_identifier(void) {
+// Names are always in UTF-8.
+static const char *intern_name(const char *top) {
+	name_top = top;
+	if (input_sjis) {
+		for (const char *p = top; p < input; p++) {
+			if (!isascii(*p)) {
+				char *sjis = strndup_(top, input - top);
+				char *utf = sjis2utf(sjis);
+				const char *name = intern_str(utf);
+				free(sjis);
+				free(utf);
+				return name;
+			}
+		}
+	}
+	return intern(top, input - top);
+}
+
+const char *get_identifier(void) {
 	skip_whitespaces();
+	Token *t = replay_token(TOK_IDENTIFIER);
+	if (t) {
+		name_top = input_buf + t->start;
+		return t->str;
+	}
 	const char *top = input;
 	if (!is_identifier(*top) || isdigit(*top))
 		error_at(top, "identifier expected");
 	while (is_identifier(*input))
 		advance_to_next_char();
-	return strndup_(top, input - top);
+	const char *id = intern_name(top);
+	add_token(TOK_IDENTIFIER, top, 0, id);
+	return id;
 }
 
-char *get_label(void) {
+const char *get_label(void) {
 	skip_whitespaces();
+	Token *t = replay_token(TOK_LABEL);
+	if (t) {
+		name_top = input_buf + t->start;
+		return t->str;
+	}
 	const char *top = input;
 	while (is_label(*input))
 		advance_to_next_char();
 	if (input == top)
 		error_at(top, "label expected");
-	return strndup_(top, input - top);
+	const char *label = intern_name(top);
+	add_token(TOK_LABEL, top, 0, label);
+	return label;
 }
 
-char *get_filename(void) {
+const char *get_filename(void) {
+	Token *t = replay_token(TOK_FILENAME);
+	if (t) {
+		name_top = input_buf + t->start;
+		return t->str;
+	}
 	const char *top = input;
 	while (is_identifier(*input))
 		advance_to_next_char();
 	if (input == top)
 		error_at(top, "file name expected");
-	return strndup_(top, input - top);
+	const char *fname = intern_name(top);
+	add_token(TOK_FILENAME, top, 0, fname);
+	return fname;
 }
 
 // number ::= [0-9]+ | '0' [xX] [0-9a-fA-F]+ | '0' [bB] [01]+
 int get_number(void) {
 	if (!isdigit(next_char()))
 		error_at(input, "number expected");
+	Token *t = replay_token(TOK_NUMBER);
+	if (t)
+		return t->value;
+	const char *top = input;
 	int base = 10;
 	if (input[0] == '0' && tolower(input[1]) == 'x') {
 		base = 16;
@@ -179,44 +433,79 @@ int get_number(void) {
 	char *p;
 	long n = strtol(input, &p, base);
 	input = p;
+	add_token(TOK_NUMBER, top, n, NULL);
 	return n;
 }
 
+// Copies Shift_JIS characters to the output. Characters with more than one
+// code are canonicalized, as the conversion from UTF-8 would do.
+static void compile_sjis_string(Buffer *b, bool compact) {
+	const char *top = input;
+	while (!isascii(*input))
+		input += is_sjis_byte1(*input) && input[1] ? 2 : 1;
+	if (!b)
+		return;
+	// The output is never longer than the input.
+	uint8_t *dst = emit_reserve(b, input - top);
+	for (const uint8_t *p = (const uint8_t *)top; p < (const uint8_t *)input;) {
+		uint8_t c1 = *p++;
+		if (!is_sjis_byte1(c1)) {
+			*dst++ = c1;
+			continue;
+		}
+		uint16_t c = canonical_sjis(c1, *p++);
+		uint8_t hk = compact ? compact_sjis(c >> 8, c & 0xff) : 0;
+		if (hk) {
+			*dst++ = hk;
+		} else {
+			*dst++ = c >> 8;
+			*dst++ = c & 0xff;
+		}
+	}
+	b->len = dst - b->buf;
+}
+
 static void compile_multibyte_string(Buffer *b, bool compact) {
 	if (config.unicode) {
 		while (!isascii(*input))
 			echo(b);
 		return;
 	}
+	if (input_sjis) {
+		compile_sjis_string(b, compact);
+		return;
+	}
 
 	const char *top = input;
 	while (!isascii(*input))
 		input++;
 	if (!b)
 		return;
-	char *buf = alloca(input - top + 1);
-	strncpy(buf, top, input - top);
-	buf[input - top] = '\0';
-	char *sjis = utf2sjis(buf);
-	if (!compact) {
-		emit_string(b, sjis);
-		return;
-	}
-	while (*sjis) {
-		uint8_t c1 = *sjis++;
-		if (!is_sjis_byte1(c1)) {
-			emit(b, c1);
-			continue;
-		}
-		uint8_t c2 = *sjis++;
-		uint8_t hk = compact_sjis(c1, c2);
-		if (hk) {
-			emit(b, hk);
-		} else {
-			emit(b, c1);
-			emit(b, c2);
+	// Shift_JIS is never longer than UTF-8, so convert directly into the
+	// output buffer.
+	size_t len = input - top;
+	uint8_t *dst = emit_reserve(b, len);
+	uint8_t *end = dst + utf2sjis_conv(top, &len, (char *)dst, len, -1);
+	if (compact) {
+		uint8_t *d = dst;
+		for (uint8_t *s = dst; s < end;) {
+			uint8_t c1 = *s++;
+			if (!is_sjis_byte1(c1)) {
+				*d++ = c1;
+				continue;
+			}
+			uint8_t c2 = *s++;
+			uint8_t hk = compact_sjis(c1, c2);
+			if (hk) {
+				*d++ = hk;
+			} else {
+				*d++ = c1;
+				*d++ = c2;
+			}
 		}
+		end = d;
 	}
+	b->len = end - b->buf;
 }
 
 void compile_sjis_codepoint(Buffer *b) {
@@ -251,8 +540,8 @@ void compile_string(Buffer *b, char terminator, bool compact, bool forbid_ascii)
 			error_at(input, "ASCII characters cannot be used here");
 		else {
 			if (!b && *input < ' ')
-				warn_at(input, "Warning: Control character in string.");
-			echo(b);
+				warn_at(input, "Control character in string.");
+			echo_ascii_run(b, terminator);
 		}
 	}
 	expect(terminator);
@@ -271,8 +560,8 @@ void compile_message(Buffer *b) {
 			error_at(top, "unfinished message");
 		if (isascii(*input)) {
 			if (!b && *input < ' ')
-				warn_at(input, "Warning: Control character in message.");
-			echo(b);
+				warn_at(input, "Control character in message.");
+			echo_ascii_run(b, '\'');
 		} else {
 			compile_multibyte_string(b, false);
 		}
@@ -295,164 +584,25 @@ void compile_bare_string(Buffer *b) {
 
 #define ISKEYWORD(s, len, kwd) ((len) == sizeof(kwd) - 1 && !memcmp((s), (kwd), (len)))
 
-static int lower_case_command(const char *s, int len) {
-#define LCCMD(cmd) if (ISKEYWORD(s, len, #cmd)) return COMMAND_ ## cmd
-	LCCMD(inc);
-	LCCMD(dec);
-	LCCMD(wavLoad);
-	LCCMD(wavPlay);
-	LCCMD(wavStop);
-	LCCMD(wavUnload);
-	LCCMD(wavIsPlay);
-	LCCMD(wavFade);
-	LCCMD(wavIsFade);
-	LCCMD(wavStopFade);
-	LCCMD(trace);
-	LCCMD(wav3DSetPos);
-	LCCMD(wav3DCommit);
-	LCCMD(wav3DGetPos);
-	LCCMD(wav3DSetPosL);
-	LCCMD(wav3DGetPosL);
-	LCCMD(wav3DFadePos);
-	LCCMD(wav3DIsFadePos);
-	LCCMD(wav3DStopFadePos);
-	LCCMD(wav3DFadePosL);
-	LCCMD(wav3DIsFadePosL);
-	LCCMD(wav3DStopFadePosL);
-	LCCMD(sndPlay);
-	LCCMD(sndStop);
-	LCCMD(sndIsPlay);
-	LCCMD(msg);
-	LCCMD(wavWaitTime);
-	LCCMD(wavGetPlayPos);
-	LCCMD(wavWaitEnd);
-	LCCMD(wavGetWaveTime);
-	LCCMD(menuSetCbkSelect);
-	LCCMD(menuSetCbkCancel);
-	LCCMD(menuClearCbkSelect);
-	LCCMD(menuClearCbkCancel);
-	LCCMD(wav3DSetMode);
-	LCCMD(grCopyStretch);
-	LCCMD(grFilterRect);
-	LCCMD(iptClearWheelCount);
-	LCCMD(iptGetWheelCount);
-	LCCMD(menuGetFontSize);
-	LCCMD(msgGetFontSize);
-	LCCMD(strGetCharType);
-	LCCMD(strGetLengthASCII);
-	LCCMD(sysWinMsgLock);
-	LCCMD(sysWinMsgUnlock);
-	LCCMD(aryCmpCount);
-	LCCMD(aryCmpTrans);
-	LCCMD(grBlendColorRect);
-	LCCMD(grDrawFillCircle);
-	LCCMD(menuSetCbkInit);
-	LCCMD(menuClearCbkInit);
-	LCCMD(menu);
-	LCCMD(sysOpenShell);
-	LCCMD(sysAddWebMenu);
-	LCCMD(iptSetMoveCursorTime);
-	LCCMD(iptGetMoveCursorTime);
-	LCCMD(grBlt);
-	LCCMD(sysGetOSName);
-	LCCMD(patchEC);
-	LCCMD(mathSetClipWindow);
-	LCCMD(mathClip);
-	LCCMD(strInputDlg);
-	LCCMD(strCheckASCII);
-	LCCMD(strCheckSJIS);
-	LCCMD(strMessageBox);
-	LCCMD(strMessageBoxStr);
-	LCCMD(grCopyUseAMapUseA);
-	LCCMD(grSetCEParam);
-	LCCMD(grEffectMoveView);
-	LCCMD(cgSetCacheSize);
-	LCCMD(gaijiSet);
-	LCCMD(gaijiClearAll);
-	LCCMD(menuGetLatestSelect);
-	LCCMD(lnkIsLink);
-	LCCMD(lnkIsData);
-	LCCMD(fncSetTable);
-	LCCMD(fncSetTableFromStr);
-	LCCMD(fncClearTable);
-	LCCMD(fncCall);
-	LCCMD(fncSetReturnCode);
-	LCCMD(fncGetReturnCode);
-	LCCMD(msgSetOutputFlag);
-	LCCMD(saveDeleteFile);
-	LCCMD(wav3DSetUseFlag);
-	LCCMD(wavFadeVolume);
-	LCCMD(patchEMEN);
-	LCCMD(wmenuEnableMsgSkip);
-	LCCMD(winGetFlipFlag);
-	LCCMD(cdGetMaxTrack);
-	LCCMD(dlgErrorOkCancel);
-	LCCMD(menuReduce);
-	LCCMD(menuGetNumof);
-	LCCMD(menuGetText);
-	LCCMD(menuGoto);
-	LCCMD(menuReturnGoto);
-	LCCMD(menuFreeShelterDIB);
-	LCCMD(msgFreeShelterDIB);
-	LCCMD(dataSetPointer);
-	LCCMD(dataGetWORD);
-	LCCMD(dataGetString);
-	LCCMD(dataSkipWORD);
-	LCCMD(dataSkipString);
-	LCCMD(varGetNumof);
-	LCCMD(patchG0);
-	LCCMD(regReadString);
-	LCCMD(fileCheckExist);
-	LCCMD(timeCheckCurDate);
-	LCCMD(dlgManualProtect);
-	LCCMD(fileCheckDVD);
-	LCCMD(sysReset);
-	return 0;
-#undef LCCMD
-}
-
-static int replace_command(int cmd) {
-	switch (cmd) {
-	case CMD3('T', 'A', 'A'): return COMMAND_TAA;
-	case CMD3('T', 'A', 'B'): return COMMAND_TAB;
-	}
-
-	if (config.sys_ver < SYSTEM38)
-		return cmd;
-
-	switch (cmd) {
-	case CMD3('T', 'O', 'C'): return COMMAND_TOC;
-	case CMD3('T', 'O', 'S'): return COMMAND_TOS;
-	case CMD3('T', 'P', 'C'): return COMMAND_TPC;
-	case CMD3('T', 'P', 'S'): return COMMAND_TPS;
-	case CMD3('T', 'O', 'P'): return COMMAND_TOP;
-	case CMD3('T', 'P', 'P'): return COMMAND_TPP;
-	case CMD2('H', 'H'): return use_ain_message() ? COMMAND_ainHH : COMMAND_newHH;
-	case CMD2('L', 'C'): return COMMAND_newLC;
-	case CMD2('L', 'E'): return COMMAND_newLE;
-	case CMD3('L', 'X', 'G'): return COMMAND_newLXG;
-	case CMD2('M', 'I'): return COMMAND_newMI;
-	case CMD2('M', 'S'): return COMMAND_newMS;
-	case CMD2('M', 'T'): return COMMAND_newMT;
-	case CMD2('N', 'T'): return COMMAND_newNT;
-	case CMD2('Q', 'E'): return COMMAND_newQE;
-	case CMD2('U', 'P'): return COMMAND_newUP;
-	case 'F': return COMMAND_newF;
-	case 'H': return use_ain_message() ? COMMAND_ainH : cmd;
-	case CMD3('M', 'H', 'H'): return COMMAND_MHH;
-	case CMD2(COMMAND_LXWx, 'T'): return COMMAND_LXWT;
-	case CMD2(COMMAND_LXWx, 'S'): return COMMAND_LXWS;
-	case CMD2(COMMAND_LXWx, 'E'): return COMMAND_LXWE;
-	case CMD2(COMMAND_LXWx, 'H'): return COMMAND_LXWH;
-	case CMD3(COMMAND_LXWx, 'H', 'H'): return COMMAND_LXWHH;
-	case CMD3('L', 'X', 'F'): return COMMAND_LXF;
-	case 'X': return use_ain_message() ? COMMAND_ainX : cmd;
-	default: return cmd;
+// Replaces an uppercase command with the 2F-prefixed command that takes
+// over it in the target system version.
+static int replace_command(const char *name, int len, int cmd) {
+	if (use_ain_message()) {
+		switch (cmd) {
+		case 'H': return COMMAND_ainH;
+		case CMD2('H', 'H'): return COMMAND_ainHH;
+		case 'X': return COMMAND_ainX;
+		}
 	}
+	int cmd2f = lookup_command(name, len, config.sys_ver);
+	return cmd2f ? cmd2f : cmd;
 }
 
-int get_command(Buffer *b) {
+// Reads a command. Sets *emit to true if the command has an opcode to be
+// emitted.
+static int read_command(bool *emit) {
 	const char *command_top = input;
+	*emit = false;
 
 	// DLL call?
 	if (config.sys_ver == SYSTEM39 && isalpha(*input)) {
@@ -460,15 +610,17 @@ int get_command(Buffer *b) {
 		while (isalnum(*p))
 			p++;
 		if (*p == '.') {
-			emit_command(b, COMMAND_dllCall);
+			*emit = true;
 			return COMMAND_dllCall;
 		}
 	}
 
 	if (!*input || *input == '}' || *input == '>')
 		return *input;
-	if (*input == 'A' || *input == 'R')
-		return echo(b);
+	if (*input == 'A' || *input == 'R') {
+		*emit = true;
+		return *input++;
+	}
 	if (isupper(*input)) {
 		int cmd = *input++;
 		if (isupper(*input))
@@ -494,9 +646,8 @@ int get_command(Buffer *b) {
 		if (cmd == CMD2('Z', 'U'))
 			return cmd;
 
-		cmd = replace_command(cmd);
-		emit_command(b, cmd);
-		return cmd;
+		*emit = true;
+		return replace_command(command_top, input - command_top, cmd);
 	}
 	if (islower(*input)) {
 		while (isalnum(*++input))
@@ -508,12 +659,30 @@ int get_command(Buffer *b) {
 			return COMMAND_CONST;
 		if (ISKEYWORD(command_top, len, "pragma"))
 			return COMMAND_PRAGMA;
-		int cmd = lower_case_command(command_top, len);
+		int cmd = lookup_command(command_top, len, config.sys_ver);
 		if (cmd) {
-			emit_command(b, cmd);
+			*emit = true;
 			return cmd;
 		}
 		error_at(command_top, "Unknown command %.*s", len, command_top);
 	}
 	return *input++;
 }
+
+int get_command(Buffer *b) {
+	Token *t = replay_token(TOK_COMMAND);
+	if (t) {
+		if (t->emit)
+			emit_command(b, t->value);
+		return t->value;
+	}
+	const char *top = input;
+	bool emit;
+	int cmd = read_command(&emit);
+	t = add_token(TOK_COMMAND, top, cmd, NULL);
+	if (t)
+		t->emit = emit;
+	if (emit)
+		emit_command(b, cmd);
+	return cmd;
+}
@@ -21,43 +21,24 @@
 #include <string.h>
 
 Buffer *new_buf(void) {
+	return new_buf_with_capacity(4096);
+}
+
+Buffer *new_buf_with_capacity(int cap) {
 	Buffer *b = malloc(sizeof(Buffer));
-	b->buf = calloc(1, 4096);
-	b->cap = 4096;
+	if (cap < 16)
+		cap = 16;
+	b->buf = calloc(1, cap);
+	b->cap = cap;
 	b->len = 0;
 	return b;
 }
 
-void emit(Buffer *b, uint8_t c) {
-	if (!b)
-		return;
-	if (b->len == b->cap) {
+// Makes room for n more bytes.
+void buf_grow(Buffer *b, int n) {
+	while (b->len + n > b->cap)
 		b->cap *= 2;
-		b->buf = realloc(b->buf, b->cap);
-	}
-	b->buf[b->len++] = c;
-}
-
-void emit_word(Buffer *b, uint16_t v) {
-	emit(b, v & 0xff);
-	emit(b, v >> 8 & 0xff);
-}
-
-void emit_word_be(Buffer *b, uint16_t v) {
-	emit(b, v >> 8 & 0xff);
-	emit(b, v & 0xff);
-}
-
-void emit_dword(Buffer *b, uint32_t v) {
-	emit(b, v & 0xff);
-	emit(b, v >> 8 & 0xff);
-	emit(b, v >> 16 & 0xff);
-	emit(b, v >> 24 & 0xff);
-}
-
-void emit_string(Buffer *b, const char *s) {
-	while (*s)
-		emit(b, *s++);
+	b->buf = realloc(b->buf, b->cap);
 }
 
 int current_address(Buffer *b) {
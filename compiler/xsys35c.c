@@ -19,6 +19,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,17 +28,30 @@
 #define DEFAULT_ALD_BASENAME "out"
 #define DEFAULT_OUTPUT_AIN "System39.ain"
 
-static const char short_options[] = "a:d:E:ghi:Io:p:s:uV:v";
+enum {
+	LOPT_STATS = 256,
+	LOPT_MAX_ERRORS,
+	LOPT_ERROR_FORMAT,
+	LOPT_DEDUP,
+};
+
+static const char short_options[] = "a:c:d:E:ghi:Ij:o:p:s:uV:v";
 static const struct option long_options[] = {
 	{ "ain",       required_argument, NULL, 'a' },
+	{ "cache",     required_argument, NULL, 'c' },
 	{ "outdir",    required_argument, NULL, 'd' },
+	{ "dedup",     no_argument,       NULL, LOPT_DEDUP },
 	{ "encoding",  required_argument, NULL, 'E' },
+	{ "error-format", required_argument, NULL, LOPT_ERROR_FORMAT },
 	{ "debug",     no_argument,       NULL, 'g' },
 	{ "help",      no_argument,       NULL, 'h' },
 	{ "hed",       required_argument, NULL, 'i' },
 	{ "init",      no_argument,       NULL, 'I' },
+	{ "jobs",      required_argument, NULL, 'j' },
+	{ "max-errors", required_argument, NULL, LOPT_MAX_ERRORS },
 	{ "ald",       required_argument, NULL, 'o' },
 	{ "project",   required_argument, NULL, 'p' },
+	{ "stats",     no_argument,       NULL, LOPT_STATS },
 	{ "sys-ver",   required_argument, NULL, 's' },
 	{ "unicode",   no_argument,       NULL, 'u' },
 	{ "variables", required_argument, NULL, 'V' },
@@ -51,13 +65,19 @@ static void usage(void) {
 	puts("    -d, --outdir <dir>        Specify output directory");
 	puts("    -a, --ain <file>          Write .ain output to <file> (default: " DEFAULT_OUTPUT_AIN ")");
 	puts("    -o, --ald <name>          Write output to <name>SA.ALD, <name>SB.ALD, ... (default: " DEFAULT_ALD_BASENAME ")");
+	puts("    -c, --cache <file>        Reuse results of unchanged source files from build cache <file>");
+	puts("        --dedup               Store identical ALD entries only once");
 	puts("    -g, --debug               Generate debug information");
 	puts("    -Es, --encoding=sjis      Set input coding system to SJIS");
 	puts("    -Eu, --encoding=utf8      Set input coding system to UTF-8 (default)");
+	puts("        --error-format=gcc    Print errors as <file>:<line>:<column>: error: <message>");
 	puts("    -i, --hed <file>          Read compile header (.hed) from <file>");
 	puts("    -h, --help                Display this message and exit");
 	puts("    -I, --init                Create a new xsys35c project");
+	puts("    -j, --jobs <n>            Compile <n> pages in parallel (default: number of CPUs)");
+	puts("        --max-errors <n>      Stop after <n> errors (default: 20, 0: no limit)");
 	puts("    -p, --project <file>      Read project configuration from <file>");
+	puts("        --stats               Print memory allocation statistics");
 	puts("    -s, --sys-ver <ver>       Target System version (3.5|3.6|3.8|3.9(default))");
 	puts("    -u, --unicode             Generate Unicode output (can only be run on xsystem35)");
 	puts("    -V, --variables <file>    Read list of variables from <file>");
@@ -82,7 +102,8 @@ static char *next_line(char **buf) {
 	return line;
 }
 
-static char *read_file(const char *path) {
+// Reads a file and appends a newline to it.
+static char *read_bytes(const char *path) {
 	FILE *fp = checked_fopen(path, "rb");
 	if (fseek(fp, 0, SEEK_END) != 0)
 		error("%s: %s", path, strerror(errno));
@@ -97,23 +118,43 @@ static char *read_file(const char *path) {
 	fclose(fp);
 	buf[size] = '\n';
 	buf[size + 1] = '\0';
+	return buf;
+}
 
+// Reads a file in the input encoding, and returns it in UTF-8.
+static char *read_file(const char *path) {
+	char *buf = read_bytes(path);
 	if (config.utf8) {
 		const char *err = validate_utf8(buf);
 		if (err) {
-			lexer_init(buf, path, -1);
+			lexer_init(buf, path, -1, false);
 			error_at(err, "Invalid UTF-8 character");
 		}
 		return buf;
 	} else {
-		char *utf = sjis2utf_sub(buf, 0xfffd);  // U+FFFD REPLACEMENT CHARACTER
-		char *err = strstr(utf, (const char*)u8"\ufffd");
+		const char *err = validate_sjis(buf);
 		if (err) {
-			lexer_init(utf, path, -1);
+			lexer_init(buf, path, -1, true);
 			error_at(err, "Invalid Shift_JIS character");
 		}
-		return sjis2utf(buf);
+		char *utf = sjis2utf(buf);
+		free(buf);
+		return utf;
+	}
+}
+
+// Reads a source file. Shift_JIS sources are not converted if they are
+// compiled in Shift_JIS pass-through mode.
+static char *read_source(const char *path) {
+	if (!sjis_passthrough())
+		return read_file(path);
+	char *buf = read_bytes(path);
+	const char *err = validate_sjis(buf);
+	if (err) {
+		lexer_init(buf, path, -1, true);
+		error_at(err, "Invalid Shift_JIS character");
 	}
+	return buf;
 }
 
 static char *trim_right(char *str) {
@@ -207,11 +248,23 @@ static char *sconame(const char *advname) {
 	return s;
 }
 
+typedef struct {
+	Compiler *compiler;
+	Map *srcs;
+	int *pages;
+} CompileJob;
+
+static void compile_page(void *data, int i) {
+	CompileJob *job = data;
+	int page = job->pages[i];
+	compile(job->compiler, job->srcs->vals->data[page], page);
+}
+
 static void build(const char *srcdir, Vector *src_paths, Vector *variables, Map *dlls, const char *ald_basename, const char *ain_path) {
 	Map *srcs = new_map();
 	for (int i = 0; i < src_paths->len; i++) {
 		char *path = src_paths->data[i];
-		map_put(srcs, path, read_file(path_join(srcdir, path)));
+		map_put(srcs, path, read_source(path_join(srcdir, path)));
 	}
 
 	Compiler *compiler = new_compiler(srcs->keys, variables, dlls);
@@ -219,18 +272,37 @@ static void build(const char *srcdir, Vector *src_paths, Vector *variables, Map
 	if (config.debug)
 		compiler->dbg_info = new_debug_info(srcs);
 
+	struct BuildCache *cache = config.cache ? cache_load(config.cache, compiler) : NULL;
+
 	for (int i = 0; i < srcs->keys->len; i++) {
 		const char *source = srcs->vals->data[i];
-		preprocess(compiler, source, i);
+		if (cache)
+			cache_preprocess(cache, source, i);
+		else
+			preprocess(compiler, source, i);
 	}
 
+	if (nr_errors())
+		exit(1);
 	preprocess_done(compiler);
 
-	uint32_t ald_mask = 0;
+	CompileJob job = { compiler, srcs, calloc(srcs->keys->len, sizeof(int)) };
+	int nr_pages = 0;
+	for (int i = 0; i < srcs->keys->len; i++) {
+		if (!cache || !cache_restore_sco(cache, i))
+			job.pages[nr_pages++] = i;
+	}
+	parallel_for(nr_pages, config.jobs ? config.jobs : nr_cpus(), compile_page, &job);
+	if (nr_errors())
+		exit(1);
+	link_scos(compiler);
+	if (cache)
+		cache_save(cache, config.cache);
+
+	char *ald_paths[ALD_MAX_VOLUMES + 1] = {0};
 	Vector *ald = new_vec();
 	for (int i = 0; i < srcs->keys->len; i++) {
-		const char *source = srcs->vals->data[i];
-		Sco *sco = compile(compiler, source, i);
+		Sco *sco = &compiler->scos[i];
 		AldEntry *e = calloc(1, sizeof(AldEntry));
 		e->volume = sco->ald_volume;
 		e->name = utf2sjis_sub(sconame(basename_utf8(srcs->keys->data[i])), '?');
@@ -238,8 +310,11 @@ static void build(const char *srcdir, Vector *src_paths, Vector *variables, Map
 		e->data = sco->buf->buf;
 		e->size = sco->buf->len;
 		vec_push(ald, e);
-		if (0 < e->volume && e->volume <= 26)
-			ald_mask |= 1 << e->volume;
+		if (0 < e->volume && e->volume <= ALD_MAX_VOLUMES && !ald_paths[e->volume]) {
+			char ald_path[PATH_MAX+1];
+			snprintf(ald_path, sizeof(ald_path), "%sS%c.ALD", ald_basename, 'A' + e->volume - 1);
+			ald_paths[e->volume] = strdup(ald_path);
+		}
 	}
 
 	if (config.sys_ver == SYSTEM39) {
@@ -248,15 +323,9 @@ static void build(const char *srcdir, Vector *src_paths, Vector *variables, Map
 		fclose(fp);
 	}
 
-	for (int i = 1; i <= 26; i++) {
-		if (!(ald_mask & 1 << i))
-			continue;
-		char ald_path[PATH_MAX+1];
-		snprintf(ald_path, sizeof(ald_path), "%sS%c.ALD", ald_basename, 'A' + i - 1);
-		FILE *fp = checked_fopen(ald_path, "wb");
-		ald_write(ald, i, fp);
-		fclose(fp);
-	}
+	int64_t saved = ald_write_volumes(ald, ald_paths, config.jobs ? config.jobs : nr_cpus(), config.dedup);
+	if (config.dedup)
+		printf("Deduplication saved %" PRId64 " bytes\n", saved);
 
 	if (config.debug) {
 		char symbols_path[PATH_MAX+1];
@@ -277,6 +346,7 @@ int main(int argc, char *argv[]) {
 	const char *hed = NULL;
 	const char *var_list = NULL;
 	bool init_mode = false;
+	bool print_stats = false;
 
 	int opt;
 	while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
@@ -284,6 +354,9 @@ int main(int argc, char *argv[]) {
 		case 'a':
 			output_ain = optarg;
 			break;
+		case 'c':
+			config.cache = optarg;
+			break;
 		case 'd':
 			outdir = optarg;
 			break;
@@ -306,6 +379,11 @@ int main(int argc, char *argv[]) {
 		case 'I':
 			init_mode = true;
 			break;
+		case 'j':
+			config.jobs = atoi(optarg);
+			if (config.jobs <= 0)
+				error("Invalid number of jobs '%s'", optarg);
+			break;
 		case 'o':
 			ald_basename = optarg;
 			break;
@@ -324,6 +402,25 @@ int main(int argc, char *argv[]) {
 		case 'v':
 			version();
 			return 0;
+		case LOPT_STATS:
+			print_stats = true;
+			break;
+		case LOPT_DEDUP:
+			config.dedup = true;
+			break;
+		case LOPT_MAX_ERRORS:
+			config.max_errors = atoi(optarg);
+			if (config.max_errors < 0)
+				error("Invalid number of errors '%s'", optarg);
+			break;
+		case LOPT_ERROR_FORMAT:
+			if (!strcmp(optarg, "gcc"))
+				config.error_format = ERROR_FORMAT_GCC;
+			else if (!strcmp(optarg, "default"))
+				config.error_format = ERROR_FORMAT_DEFAULT;
+			else
+				error("Unknown error format '%s'", optarg);
+			break;
 		case '?':
 			usage();
 			return 1;
@@ -390,5 +487,7 @@ int main(int argc, char *argv[]) {
 	Vector *vars = var_list ? read_var_list(var_list) : NULL;
 
 	build(srcdir, srcs, vars, dlls, ald_basename, output_ain);
+	if (print_stats)
+		arena_print_stats(stdout);
 	return 0;
 }
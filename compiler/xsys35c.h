@@ -16,21 +16,21 @@
  *
 */
 #include "common.h"
+#include <setjmp.h>
+#include <string.h>
 
 // config.c
 
-typedef enum {
-	SYSTEM35,
-	SYSTEM36,
-	SYSTEM38,
-	SYSTEM39,
-} SysVer;
-
 typedef enum {
 	MAGIC_AINI,
 	MAGIC_AIN2,
 } AinMagic;
 
+typedef enum {
+	ERROR_FORMAT_DEFAULT,
+	ERROR_FORMAT_GCC,  // file:line:column: error: message
+} ErrorFormat;
+
 typedef struct {
 	const char *ald_basename;
 	const char *output_ain;
@@ -42,6 +42,7 @@ typedef struct {
 	ScoVer sco_ver;
 	const char *hed;
 	const char *var_list;
+	const char *cache;
 
 	bool debug;
 	bool unicode;
@@ -50,6 +51,11 @@ typedef struct {
 	bool disable_ain_message;
 	bool disable_ain_variable;
 	bool old_SR;
+	bool dedup;  // store identical ALD entries once
+
+	int jobs;  // number of pages compiled in parallel (0: number of CPUs)
+	int max_errors;  // stop after this many errors (0: no limit)
+	ErrorFormat error_format;
 } Config;
 extern Config config;
 
@@ -64,8 +70,16 @@ static inline const char *to_output_encoding(const char *str_utf8) {
 	return config.unicode ? str_utf8 : utf2sjis_sub(str_utf8, '?');
 }
 
+// Shift_JIS source files are compiled without converting them to UTF-8,
+// unless the output is Unicode.
+static inline bool sjis_passthrough(void) {
+	return !config.utf8 && !config.unicode;
+}
+
 // sco.c
 
+// A NULL Buffer is a null sink; emit functions do nothing for it. The first
+// pass of the compiler emits to NULL.
 typedef struct {
 	uint8_t *buf;
 	int len;
@@ -73,11 +87,60 @@ typedef struct {
 } Buffer;
 
 Buffer *new_buf(void);
-void emit(Buffer *b, uint8_t c);
-void emit_word(Buffer *b, uint16_t v);
-void emit_word_be(Buffer *b, uint16_t v);
-void emit_dword(Buffer *b, uint32_t v);
-void emit_string(Buffer *b, const char *s);
+Buffer *new_buf_with_capacity(int cap);
+void buf_grow(Buffer *b, int n);
+
+// Appends n bytes to b and returns a pointer to them. b must not be NULL.
+static inline uint8_t *emit_reserve(Buffer *b, int n) {
+	if (b->len + n > b->cap)
+		buf_grow(b, n);
+	uint8_t *p = b->buf + b->len;
+	b->len += n;
+	return p;
+}
+
+static inline void emit(Buffer *b, uint8_t c) {
+	if (!b)
+		return;
+	*emit_reserve(b, 1) = c;
+}
+
+static inline void emit_bytes(Buffer *b, const void *data, int n) {
+	if (!b)
+		return;
+	memcpy(emit_reserve(b, n), data, n);
+}
+
+static inline void emit_word(Buffer *b, uint16_t v) {
+	if (!b)
+		return;
+	uint8_t *p = emit_reserve(b, 2);
+	p[0] = v & 0xff;
+	p[1] = v >> 8 & 0xff;
+}
+
+static inline void emit_word_be(Buffer *b, uint16_t v) {
+	if (!b)
+		return;
+	uint8_t *p = emit_reserve(b, 2);
+	p[0] = v >> 8 & 0xff;
+	p[1] = v & 0xff;
+}
+
+static inline void emit_dword(Buffer *b, uint32_t v) {
+	if (!b)
+		return;
+	uint8_t *p = emit_reserve(b, 4);
+	p[0] = v & 0xff;
+	p[1] = v >> 8 & 0xff;
+	p[2] = v >> 16 & 0xff;
+	p[3] = v >> 24 & 0xff;
+}
+
+static inline void emit_string(Buffer *b, const char *s) {
+	emit_bytes(b, s, strlen(s));
+}
+
 void set_byte(Buffer *b, uint32_t addr, uint8_t val);
 uint8_t get_byte(Buffer *b, uint32_t addr);
 uint16_t swap_word(Buffer *b, uint32_t addr, uint16_t val);
@@ -91,24 +154,63 @@ void sco_finalize(Buffer *b);
 
 // lexer.c
 
-extern const char *input_name;
-extern int input_page;
-extern const char *input_buf;
-extern const char *input;
-extern int input_line;
+typedef enum {
+	TOK_SPACE,
+	TOK_IDENTIFIER,
+	TOK_LABEL,
+	TOK_FILENAME,
+	TOK_NUMBER,
+	TOK_COMMAND,
+} TokenType;
+
+typedef struct {
+	uint32_t start;  // offset in the source
+	uint32_t end;
+	uint8_t type;
+	bool emit;       // TOK_COMMAND: whether the command has an opcode
+	int value;       // TOK_SPACE: newlines, TOK_NUMBER: value, TOK_COMMAND: command
+	const char *str; // TOK_IDENTIFIER, TOK_LABEL, TOK_FILENAME
+} Token;
+
+// Tokens recorded in the first pass, in the order of their start offsets.
+typedef struct {
+	Token *tokens;
+	int len;
+	int cap;
+} TokenList;
+
+// The lexer state is per-thread so that pages can be compiled in parallel.
+extern _Thread_local const char *input_name;
+extern _Thread_local int input_page;
+extern _Thread_local const char *input_buf;
+extern _Thread_local const char *input;
+extern _Thread_local int input_line;
+// Start of the name returned by the last get_identifier(), get_label() or
+// get_filename().
+extern _Thread_local const char *name_top;
+
+// If set, error_at() jumps here after reporting an error, so that the
+// compiler can continue and report more errors. Otherwise it exits.
+extern _Thread_local jmp_buf *error_recovery;
 
-#define error_at(...) (warn_at(__VA_ARGS__), exit(1))
 void warn_at(const char *pos, char *fmt, ...);
-void lexer_init(const char *source, const char *name, int pageno);
+void report_error_at(const char *pos, char *fmt, ...);  // does not return early
+noreturn void error_at(const char *pos, char *fmt, ...);
+int nr_errors(void);
+// If `sjis` is true, `source` is in Shift_JIS. Names are converted to UTF-8,
+// and strings are copied to the output without conversion.
+void lexer_init(const char *source, const char *name, int pageno, bool sjis);
+void lexer_record_tokens(TokenList *tokens);
+void lexer_replay_tokens(TokenList *tokens);
 void skip_whitespaces(void);
 char next_char(void);
 bool consume(char c);
 void expect(char c);
 bool consume_keyword(const char *keyword);
 uint8_t echo(Buffer *b);
-char *get_identifier(void);
-char *get_label(void);
-char *get_filename(void);
+const char *get_identifier(void);
+const char *get_label(void);
+const char *get_filename(void);
 int get_number(void);
 void compile_string(Buffer *b, char terminator, bool compact, bool forbid_ascii);
 void compile_message(Buffer *b);
@@ -125,9 +227,38 @@ typedef struct {
 	Vector *params;
 } Function;
 
+// A reference to a function defined in another page, to be filled in by
+// link_scos().
+typedef struct {
+	uint32_t addr;
+	Function *func;
+} FuncRef;
+
+typedef enum {
+	DECL_VARIABLE,
+	DECL_CONST,
+	DECL_FUNCTION,
+} DeclType;
+
+// A global symbol defined in the first pass.
+typedef struct {
+	DeclType type;
+	const char *name;
+	int value;  // DECL_CONST
+	Function *func;  // DECL_FUNCTION
+} Declaration;
+
 typedef struct {
 	Buffer *buf;
 	int ald_volume;
+	Vector *decls;      // Declaration*
+	TokenList *tokens;  // tokens recorded in the first pass
+	Vector *func_refs;  // FuncRef*
+	Vector *msg_refs;   // addresses of page-local message IDs
+	Buffer *msg_buf;    // messages of this page (SYSTEM39)
+	int msg_count;
+	int msg_base;       // ID of the first message of this page
+	Arena *arena;       // objects created in the second pass
 } Sco;
 
 struct DebugInfo;
@@ -135,13 +266,14 @@ struct DebugInfo;
 typedef struct {
 	Vector *src_paths;
 	Vector *variables;
-	HashMap *symbols;   // variables and constants
-	HashMap *functions;
+	HashMap *symbols;   // variables and constants, keyed by interned names
+	HashMap *functions; // keyed by interned names
 	Map *dlls;
-	Buffer *msg_buf;
+	Buffer *msg_buf;    // messages of all pages, filled by link_scos()
 	int msg_count;
 	Sco *scos;
 	struct DebugInfo *dbg_info;
+	Arena *arena;       // objects created in the first pass
 } Compiler;
 
 typedef struct {
@@ -153,22 +285,48 @@ typedef struct {
 
 Compiler *new_compiler(Vector *src_paths, Vector *variables, Map *dlls);
 void preprocess(Compiler *comp, const char *source, int pageno);
+void replay_declarations(Compiler *comp, int pageno);
 void preprocess_done(Compiler *comp);
 Sco *compile(Compiler *comp, const char *source, int pageno);
+void link_scos(Compiler *comp);
 
 // ain.c
 
 void ain_write(Compiler *compiler, FILE *fp);
 
+// cache.c
+
+struct BuildCache;
+struct BuildCache *cache_load(const char *path, Compiler *comp);
+void cache_preprocess(struct BuildCache *cache, const char *source, int pageno);
+bool cache_restore_sco(struct BuildCache *cache, int pageno);
+void cache_save(struct BuildCache *cache, const char *path);
+
 // hel.c
 
 Vector *parse_hel(const char* hel, const char *name);
 
 // debuginfo.c
 
+typedef struct {
+	int line;
+	int addr;
+} LineInfo;
+DEFINE_VECTOR(LineVec, LineInfo, linevec)
+
+typedef struct {
+	const char *name;
+	int page;
+	int addr;
+	bool is_local;
+} FuncInfo;
+DEFINE_VECTOR(FuncVec, FuncInfo, funcvec)
+
 struct DebugInfo *new_debug_info(Map *srcs);
 void debug_init_page(struct DebugInfo *di, int page);
-void debug_line_add(struct DebugInfo *di, int line, int addr);
-void debug_line_reset(struct DebugInfo *di);
-void debug_finish_page(struct DebugInfo *di, Map *labels);
+void debug_line_add(struct DebugInfo *di, int page, int line, int addr);
+void debug_line_reset(struct DebugInfo *di, int page);
+void debug_finish_page(struct DebugInfo *di, int page, Map *labels);
+LineVec *debug_page_lines(struct DebugInfo *di, int page);
+FuncVec *debug_page_functions(struct DebugInfo *di, int page);
 void debug_info_write(struct DebugInfo *di, Compiler *compiler, FILE *fp);
@@ -77,6 +77,7 @@ static HashMap *read_FUNC(void) {
 	input += 8; // skip section header
 	HashMap *functions = new_function_hash();
 	uint32_t count = read_le32();
+	hash_reserve(functions, count);
 	for (uint32_t i = 0; i < count; i++) {
 		const char *name = read_string();
 		Function *func = calloc(1, sizeof(Function));
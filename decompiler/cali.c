@@ -19,13 +19,11 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define NODE_POOL_SIZE 1024
-
-static Cali node_pool[NODE_POOL_SIZE];
-static Cali *free_node;
+// Nodes are valid until the next parse_cali() call.
+static Arena *node_arena;
 
 static Cali *new_node(int type, int val, Cali *lhs, Cali *rhs) {
-	Cali *n = (free_node > node_pool) ? --free_node : calloc(1, sizeof(Cali));
+	Cali *n = arena_alloc(node_arena, sizeof(Cali));
 	n->type = type;
 	n->val = val;
 	n->lhs = lhs;
@@ -167,7 +165,9 @@ static int precedence(int op) {
 }
 
 Cali *parse_cali(const uint8_t **code, bool is_lhs) {
-	free_node = node_pool + NODE_POOL_SIZE;
+	if (!node_arena)
+		node_arena = new_arena("cali");
+	arena_reset(node_arena);
 	return parse(code, is_lhs);
 }
 
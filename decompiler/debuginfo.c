@@ -16,55 +16,52 @@
  *
 */
 #include "xsys35dc.h"
-#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define DSYM_VERSION 0
 
-static Vector *read_string_array(FILE *fp, uint32_t section_len, const char *path) {
-	uint8_t *buf = malloc(section_len);
-	if (fread(buf, section_len, 1, fp) != 1)
-		error("%s: %s", path, strerror(errno));
-	uint32_t count = le32(buf);
+static Vector *read_string_array(ByteReader *r, const char *path) {
+	uint32_t count = br_u32(r);
 	Vector *vec = new_vec();
-	uint8_t *p = buf + 4;
-	for (uint32_t i = 0; i < count; i++) {
-		vec_push(vec, p);
-		p += strlen((char *)p) + 1;
-	}
-	if (p != buf + section_len)
+	for (uint32_t i = 0; i < count && !r->error; i++)
+		vec_push(vec, (char *)br_str(r));
+	if (r->error || !br_eof(r))
 		error("%s: invalid string array section", path);
 	return vec;
 }
 
 DebugInfo *debug_info_read(const char *path) {
-	FILE *fp = checked_fopen(path, "rb");
-	uint8_t header[12];
+	size_t size;
+	const uint8_t *data = map_file(path, &size);
+	ByteReader r;
+	br_init(&r, data, size);
 
-	if (fread(header, sizeof(header), 1, fp) != 1 || memcmp(header, "DSYM", 4))
+	const uint8_t *magic = br_bytes(&r, 4);
+	if (!magic || memcmp(magic, "DSYM", 4))
 		error("%s: not a DSYM file", path);
-	if (le32(header + 4) != DSYM_VERSION)
+	if (br_u32(&r) != DSYM_VERSION)
 		error("%s: unsupported DSYM version", path);
-	int nr_sections = le32(header + 8);
+	int nr_sections = br_u32(&r);
 
 	DebugInfo *di = calloc(1, sizeof(DebugInfo));
 	di->srcs = calloc(1, sizeof(Map));
 	for (int i = 0; i < nr_sections; i++) {
-		uint8_t section_header[8];
-		if (fread(section_header, sizeof(section_header), 1, fp) != 1)
+		const uint8_t *tag = br_bytes(&r, 4);
+		uint32_t section_len = br_u32(&r) - 8;
+		const uint8_t *section = br_bytes(&r, section_len);
+		if (!section)
 			break;
-		uint32_t section_len = le32(section_header + 4) - 8;
+		ByteReader sr;
+		br_init(&sr, section, section_len);
 
-		if (!memcmp(section_header, "SRCS", 4)) {
-			di->srcs->keys = read_string_array(fp, section_len, path);
-		} else if (!memcmp(section_header, "SCNT", 4)) {
-			di->srcs->vals = read_string_array(fp, section_len, path);
-		} else if (!memcmp(section_header, "VARI", 4)) {
-			di->variables = read_string_array(fp, section_len, path);
-		} else {
-			fseek(fp, section_len, SEEK_CUR);
+		if (!memcmp(tag, "SRCS", 4)) {
+			di->srcs->keys = read_string_array(&sr, path);
+		} else if (!memcmp(tag, "SCNT", 4)) {
+			di->srcs->vals = read_string_array(&sr, path);
+		} else if (!memcmp(tag, "VARI", 4)) {
+			di->variables = read_string_array(&sr, path);
 		}
 	}
 	if (!di->srcs->keys || !di->srcs->vals || di->srcs->keys->len != di->srcs->vals->len ||
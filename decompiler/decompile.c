@@ -72,6 +72,7 @@ typedef struct {
 	Vector *variables;
 	HashMap *functions; // Function -> Function (itself)
 	FILE *out;
+	Arena *arena;
 
 	int page;
 	const uint8_t *p;  // Points inside scos->data[page]->data
@@ -471,10 +472,10 @@ static Function *get_function(uint16_t page, uint32_t addr) {
 	if (dc.ain && dc.ain->functions)
 		warning_at(dc.p, "function %d:%d is not found in System39.ain", page, addr);
 
-	f = calloc(1, sizeof(Function));
+	f = arena_alloc(dc.arena, sizeof(Function));
 	if (page < dc.scos->len && dc.scos->data[page]) {
 		Sco *sco = dc.scos->data[page];
-		char *name_sjis = malloc(strlen(sco->sco_name) + 10);
+		char *name_sjis = arena_alloc(dc.arena, strlen(sco->sco_name) + 10);
 		strcpy(name_sjis, sco->sco_name);
 		char *p = strrchr(name_sjis, '.');
 		if (!p)
@@ -484,7 +485,7 @@ static Function *get_function(uint16_t page, uint32_t addr) {
 	} else {
 		char name[16];
 		sprintf(name, "F_%d_%05x", page, addr);
-		f->name = strdup(name);
+		f->name = arena_strndup(dc.arena, name, strlen(name));
 	}
 	f->page = page + 1;
 	f->addr = addr;
@@ -804,152 +805,22 @@ static int get_command(void) {
 	case '/':
 		dc.p++;
 		switch(*dc.p++) {
-		case 0x00: dc_puts("TOC"); return COMMAND_TOC;
-		case 0x01: dc_puts("TOS"); return COMMAND_TOS;
-		case 0x02: dc_puts("TPC"); return COMMAND_TPC;
-		case 0x03: dc_puts("TPS"); return COMMAND_TPS;
-		case 0x04: dc_puts("TOP"); return COMMAND_TOP;
-		case 0x05: dc_puts("TPP"); return COMMAND_TPP;
-		case 0x06: dc_puts("inc"); return COMMAND_inc;
-		case 0x07: dc_puts("dec"); return COMMAND_dec;
-		case 0x08: dc_puts("TAA"); return COMMAND_TAA;
-		case 0x09: dc_puts("TAB"); return COMMAND_TAB;
-		case 0x0a: dc_puts("wavLoad"); return COMMAND_wavLoad;
-		case 0x0b: dc_puts("wavPlay"); return COMMAND_wavPlay;
-		case 0x0c: dc_puts("wavStop"); return COMMAND_wavStop;
-		case 0x0d: dc_puts("wavUnload"); return COMMAND_wavUnload;
-		case 0x0e: dc_puts("wavIsPlay"); return COMMAND_wavIsPlay;
-		case 0x0f: dc_puts("wavFade"); return COMMAND_wavFade;
-		case 0x10: dc_puts("wavIsFade"); return COMMAND_wavIsFade;
-		case 0x11: dc_puts("wavStopFade"); return COMMAND_wavStopFade;
-		case 0x12: dc_puts("trace"); return COMMAND_trace;
-		case 0x13: dc_puts("wav3DSetPos"); return COMMAND_wav3DSetPos;
-		case 0x14: dc_puts("wav3DCommit"); return COMMAND_wav3DCommit;
-		case 0x15: dc_puts("wav3DGetPos"); return COMMAND_wav3DGetPos;
-		case 0x16: dc_puts("wav3DSetPosL"); return COMMAND_wav3DSetPosL;
-		case 0x17: dc_puts("wav3DGetPosL"); return COMMAND_wav3DGetPosL;
-		case 0x18: dc_puts("wav3DFadePos"); return COMMAND_wav3DFadePos;
-		case 0x19: dc_puts("wav3DIsFadePos"); return COMMAND_wav3DIsFadePos;
-		case 0x1a: dc_puts("wav3DStopFadePos"); return COMMAND_wav3DStopFadePos;
-		case 0x1b: dc_puts("wav3DFadePosL"); return COMMAND_wav3DFadePosL;
-		case 0x1c: dc_puts("wav3DIsFadePosL"); return COMMAND_wav3DIsFadePosL;
-		case 0x1d: dc_puts("wav3DStopFadePosL"); return COMMAND_wav3DStopFadePosL;
-		case 0x1e: dc_puts("sndPlay"); return COMMAND_sndPlay;
-		case 0x1f: dc_puts("sndStop"); return COMMAND_sndStop;
-		case 0x20: dc_puts("sndIsPlay"); return COMMAND_sndIsPlay;
 		case 0x21: return COMMAND_msg;
-		case 0x22: dc_puts("HH"); return COMMAND_newHH;
-		case 0x23: dc_puts("LC"); return COMMAND_newLC;
-		case 0x24: dc_puts("LE"); return COMMAND_newLE;
-		case 0x25: dc_puts("LXG"); return COMMAND_newLXG;
-		case 0x26: dc_puts("MI"); return COMMAND_newMI;
-		case 0x27: dc_puts("MS"); return COMMAND_newMS;
-		case 0x28: dc_puts("MT"); return COMMAND_newMT;
-		case 0x29: dc_puts("NT"); return COMMAND_newNT;
-		case 0x2a: dc_puts("QE"); return COMMAND_newQE;
-		case 0x2b: dc_puts("UP"); return COMMAND_newUP;
-		case 0x2c: dc_puts("F"); return COMMAND_newF;
-		case 0x2d: dc_puts("wavWaitTime"); return COMMAND_wavWaitTime;
-		case 0x2e: dc_puts("wavGetPlayPos"); return COMMAND_wavGetPlayPos;
-		case 0x2f: dc_puts("wavWaitEnd"); return COMMAND_wavWaitEnd;
-		case 0x30: dc_puts("wavGetWaveTime"); return COMMAND_wavGetWaveTime;
-		case 0x31: dc_puts("menuSetCbkSelect"); return COMMAND_menuSetCbkSelect;
-		case 0x32: dc_puts("menuSetCbkCancel"); return COMMAND_menuSetCbkCancel;
-		case 0x33: dc_puts("menuClearCbkSelect"); return COMMAND_menuClearCbkSelect;
-		case 0x34: dc_puts("menuClearCbkCancel"); return COMMAND_menuClearCbkCancel;
-		case 0x35: dc_puts("wav3DSetMode"); return COMMAND_wav3DSetMode;
-		case 0x36: dc_puts("grCopyStretch"); return COMMAND_grCopyStretch;
-		case 0x37: dc_puts("grFilterRect"); return COMMAND_grFilterRect;
-		case 0x38: dc_puts("iptClearWheelCount"); return COMMAND_iptClearWheelCount;
-		case 0x39: dc_puts("iptGetWheelCount"); return COMMAND_iptGetWheelCount;
-		case 0x3a: dc_puts("menuGetFontSize"); return COMMAND_menuGetFontSize;
-		case 0x3b: dc_puts("msgGetFontSize"); return COMMAND_msgGetFontSize;
-		case 0x3c: dc_puts("strGetCharType"); return COMMAND_strGetCharType;
-		case 0x3d: dc_puts("strGetLengthASCII"); return COMMAND_strGetLengthASCII;
-		case 0x3e: dc_puts("sysWinMsgLock"); return COMMAND_sysWinMsgLock;
-		case 0x3f: dc_puts("sysWinMsgUnlock"); return COMMAND_sysWinMsgUnlock;
-		case 0x40: dc_puts("aryCmpCount"); return COMMAND_aryCmpCount;
-		case 0x41: dc_puts("aryCmpTrans"); return COMMAND_aryCmpTrans;
-		case 0x42: dc_puts("grBlendColorRect"); return COMMAND_grBlendColorRect;
-		case 0x43: dc_puts("grDrawFillCircle"); return COMMAND_grDrawFillCircle;
-		case 0x44: dc_puts("MHH"); return COMMAND_MHH;
-		case 0x45: dc_puts("menuSetCbkInit"); return COMMAND_menuSetCbkInit;
-		case 0x46: dc_puts("menuClearCbkInit"); return COMMAND_menuClearCbkInit;
 		case 0x47:
 			if (*dc.p != ']')
 				error_at(dc.p - 2, "command 2F47 not followed by ']'");
 			dc_putc(*dc.p++);
 			return COMMAND_menu;
-		case 0x48: dc_puts("sysOpenShell"); return COMMAND_sysOpenShell;
-		case 0x49: dc_puts("sysAddWebMenu"); return COMMAND_sysAddWebMenu;
-		case 0x4a: dc_puts("iptSetMoveCursorTime"); return COMMAND_iptSetMoveCursorTime;
-		case 0x4b: dc_puts("iptGetMoveCursorTime"); return COMMAND_iptGetMoveCursorTime;
-		case 0x4c: dc_puts("grBlt"); return COMMAND_grBlt;
-		case 0x4d: dc_puts("LXWT"); return COMMAND_LXWT;
-		case 0x4e: dc_puts("LXWS"); return COMMAND_LXWS;
-		case 0x4f: dc_puts("LXWE"); return COMMAND_LXWE;
-		case 0x50: dc_puts("LXWH"); return COMMAND_LXWH;
-		case 0x51: dc_puts("LXWHH"); return COMMAND_LXWHH;
-		case 0x52: dc_puts("sysGetOSName"); return COMMAND_sysGetOSName;
-		case 0x53: dc_puts("patchEC"); return COMMAND_patchEC;
-		case 0x54: dc_puts("mathSetClipWindow"); return COMMAND_mathSetClipWindow;
-		case 0x55: dc_puts("mathClip"); return COMMAND_mathClip;
-		case 0x56: dc_puts("LXF"); return COMMAND_LXF;
-		case 0x57: dc_puts("strInputDlg"); return COMMAND_strInputDlg;
-		case 0x58: dc_puts("strCheckASCII"); return COMMAND_strCheckASCII;
-		case 0x59: dc_puts("strCheckSJIS"); return COMMAND_strCheckSJIS;
-		case 0x5a: dc_puts("strMessageBox"); return COMMAND_strMessageBox;
-		case 0x5b: dc_puts("strMessageBoxStr"); return COMMAND_strMessageBoxStr;
-		case 0x5c: dc_puts("grCopyUseAMapUseA"); return COMMAND_grCopyUseAMapUseA;
-		case 0x5d: dc_puts("grSetCEParam"); return COMMAND_grSetCEParam;
-		case 0x5e: dc_puts("grEffectMoveView"); return COMMAND_grEffectMoveView;
-		case 0x5f: dc_puts("cgSetCacheSize"); return COMMAND_cgSetCacheSize;
 		case 0x60: return COMMAND_dllCall;
-		case 0x61: dc_puts("gaijiSet"); return COMMAND_gaijiSet;
-		case 0x62: dc_puts("gaijiClearAll"); return COMMAND_gaijiClearAll;
-		case 0x63: dc_puts("menuGetLatestSelect"); return COMMAND_menuGetLatestSelect;
-		case 0x64: dc_puts("lnkIsLink"); return COMMAND_lnkIsLink;
-		case 0x65: dc_puts("lnkIsData"); return COMMAND_lnkIsData;
-		case 0x66: dc_puts("fncSetTable"); return COMMAND_fncSetTable;
-		case 0x67: dc_puts("fncSetTableFromStr"); return COMMAND_fncSetTableFromStr;
-		case 0x68: dc_puts("fncClearTable"); return COMMAND_fncClearTable;
-		case 0x69: dc_puts("fncCall"); return COMMAND_fncCall;
-		case 0x6a: dc_puts("fncSetReturnCode"); return COMMAND_fncSetReturnCode;
-		case 0x6b: dc_puts("fncGetReturnCode"); return COMMAND_fncGetReturnCode;
-		case 0x6c: dc_puts("msgSetOutputFlag"); return COMMAND_msgSetOutputFlag;
-		case 0x6d: dc_puts("saveDeleteFile"); return COMMAND_saveDeleteFile;
-		case 0x6e: dc_puts("wav3DSetUseFlag"); return COMMAND_wav3DSetUseFlag;
-		case 0x6f: dc_puts("wavFadeVolume"); return COMMAND_wavFadeVolume;
-		case 0x70: dc_puts("patchEMEN"); return COMMAND_patchEMEN;
-		case 0x71: dc_puts("wmenuEnableMsgSkip"); return COMMAND_wmenuEnableMsgSkip;
-		case 0x72: dc_puts("winGetFlipFlag"); return COMMAND_winGetFlipFlag;
-		case 0x73: dc_puts("cdGetMaxTrack"); return COMMAND_cdGetMaxTrack;
-		case 0x74: dc_puts("dlgErrorOkCancel"); return COMMAND_dlgErrorOkCancel;
-		case 0x75: dc_puts("menuReduce"); return COMMAND_menuReduce;
-		case 0x76: dc_puts("menuGetNumof"); return COMMAND_menuGetNumof;
-		case 0x77: dc_puts("menuGetText"); return COMMAND_menuGetText;
-		case 0x78: dc_puts("menuGoto"); return COMMAND_menuGoto;
-		case 0x79: dc_puts("menuReturnGoto"); return COMMAND_menuReturnGoto;
-		case 0x7a: dc_puts("menuFreeShelterDIB"); return COMMAND_menuFreeShelterDIB;
-		case 0x7b: dc_puts("msgFreeShelterDIB"); return COMMAND_msgFreeShelterDIB;
 		case 0x7c: return COMMAND_ainMsg;
 		case 0x7d: return COMMAND_ainH;
 		case 0x7e: return COMMAND_ainHH;
 		case 0x7f: return COMMAND_ainX;
-		case 0x80: dc_puts("dataSetPointer"); return COMMAND_dataSetPointer;
-		case 0x81: dc_puts("dataGetWORD"); return COMMAND_dataGetWORD;
-		case 0x82: dc_puts("dataGetString"); return COMMAND_dataGetString;
-		case 0x83: dc_puts("dataSkipWORD"); return COMMAND_dataSkipWORD;
-		case 0x84: dc_puts("dataSkipString"); return COMMAND_dataSkipString;
-		case 0x85: dc_puts("varGetNumof"); return COMMAND_varGetNumof;
-		case 0x86: dc_puts("patchG0"); return COMMAND_patchG0;
-		case 0x87: dc_puts("regReadString"); return COMMAND_regReadString;
-		case 0x88: dc_puts("fileCheckExist"); return COMMAND_fileCheckExist;
-		case 0x89: dc_puts("timeCheckCurDate"); return COMMAND_timeCheckCurDate;
-		case 0x8a: dc_puts("dlgManualProtect"); return COMMAND_dlgManualProtect;
-		case 0x8b: dc_puts("fileCheckDVD"); return COMMAND_fileCheckDVD;
-		case 0x8c: dc_puts("sysReset"); return COMMAND_sysReset;
 		default:
+			if (dc.p[-1] < NR_COMMANDS_2F) {
+				dc_puts(commands_2f[dc.p[-1]].name);
+				return CMD2F(dc.p[-1]);
+			}
 			error_at(dc.p - 2, "Unsupported command 2f %02x", dc.p[-1]);
 		}
 		break;
@@ -1634,54 +1505,12 @@ static void decompile_page(int page) {
 			break;
 		case CMD2('Z', 'W'): arguments("e"); break;
 		case CMD2('Z', 'Z'): arguments("Ne"); break;
-		case COMMAND_TOC: arguments(""); break;
-		case COMMAND_TOS: arguments(""); break;
-		case COMMAND_TPC: arguments("e"); break;
-		case COMMAND_TPS: arguments("e"); break;
-		case COMMAND_TOP: arguments(""); break;
-		case COMMAND_TPP: arguments(""); break;
-		case COMMAND_inc: arguments("v"); break;
-		case COMMAND_dec: arguments("v"); break;
-		case COMMAND_TAA: arguments("e"); break;
-		case COMMAND_TAB: arguments("v"); break;
-		case COMMAND_wavLoad: arguments("ee"); break;
-		case COMMAND_wavPlay: arguments("ee"); break;
-		case COMMAND_wavStop: arguments("e"); break;
-		case COMMAND_wavUnload: arguments("e"); break;
-		case COMMAND_wavIsPlay: arguments("ev"); break;
-		case COMMAND_wavFade: arguments("eeee"); break;
-		case COMMAND_wavIsFade: arguments("ev"); break;
-		case COMMAND_wavStopFade: arguments("e"); break;
-		case COMMAND_trace: arguments("z"); break;
-		case COMMAND_wav3DSetPos: arguments("eeee"); break;
-		case COMMAND_wav3DCommit: arguments(""); break;
-		case COMMAND_wav3DGetPos: arguments("evvv"); break;
-		case COMMAND_wav3DSetPosL: arguments("eee"); break;
-		case COMMAND_wav3DGetPosL: arguments("vvv"); break;
-		case COMMAND_wav3DFadePos: arguments("eeeee"); break;
-		case COMMAND_wav3DIsFadePos: arguments("ev"); break;
-		case COMMAND_wav3DStopFadePos: arguments("e"); break;
-		case COMMAND_wav3DFadePosL: arguments("eeee"); break;
-		case COMMAND_wav3DIsFadePosL: arguments("v"); break;
-		case COMMAND_wav3DStopFadePosL: arguments(""); break;
-		case COMMAND_sndPlay: arguments("ee"); break;
-		case COMMAND_sndStop: arguments(""); break;
-		case COMMAND_sndIsPlay: arguments("v"); break;
 		case COMMAND_msg:
 			dc.disable_ain_message = true;
 			dc_putc('\'');
 			dc.p = dc_put_string((const char *)dc.p, '\0', STRING_ESCAPE);
 			dc_putc('\'');
 			break;
-		case COMMAND_newHH: arguments("ne"); break;
-		case COMMAND_newLC: arguments("eez"); break;
-		case COMMAND_newLE: arguments("nzee"); break;
-		case COMMAND_newLXG: arguments("ezz"); break;
-		case COMMAND_newMI: arguments("eez"); break;
-		case COMMAND_newMS: arguments("ez"); break;
-		case COMMAND_newMT: arguments("z"); break;
-		case COMMAND_newNT: arguments("z"); break;
-		case COMMAND_newQE: arguments("nzee"); break;
 		case COMMAND_newUP:
 			dc_putc(' ');
 			switch (subcommand_num()) {
@@ -1696,104 +1525,20 @@ static void decompile_page(int page) {
 				goto unknown_command;
 			}
 			break;
-		case COMMAND_newF: arguments("Nee"); break;
-		case COMMAND_wavWaitTime: arguments("ee"); break;
-		case COMMAND_wavGetPlayPos: arguments("ev"); break;
-		case COMMAND_wavWaitEnd: arguments("e"); break;
-		case COMMAND_wavGetWaveTime: arguments("ev"); break;
-		case COMMAND_menuSetCbkSelect: arguments("F"); break;
-		case COMMAND_menuSetCbkCancel: arguments("F"); break;
-		case COMMAND_menuClearCbkSelect: arguments(""); break;
-		case COMMAND_menuClearCbkCancel: arguments(""); break;
-		case COMMAND_wav3DSetMode: arguments("ee"); break;
-		case COMMAND_grCopyStretch: arguments("eeeeeeeee"); break;
-		case COMMAND_grFilterRect: arguments("eeeee"); break;
-		case COMMAND_iptClearWheelCount: arguments(""); break;
-		case COMMAND_iptGetWheelCount: arguments("vv"); break;
-		case COMMAND_menuGetFontSize: arguments("v"); break;
-		case COMMAND_msgGetFontSize: arguments("v"); break;
-		case COMMAND_strGetCharType: arguments("eev"); break;
-		case COMMAND_strGetLengthASCII: arguments("ev"); break;
-		case COMMAND_sysWinMsgLock: arguments(""); break;
-		case COMMAND_sysWinMsgUnlock: arguments(""); break;
-		case COMMAND_aryCmpCount: arguments("veev"); break;
-		case COMMAND_aryCmpTrans: arguments("veeeev"); break;
-		case COMMAND_grBlendColorRect: arguments("eeeeeeeee"); break;
-		case COMMAND_grDrawFillCircle: arguments("eeee"); break;
-		case COMMAND_MHH: arguments("eee"); break;
-		case COMMAND_menuSetCbkInit: arguments("F"); break;
-		case COMMAND_menuClearCbkInit: arguments(""); break;
 		case COMMAND_menu: break;
-		case COMMAND_sysOpenShell: arguments("z"); break;
-		case COMMAND_sysAddWebMenu: arguments("zz"); break;
-		case COMMAND_iptSetMoveCursorTime: arguments("e"); break;
-		case COMMAND_iptGetMoveCursorTime: arguments("v"); break;
-		case COMMAND_grBlt: arguments("eeeeee"); break;
-		case COMMAND_LXWT: arguments("ez"); break;
-		case COMMAND_LXWS: arguments("ee"); break;
-		case COMMAND_LXWE: arguments("ee"); break;
-		case COMMAND_LXWH: arguments("ene"); break;
-		case COMMAND_LXWHH: arguments("ene"); break;
-		case COMMAND_sysGetOSName: arguments("e"); break;
-		case COMMAND_patchEC: arguments("e"); break;
-		case COMMAND_mathSetClipWindow: arguments("eeee"); break;
-		case COMMAND_mathClip: arguments("vvvvvv"); break;
-		case COMMAND_LXF: arguments("ezz"); break;
-		case COMMAND_strInputDlg: arguments("zeev"); break;
-		case COMMAND_strCheckASCII: arguments("ev"); break;
-		case COMMAND_strCheckSJIS: arguments("ev"); break;
-		case COMMAND_strMessageBox: arguments("z"); break;
-		case COMMAND_strMessageBoxStr: arguments("e"); break;
-		case COMMAND_grCopyUseAMapUseA: arguments("eeeeeee"); break;
-		case COMMAND_grSetCEParam: arguments("ee"); break;
-		case COMMAND_grEffectMoveView: arguments("eeee"); break;
-		case COMMAND_cgSetCacheSize: arguments("e"); break;
 		case COMMAND_dllCall: dll_call(); break;
-		case COMMAND_gaijiSet: arguments("ee"); break;
-		case COMMAND_gaijiClearAll: arguments(""); break;
-		case COMMAND_menuGetLatestSelect: arguments("v"); break;
-		case COMMAND_lnkIsLink: arguments("eev"); break;
-		case COMMAND_lnkIsData: arguments("eev"); break;
-		case COMMAND_fncSetTable: arguments("eF"); break;
-		case COMMAND_fncSetTableFromStr: arguments("eev"); break;
-		case COMMAND_fncClearTable: arguments("e"); break;
-		case COMMAND_fncCall: arguments("e"); break;
-		case COMMAND_fncSetReturnCode: arguments("e"); break;
-		case COMMAND_fncGetReturnCode: arguments("v"); break;
-		case COMMAND_msgSetOutputFlag: arguments("e"); break;
-		case COMMAND_saveDeleteFile: arguments("ev"); break;
-		case COMMAND_wav3DSetUseFlag: arguments("e"); break;
-		case COMMAND_wavFadeVolume: arguments("eeee"); break;
-		case COMMAND_patchEMEN: arguments("e"); break;
-		case COMMAND_wmenuEnableMsgSkip: arguments("e"); break;
-		case COMMAND_winGetFlipFlag: arguments("v"); break;
-		case COMMAND_cdGetMaxTrack: arguments("v"); break;
-		case COMMAND_dlgErrorOkCancel: arguments("zv"); break;
-		case COMMAND_menuReduce: arguments("e"); break;
-		case COMMAND_menuGetNumof: arguments("v"); break;
-		case COMMAND_menuGetText: arguments("ee"); break;
-		case COMMAND_menuGoto: arguments("ee"); break;
-		case COMMAND_menuReturnGoto: arguments("ee"); break;
-		case COMMAND_menuFreeShelterDIB: arguments(""); break;
-		case COMMAND_msgFreeShelterDIB: arguments(""); break;
 		case COMMAND_ainMsg: ain_msg(NULL, NULL); break;
-		case COMMAND_ainH: ain_msg("H", "ne"); break;
-		case COMMAND_ainHH: ain_msg("HH", "ne"); break;
-		case COMMAND_ainX: ain_msg("X", "e"); break;
-		case COMMAND_dataSetPointer: arguments("F"); break;
-		case COMMAND_dataGetWORD: arguments("ve"); break;
-		case COMMAND_dataGetString: arguments("ee"); break;
-		case COMMAND_dataSkipWORD: arguments("e"); break;
-		case COMMAND_dataSkipString: arguments("e"); break;
-		case COMMAND_varGetNumof: arguments("v"); break;
-		case COMMAND_patchG0: arguments("e"); break;
-		case COMMAND_regReadString: arguments("eeev"); break;
-		case COMMAND_fileCheckExist: arguments("ev"); break;
-		case COMMAND_timeCheckCurDate: arguments("eeev"); break;
-		case COMMAND_dlgManualProtect: arguments("oo"); break;
-		case COMMAND_fileCheckDVD: arguments("oeeov"); break;
-		case COMMAND_sysReset: arguments(""); break;
+		case COMMAND_ainH: ain_msg("H", command_info(cmd)->args); break;
+		case COMMAND_ainHH: ain_msg("HH", command_info(cmd)->args); break;
+		case COMMAND_ainX: ain_msg("X", command_info(cmd)->args); break;
 		default:
+			{
+				const CommandInfo *info = command_info(cmd);
+				if (info && info->args) {
+					arguments(info->args);
+					break;
+				}
+			}
 		unknown_command:
 			if (dc.out)
 				error("%s:%x: unknown command '%.*s'", sjis2utf(sco->sco_name), topaddr, dc_addr() - topaddr, sco->data + topaddr);
@@ -1949,6 +1694,7 @@ void warning_at(const uint8_t *pos, char *fmt, ...) {
 
 void decompile(Vector *scos, Ain *ain, DebugInfo *debug_info, const char *outdir, const char *ald_basename) {
 	memset(&dc, 0, sizeof(dc));
+	dc.arena = new_arena("decompiler");
 	dc.scos = scos;
 	dc.ain = ain;
 	if (ain && ain->variables) {
@@ -2032,6 +1778,8 @@ void decompile(Vector *scos, Ain *ain, DebugInfo *debug_info, const char *outdir
 	if (ain && ain->dlls)
 		write_hels(ain->dlls, outdir);
 
-	if (config.verbose)
+	if (config.verbose) {
+		arena_print_stats(stdout);
 		puts("Done!");
+	}
 }
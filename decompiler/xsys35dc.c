@@ -88,15 +88,24 @@ Sco *sco_new(const char *name, const uint8_t *data, int len, int volume) {
 }
 
 void convert_to_utf8(FILE *fp) {
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	char *sjis = malloc(size > 0 ? size : 1);
 	fseek(fp, 0, SEEK_SET);
-	Vector *lines = new_vec();
-	char buf[2048];
-	while (fgets(buf, sizeof(buf), fp))
-		vec_push(lines, sjis2utf(buf));
+	if (size > 0 && fread(sjis, size, 1, fp) != 1)
+		error("read error");
 
 	fseek(fp, 0, SEEK_SET);
-	for (int i = 0; i < lines->len; i++)
-		fputs(lines->data[i], fp);
+	char buf[4096];
+	for (long pos = 0; pos < size;) {
+		size_t len = size - pos;
+		size_t n = sjis2utf_conv(sjis + pos, &len, buf, sizeof(buf), -1);
+		if (!len)  // truncated character at the end
+			error("Invalid SJIS byte sequence %02x", (uint8_t)sjis[pos]);
+		fwrite(buf, 1, n, fp);
+		pos += len;
+	}
+	free(sjis);
 	// No truncation needed because UTF-8 encoding is no shorter than SJIS.
 }
 
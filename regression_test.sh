@@ -12,6 +12,7 @@ bindir="$1"
 ${bindir}/xsys35c -p testdata/source/xsys35c.cfg -o testdata/actual
 if [ -f testdata/regression_test.ald ]; then
     ${bindir}/ald compare testdata/regression_test.ald testdata/actualSA.ALD
+    ${bindir}/ald compare -H <(${bindir}/ald hash testdata/regression_test.ald) testdata/actualSA.ALD
 else
     cp testdata/actualSA.ALD testdata/regression_test.ald
 fi
@@ -19,6 +20,17 @@ rm -rf testdata/decompiled
 ${bindir}/xsys35dc -o testdata/decompiled testdata/actualSA.ALD
 diff -uN --strip-trailing-cr testdata/source testdata/decompiled
 
+printf '!X:+!\n\tfoo\n*a:\n\t@b:\n' > testdata/errors.adv
+diff -u - <(${bindir}/xsys35c --error-format=gcc -o testdata/errors testdata/errors.adv 2>&1 || echo "exit $?") <<EOF
+testdata/errors.adv:1:4: error: identifier expected
+testdata/errors.adv:2:2: error: Unknown command foo
+exit 1
+EOF
+diff -u - <(${bindir}/xsys35c --error-format=gcc --max-errors=1 -o testdata/errors testdata/errors.adv 2>&1) <<EOF
+testdata/errors.adv:1:4: error: identifier expected
+Too many errors, stopping.
+EOF
+rm testdata/errors.adv
 
 tmpfile=$(mktemp)
 
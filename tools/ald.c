@@ -19,9 +19,11 @@
 #include <ctype.h>
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #ifdef _WIN32
 #include <sys/utime.h>
 #endif
@@ -32,72 +34,86 @@ static void usage(void) {
 	puts("commands:");
 	puts("  list        Print list of archive files");
 	puts("  create      Create a new archive");
+	puts("  update      Replace file(s) in archive");
 	puts("  extract     Extract file(s) from archive");
 	puts("  dump        Print hex dump of file");
 	puts("  dump-index  Print contents of link table");
 	puts("  compare     Compare contents of two archives");
+	puts("  hash        Print content hashes of archive files");
 	puts("  help        Display help information about commands");
 	puts("  version     Display version information and exit");
 	puts("");
 	puts("Run 'ald help <command>' for more information about a specific command.");
 }
 
-static Vector *read_alds(int *pargc, char **pargv[]) {
+static AldArchive *read_alds(int *pargc, char **pargv[]) {
 	int argc = *pargc;
 	char **argv = *pargv;
 
 	for (int dd = 0; dd < argc; dd++) {
 		if (!strcmp(argv[dd], "--")) {
-			Vector *ald = NULL;
+			AldArchive *ald = dd ? new_ald_archive() : NULL;
 			for (int i = 0; i < dd; i++)
-				ald = ald_read(ald, argv[i]);
+				ald_add_volume(ald, argv[i]);
 			*pargc -= dd + 1;
 			*pargv += dd + 1;
 			return ald;
 		}
 	}
 
-	Vector *ald = NULL;
+	AldArchive *ald = NULL;
 	for (int i = 0; i < argc; i++) {
 		const char *dot = strrchr(argv[i], '.');
 		if (!dot || strcasecmp(dot, ".ald"))
 			break;
-		ald = ald_read(ald, argv[i]);
+		if (!ald)
+			ald = new_ald_archive();
+		ald_add_volume(ald, argv[i]);
 		*pargc -= 1;
 		*pargv += 1;
 	}
 	return ald;
 }
 
-static AldEntry *find_entry(Vector *ald, const char *num_or_name) {
+static AldEntry *find_entry(AldArchive *ald, const char *num_or_name) {
 	char *endptr;
 	unsigned long idx = strtoul(num_or_name, &endptr, 0);
 	if (*endptr == '\0') {
-		if (idx == 0 || idx > ald->len) {
-			fprintf(stderr, "ald: index %lu is out of range (1-%d)\n", idx, ald->len);
+		if (idx == 0 || idx > ald_count(ald)) {
+			fprintf(stderr, "ald: index %lu is out of range (1-%d)\n", idx, ald_count(ald));
 			return NULL;
 		}
-		if (!ald->data[idx-1]) {
+		AldEntry *e = ald_get(ald, idx - 1);
+		if (!e)
 			fprintf(stderr, "ald: No entry for index %lu\n", idx);
-			return NULL;
-		}
-		return ald->data[idx-1];
+		return e;
 	}
 
-	for (int i = 0; i < ald->len; i++) {
-		AldEntry *e = ald->data[i];
-		if (e && !strcasecmp(num_or_name, sjis2utf(e->name)))
-			return e;
+	// Characters that Shift_JIS cannot represent are replaced with DEL, which
+	// entry names do not contain.
+	char *sjis_name = utf2sjis_sub(num_or_name, 0x7f);
+	int index = ald_find(ald, sjis_name);
+	free(sjis_name);
+	if (index < 0) {
+		fprintf(stderr, "ald: No entry for '%s'\n", num_or_name);
+		return NULL;
 	}
-	fprintf(stderr, "ald: No entry for '%s'\n", num_or_name);
-	return NULL;
+	return ald_get(ald, index);
+}
+
+static int parse_jobs(const char *arg) {
+	int jobs = atoi(arg);
+	if (jobs < 1)
+		error("ald: invalid number of jobs: %s", arg);
+	return jobs;
 }
 
-static void write_manifest(Vector *ald, FILE *fp) {
-	for (int i = 0; i < ald->len; i++) {
-		AldEntry *e = ald->data[i];
+static void write_manifest(AldArchive *ald, FILE *fp) {
+	for (int i = 0; i < ald_count(ald); i++) {
+		AldEntry *e = ald_get(ald, i);
+		char name[256];
 		if (e)
-			fprintf(fp, "%d,%d,%s\n", e->volume, i + 1, sjis2utf(e->name));
+			fprintf(fp, "%d,%d,%s\n", e->volume, i + 1, sjis2utf_buf(e->name, name, sizeof(name)));
 	}
 }
 
@@ -112,55 +128,60 @@ static int do_list(int argc, char *argv[]) {
 		help_list();
 		return 1;
 	}
-	Vector *ald = new_vec();
+	AldArchive *ald = new_ald_archive();
 	for (int i = 1; i < argc; i++)
-		ald_read(ald, argv[i]);
+		ald_add_volume(ald, argv[i]);
 	char buf[30];
-	for (int i = 0; i < ald->len; i++) {
-		AldEntry *e = ald->data[i];
+	char name[256];
+	for (int i = 0; i < ald_count(ald); i++) {
+		AldEntry *e = ald_get(ald, i);
 		if (!e)
 			continue;
 		struct tm *t = localtime(&e->timestamp);
 		strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", t);
-		printf("%4d %2d  %s  %8d  %s\n", i + 1, e->volume, buf, e->size, sjis2utf(e->name));
+		printf("%4d %2d  %s  %8d  %s\n", i + 1, e->volume, buf, e->size, sjis2utf_buf(e->name, name, sizeof(name)));
 	}
+	ald_close(ald);
 	return 0;
 }
 
 // ald create ----------------------------------------
 
-static const char create_short_options[] = "m:";
+static const char create_short_options[] = "Dm:";
 static const struct option create_long_options[] = {
+	{ "dedup",     no_argument,       NULL, 'D' },
 	{ "manifest",  required_argument, NULL, 'm' },
 	{ 0, 0, 0, 0 }
 };
 
 static void help_create(void) {
-	puts("Usage: ald create <aldfile> <file>...");
-	puts("       ald create <aldfile> -m <manifest-file>");
+	puts("Usage: ald create [options] <aldfile> <file>...");
+	puts("       ald create [options] <aldfile> -m <manifest-file>");
 	puts("Options:");
+	puts("    -D, --dedup              Store identical files only once");
 	puts("    -m, --manifest <file>    Read manifest from <file>");
 }
 
-static void add_file(Vector *ald, int volume, int no, const char *path) {
-	FILE *fp = checked_fopen(path, "rb");
-	struct stat sbuf;
-	if (fstat(fileno(fp), &sbuf) < 0)
+// Only the file's metadata is read here; its contents are streamed into the
+// archive by ald_write().
+static AldEntry *new_file_entry(int volume, const char *path) {
+	ustat sbuf;
+	if (stat_utf8(path, &sbuf) < 0)
 		error("%s: %s", path, strerror(errno));
-	uint8_t *data = malloc(sbuf.st_size);
-	if (!data)
-		error("out of memory");
-	if (sbuf.st_size > 0 && fread(data, sbuf.st_size, 1, fp) != 1)
-		error("%s: %s", path, strerror(errno));
-	fclose(fp);
+	if (sbuf.st_size > INT32_MAX)
+		error("%s: file too large", path);
 
 	AldEntry *e = calloc(1, sizeof(AldEntry));
 	e->name = utf2sjis_sub(basename_utf8(path), '?');
 	e->timestamp = sbuf.st_mtime;
-	e->data = data;
+	e->path = strdup(path);
 	e->size = sbuf.st_size;
 	e->volume = volume;
-	vec_set(ald, no - 1, e);
+	return e;
+}
+
+static void add_file(Vector *ald, int volume, int no, const char *path) {
+	vec_set(ald, no - 1, new_file_entry(volume, path));
 }
 
 static uint32_t add_files_from_manifest(Vector *ald, const char *manifest) {
@@ -183,7 +204,7 @@ static uint32_t add_files_from_manifest(Vector *ald, const char *manifest) {
 		else
 			error("%s:%d manifest syntax error", manifest, lineno);
 
-		if (volume < 1 || volume > 26)
+		if (volume < 1 || volume > ALD_MAX_VOLUMES)
 			error("%s:%d invalid volume id %d", manifest, lineno, volume);
 		if (link_no < 1 || link_no > 65535)
 			error("%s:%d invalid link number %d", manifest, lineno, link_no);
@@ -198,9 +219,13 @@ static uint32_t add_files_from_manifest(Vector *ald, const char *manifest) {
 
 static int do_create(int argc, char *argv[]) {
 	const char *manifest = NULL;
+	bool dedup = false;
 	int opt;
 	while ((opt = getopt_long(argc, argv, create_short_options, create_long_options, NULL)) != -1) {
 		switch (opt) {
+		case 'D':
+			dedup = true;
+			break;
 		case 'm':
 			manifest = optarg;
 			break;
@@ -218,6 +243,7 @@ static int do_create(int argc, char *argv[]) {
 	}
 	char *ald_path = strdup(argv[0]);
 	Vector *entries = new_vec();
+	char *paths[ALD_MAX_VOLUMES + 1] = {0};
 
 	if (manifest) {
 		int len = strlen(ald_path);
@@ -227,29 +253,74 @@ static int do_create(int argc, char *argv[]) {
 		char base = *volume_letter - 1;
 
 		uint32_t vol_bits = add_files_from_manifest(entries, manifest);
-		for (int vol = 1; vol <= 26; vol++) {
+		for (int vol = 1; vol <= ALD_MAX_VOLUMES; vol++) {
 			if ((vol_bits & 1 << vol) == 0)
 				continue;
 			*volume_letter = base + vol;
-			FILE *fp = checked_fopen(ald_path, "wb");
-			ald_write(entries, vol, fp);
-			fclose(fp);
+			paths[vol] = strdup(ald_path);
 		}
 	} else {
 		for (int i = 1; i < argc; i++)
 			add_file(entries, 1, i, argv[i]);
-		FILE *fp = checked_fopen(ald_path, "wb");
-		ald_write(entries, 1, fp);
-		fclose(fp);
+		paths[1] = ald_path;
+	}
+	int64_t saved = ald_write_volumes(entries, paths, nr_cpus(), dedup);
+	if (dedup)
+		printf("Deduplication saved %" PRId64 " bytes\n", saved);
+	return 0;
+}
+
+// ald update ----------------------------------------
+
+static const char update_short_options[] = "c";
+static const struct option update_long_options[] = {
+	{ "compact", no_argument, NULL, 'c' },
+	{ 0, 0, 0, 0 }
+};
+
+static void help_update(void) {
+	puts("Usage: ald update [options] <aldfile> <file>...");
+	puts("Options:");
+	puts("    -c, --compact    Rewrite <aldfile> afterwards to reclaim unused space");
+}
+
+static int do_update(int argc, char *argv[]) {
+	bool compact = false;
+	int opt;
+	while ((opt = getopt_long(argc, argv, update_short_options, update_long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			compact = true;
+			break;
+		default:
+			help_update();
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1 || (!compact && argc < 2)) {
+		help_update();
+		return 1;
 	}
+	Vector *entries = new_vec();
+	for (int i = 1; i < argc; i++)
+		vec_push(entries, new_file_entry(0, argv[i]));
+	int moved = entries->len ? ald_update(argv[0], entries) : 0;
+	if (moved && !compact)
+		printf("%d file(s) moved to the end of %s. Run 'ald update -c %s' to reclaim unused space.\n", moved, argv[0], argv[0]);
+	if (compact)
+		ald_compact(argv[0]);
 	return 0;
 }
 
 // ald extract ----------------------------------------
 
-static const char extract_short_options[] = "d:m:";
+static const char extract_short_options[] = "d:j:m:";
 static const struct option extract_long_options[] = {
 	{ "directory", required_argument, NULL, 'd' },
+	{ "jobs",      required_argument, NULL, 'j' },
 	{ "manifest",  required_argument, NULL, 'm' },
 	{ 0, 0, 0, 0 }
 };
@@ -258,43 +329,89 @@ static void help_extract(void) {
 	puts("Usage: ald extract [options] <aldfile>... [--] [(<n>|<file>)...]");
 	puts("Options:");
 	puts("    -d, --directory <dir>    Extract files into <dir>");
+	puts("    -j, --jobs <n>           Extract <n> files at a time (default: 1)");
 	puts("    -m, --manifest <file>    Write manifest to <file>");
 }
 
-static void extract_entry(AldEntry *e, const char *directory) {
-	const char *utf_name = sjis2utf(e->name);
+typedef struct {
+	AldArchive *ald;
+	Vector *groups;  // entries that are extracted one after another
+	const char *directory;
+} ExtractJob;
+
+static void extract_entry(ExtractJob *job, AldEntry *e) {
+	char name[256];
+	char path[1024];
+	const char *utf_name = sjis2utf_buf(e->name, name, sizeof(name));
 	puts(utf_name);
-	FILE *fp = checked_fopen(path_join(directory, utf_name), "wb");
-	if (e->size > 0 && fwrite(e->data, e->size, 1, fp) != 1)
-		error("%s: %s", sjis2utf(e->name), strerror(errno));
+	int fd = checked_create(path_join_buf(job->directory, utf_name, path, sizeof(path)));
+	int64_t offset;
+	int src_fd = ald_entry_fd(job->ald, e, &offset);
+	write_fd(fd, e->data, e->size, src_fd, offset);
 
-	fflush(fp);
 #ifdef _WIN32
 	struct _utimbuf times = {
 		.actime = e->timestamp,
 		.modtime = e->timestamp
 	};
-	_futime(_fileno(fp), &times);
+	_futime(fd, &times);
 #else
 	struct timespec times[2] = {
 		[0].tv_nsec = UTIME_OMIT,
 		[1].tv_sec = e->timestamp
 	};
-	futimens(fileno(fp), times);
+	futimens(fd, times);
 #endif
 
-	fclose(fp);
+	close(fd);
+}
+
+static void extract_group(void *data, int i) {
+	ExtractJob *job = data;
+	Vector *group = job->groups->data[i];
+	for (int j = 0; j < group->len; j++)
+		extract_entry(job, group->data[j]);
+}
+
+// Groups entries that would be written to the same file, so that they are not
+// written concurrently and the last one wins as in a sequential run. Names are
+// compared ignoring ASCII case, for case-insensitive file systems.
+static Vector *group_by_output_name(Vector *entries) {
+	Vector *groups = new_vec();
+	HashMap *group_of = new_string_hash();
+	for (int i = 0; i < entries->len; i++) {
+		AldEntry *e = entries->data[i];
+		char *key = sjis2utf(e->name);
+		for (char *p = key; *p; p++) {
+			if ('A' <= *p && *p <= 'Z')
+				*p += 'a' - 'A';
+		}
+		Vector *group = hash_get(group_of, key);
+		if (group) {
+			free(key);
+		} else {
+			group = new_vec();
+			hash_put(group_of, key, group);
+			vec_push(groups, group);
+		}
+		vec_push(group, e);
+	}
+	return groups;
 }
 
 static int do_extract(int argc, char *argv[]) {
 	const char *directory = NULL;
 	const char *manifest = NULL;
+	int jobs = 1;
 	int opt;
 	while ((opt = getopt_long(argc, argv, extract_short_options, extract_long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'd':
 			directory = optarg;
 			break;
+		case 'j':
+			jobs = parse_jobs(optarg);
+			break;
 		case 'm':
 			manifest = optarg;
 			break;
@@ -306,7 +423,7 @@ static int do_extract(int argc, char *argv[]) {
 	argc -= optind;
 	argv += optind;
 
-	Vector *ald = read_alds(&argc, &argv);
+	AldArchive *ald = read_alds(&argc, &argv);
 	if (!ald) {
 		help_extract();
 		return 1;
@@ -321,20 +438,30 @@ static int do_extract(int argc, char *argv[]) {
 		fclose(fp);
 	}
 
+	Vector *entries = new_vec();
 	if (!argc) {
 		// Extract all files.
-		for (int i = 0; i < ald->len; i++) {
-			AldEntry *e = ald->data[i];
+		for (int i = 0; i < ald_count(ald); i++) {
+			AldEntry *e = ald_get(ald, i);
 			if (e)
-				extract_entry(e, directory);
+				vec_push(entries, e);
 		}
 	} else {
 		for (int i = 0; i < argc; i++) {
 			AldEntry *e = find_entry(ald, argv[i]);
 			if (e)
-				extract_entry(e, directory);
+				vec_push(entries, e);
 		}
 	}
+	ExtractJob job = { .ald = ald, .directory = directory };
+	if (jobs == 1) {
+		job.groups = new_vec();
+		vec_push(job.groups, entries);
+	} else {
+		job.groups = group_by_output_name(entries);
+	}
+	parallel_for(job.groups->len, jobs, extract_group, &job);
+	ald_close(ald);
 	return 0;
 }
 
@@ -344,10 +471,12 @@ static void help_dump(void) {
 	puts("Usage: ald dump <aldfile>... [--] <n>|<file>");
 }
 
+// Prints a 2-byte character, or a half-width kana if c2 is zero.
 static void print_sjis_2byte(uint8_t c1, uint8_t c2) {
-	char in[3] = {c1, c2, 0};
-	char *out = sjis2utf_sub(in, '.');
-	fputs(out, stdout);
+	char in[2] = {c1, c2};
+	char out[6];
+	size_t len = c2 ? 2 : 1;
+	fwrite(out, 1, sjis2utf_conv(in, &len, out, sizeof(out), '.'), stdout);
 }
 
 static void dump_entry(AldEntry *entry) {
@@ -392,17 +521,17 @@ static void dump_entry(AldEntry *entry) {
 static int do_dump(int argc, char *argv[]) {
 	argc--;
 	argv++;
-	Vector *ald = read_alds(&argc, &argv);
+	AldArchive *ald = read_alds(&argc, &argv);
 	if (!ald || argc != 1) {
 		help_dump();
 		return 1;
 	}
 
 	AldEntry *e = find_entry(ald, argv[0]);
-	if (!e)
-		return 1;
-	dump_entry(e);
-	return 0;
+	if (e)
+		dump_entry(e);
+	ald_close(ald);
+	return e ? 0 : 1;
 }
 
 // ald dump-index ----------------------------------------
@@ -442,65 +571,259 @@ static int do_dump_index(int argc, char *argv[]) {
 	return 0;
 }
 
+// ald hash ----------------------------------------
+
+static const char hash_short_options[] = "j:";
+static const struct option hash_long_options[] = {
+	{ "jobs", required_argument, NULL, 'j' },
+	{ 0, 0, 0, 0 }
+};
+
+static void help_hash(void) {
+	puts("Usage: ald hash [options] <aldfile>...");
+	puts("Options:");
+	puts("    -j, --jobs <n>    Hash <n> entries at a time (default: number of CPUs)");
+}
+
+typedef struct {
+	AldArchive *ald;
+	uint64_t *hashes;
+} HashJob;
+
+static void hash_entry(void *data, int i) {
+	HashJob *job = data;
+	AldEntry *e = ald_get(job->ald, i);
+	if (e)
+		job->hashes[i] = fnv1a64(e->data, e->size, FNV64_INIT);
+}
+
+// Returns the content hashes of all entries, computed in parallel.
+static uint64_t *hash_entries(AldArchive *ald, int jobs) {
+	HashJob job = { .ald = ald, .hashes = calloc(ald_count(ald) + 1, sizeof(uint64_t)) };
+	parallel_for(ald_count(ald), jobs, hash_entry, &job);
+	return job.hashes;
+}
+
+static int do_hash(int argc, char *argv[]) {
+	int jobs = nr_cpus();
+	int opt;
+	while ((opt = getopt_long(argc, argv, hash_short_options, hash_long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs = parse_jobs(optarg);
+			break;
+		default:
+			help_hash();
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0) {
+		help_hash();
+		return 1;
+	}
+
+	AldArchive *ald = new_ald_archive();
+	for (int i = 0; i < argc; i++)
+		ald_add_volume(ald, argv[i]);
+	uint64_t *hashes = hash_entries(ald, jobs);
+	char name[256];
+	for (int i = 0; i < ald_count(ald); i++) {
+		AldEntry *e = ald_get(ald, i);
+		if (e)
+			printf("%d,%d,%d,%016" PRIx64 ",%s\n", e->volume, i + 1, e->size, hashes[i], sjis2utf_buf(e->name, name, sizeof(name)));
+	}
+	free(hashes);
+	ald_close(ald);
+	return 0;
+}
+
 // ald compare ----------------------------------------
 
+static const char compare_short_options[] = "H:j:s";
+static const struct option compare_long_options[] = {
+	{ "hashes",  required_argument, NULL, 'H' },
+	{ "jobs",    required_argument, NULL, 'j' },
+	{ "summary", no_argument,       NULL, 's' },
+	{ 0, 0, 0, 0 }
+};
+
 static void help_compare(void) {
-	puts("Usage: ald compare <aldfile1> <aldfile2>");
+	puts("Usage: ald compare [options] <aldfile1> <aldfile2>");
+	puts("       ald compare [options] -H <hashfile> <aldfile>...");
+	puts("Options:");
+	puts("    -H, --hashes <file>    Compare with a hash list written by 'ald hash'");
+	puts("    -j, --jobs <n>         Compare <n> entries at a time (default: number of CPUs)");
+	puts("    -s, --summary          Print numbers of identical, changed, added and removed entries");
 }
 
-static bool compare_entry(int page, AldEntry *e1, AldEntry *e2) {
-	if (strcasecmp(e1->name, e2->name)) {
-		printf("Entry %d: names differ, %s != %s\n", page, sjis2utf(e1->name), sjis2utf(e2->name));
-		return true;
+// An entry of a hash list, or of the first archive.
+typedef struct {
+	const char *name;  // in UTF-8
+	int size;
+	uint64_t hash;
+} HashListEntry;
+
+static Vector *read_hash_list(const char *path) {
+	FILE *fp = checked_fopen(path, "r");
+	Vector *list = new_vec();
+	char line[512];
+	int lineno = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[0] == '\n')
+			continue;
+		int volume, index, size, name_pos;
+		uint64_t hash;
+		if (sscanf(line, " %d, %d, %d, %" SCNx64 ",%n", &volume, &index, &size, &hash, &name_pos) != 4)
+			error("%s:%d syntax error", path, lineno);
+		if (index < 1 || index > 65535)
+			error("%s:%d invalid index %d", path, lineno, index);
+		line[strcspn(line, "\r\n")] = '\0';
+		HashListEntry *h = calloc(1, sizeof(HashListEntry));
+		h->name = strdup(line + name_pos);
+		h->size = size;
+		h->hash = hash;
+		vec_set(list, index - 1, h);
 	}
-	if (e1->size == e2->size && !memcmp(e1->data, e2->data, e1->size))
-		return false;
+	fclose(fp);
+	return list;
+}
 
-	int i;
-	for (i = 0; i < e1->size && i < e2->size; i++) {
-		if (e1->data[i] != e2->data[i])
+typedef struct {
+	AldArchive *ald1;  // NULL when comparing with a hash list
+	Vector *hashes;
+	AldArchive *ald2;
+	int *diffs;  // offset of the first difference, or -1 if the contents are identical
+} CompareJob;
+
+static void compare_contents(void *data, int i) {
+	CompareJob *job = data;
+	AldEntry *e2 = ald_get(job->ald2, i);
+	job->diffs[i] = -1;
+	if (!e2)
+		return;
+	if (!job->ald1) {
+		HashListEntry *h = i < job->hashes->len ? job->hashes->data[i] : NULL;
+		if (h && (h->size != e2->size || h->hash != fnv1a64(e2->data, e2->size, FNV64_INIT)))
+			job->diffs[i] = 0;  // unknown
+		return;
+	}
+	AldEntry *e1 = ald_get(job->ald1, i);
+	if (!e1 || (e1->size == e2->size && !memcmp(e1->data, e2->data, e1->size)))
+		return;
+	int j;
+	for (j = 0; j < e1->size && j < e2->size; j++) {
+		if (e1->data[j] != e2->data[j])
 			break;
 	}
-	printf("%s (%d): differ at %05x\n", sjis2utf(e1->name), page, i);
-	return true;
+	job->diffs[i] = j;
 }
 
 static int do_compare(int argc, char *argv[]) {
-	if (argc != 3) {
+	const char *hashfile = NULL;
+	int jobs = nr_cpus();
+	bool summary = false;
+	int opt;
+	while ((opt = getopt_long(argc, argv, compare_short_options, compare_long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'H':
+			hashfile = optarg;
+			break;
+		case 'j':
+			jobs = parse_jobs(optarg);
+			break;
+		case 's':
+			summary = true;
+			break;
+		default:
+			help_compare();
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (hashfile ? argc == 0 : argc != 2) {
 		help_compare();
 		return 1;
 	}
-	const char *aldfile1 = argv[1];
-	const char *aldfile2 = argv[2];
-	Vector *ald1 = ald_read(NULL, aldfile1);
-	Vector *ald2 = ald_read(NULL, aldfile2);
-
-	bool differs = false;
-	for (int i = 0; i < ald1->len && i < ald2->len; i++) {
-		if (ald1->data[i] && ald2->data[i]) {
-			differs |= compare_entry(i, ald1->data[i], ald2->data[i]);
-		} else if (ald1->data[i]) {
-			AldEntry *e = ald1->data[i];
-			printf("%s (%d) only exists in %s\n", sjis2utf(e->name), i, aldfile1);
-			differs = true;
-		} else if (ald2->data[i]) {
-			AldEntry *e = ald2->data[i];
-			printf("%s (%d) only exists in %s\n", sjis2utf(e->name), i, aldfile2);
-			differs = true;
-		}
-	}
 
-	for (int i = ald2->len; i < ald1->len; i++) {
-		AldEntry *e = ald1->data[i];
-		printf("%s (%d) only exists in %s\n", sjis2utf(e->name), i, aldfile1);
-		differs = true;
+	CompareJob job = { .ald2 = new_ald_archive() };
+	const char *name1, *name2;
+	if (hashfile) {
+		job.hashes = read_hash_list(hashfile);
+		for (int i = 0; i < argc; i++)
+			ald_add_volume(job.ald2, argv[i]);
+		name1 = hashfile;
+		name2 = argc == 1 ? argv[0] : "the archive";
+	} else {
+		job.ald1 = new_ald_archive();
+		ald_add_volume(job.ald1, argv[0]);
+		ald_add_volume(job.ald2, argv[1]);
+		name1 = argv[0];
+		name2 = argv[1];
+	}
+	int n1 = job.ald1 ? ald_count(job.ald1) : job.hashes->len;
+	int n = n1 > ald_count(job.ald2) ? n1 : ald_count(job.ald2);
+	job.diffs = calloc(n + 1, sizeof(int));
+	parallel_for(n, jobs, compare_contents, &job);
+
+	int identical = 0, changed = 0, added = 0, removed = 0;
+	int64_t identical_bytes = 0, changed_bytes1 = 0, changed_bytes2 = 0, added_bytes = 0, removed_bytes = 0;
+	for (int i = 0; i < n; i++) {
+		char buf1[256], buf2[256];
+		HashListEntry old = {0};
+		HashListEntry *e1 = NULL;
+		if (job.ald1) {
+			AldEntry *e = ald_get(job.ald1, i);
+			if (e) {
+				old.name = sjis2utf_buf(e->name, buf1, sizeof(buf1));
+				old.size = e->size;
+				e1 = &old;
+			}
+		} else if (i < job.hashes->len) {
+			e1 = job.hashes->data[i];
+		}
+		AldEntry *e2 = ald_get(job.ald2, i);
+		const char *e2_name = e2 ? sjis2utf_buf(e2->name, buf2, sizeof(buf2)) : NULL;
+
+		if (e1 && e2) {
+			if (strcasecmp(e1->name, e2_name)) {
+				printf("Entry %d: names differ, %s != %s\n", i, e1->name, e2_name);
+			} else if (job.diffs[i] < 0) {
+				identical++;
+				identical_bytes += e2->size;
+				continue;
+			} else if (job.ald1) {
+				printf("%s (%d): differ at %05x\n", e1->name, i, job.diffs[i]);
+			} else {
+				printf("%s (%d): differ\n", e1->name, i);
+			}
+			changed++;
+			changed_bytes1 += e1->size;
+			changed_bytes2 += e2->size;
+		} else if (e1) {
+			printf("%s (%d) only exists in %s\n", e1->name, i, name1);
+			removed++;
+			removed_bytes += e1->size;
+		} else if (e2) {
+			printf("%s (%d) only exists in %s\n", e2_name, i, name2);
+			added++;
+			added_bytes += e2->size;
+		}
 	}
-	for (int i = ald1->len; i < ald2->len; i++) {
-		AldEntry *e = ald2->data[i];
-		printf("%s (%d) only exists in %s\n", sjis2utf(e->name), i, aldfile2);
-		differs = true;
+	if (summary) {
+		printf("identical: %d entries (%" PRId64 " bytes)\n", identical, identical_bytes);
+		printf("changed:   %d entries (%" PRId64 " -> %" PRId64 " bytes)\n", changed, changed_bytes1, changed_bytes2);
+		printf("added:     %d entries (%" PRId64 " bytes)\n", added, added_bytes);
+		printf("removed:   %d entries (%" PRId64 " bytes)\n", removed, removed_bytes);
 	}
-	return differs ? 1 : 0;
+	free(job.diffs);
+	if (job.ald1)
+		ald_close(job.ald1);
+	ald_close(job.ald2);
+	return changed || added || removed ? 1 : 0;
 }
 
 // ald help ----------------------------------------
@@ -533,10 +856,12 @@ typedef struct {
 static Command commands[] = {
 	{"list",       do_list,       help_list},
 	{"create",     do_create,     help_create},
+	{"update",     do_update,     help_update},
 	{"extract",    do_extract,    help_extract},
 	{"dump",       do_dump,       help_dump},
 	{"dump-index", do_dump_index, help_dump_index},
 	{"compare",    do_compare,    help_compare},
+	{"hash",       do_hash,       help_hash},
 	{"help",       do_help,       help_help},
 	{"version",    do_version,    help_version},
 	{NULL, NULL, NULL}
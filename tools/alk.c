@@ -17,54 +17,33 @@
 */
 #include "common.h"
 #include <errno.h>
-#include <fcntl.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#ifdef _POSIX_MAPPED_FILES
-#include <sys/mman.h>
-#endif
-#ifndef _O_BINARY
-#define _O_BINARY 0
-#endif
 
 typedef struct {
 	const uint8_t *data;
 	int size;
 } AlkEntry;
 
-static Vector *alk_read(const char *path) {
-	int fd = checked_open(path, O_RDONLY | _O_BINARY);
+// The archive opened by alk_read(), kept open for zero-copy extraction.
+static const uint8_t *alk_base;
+static int alk_fd = -1;
 
-	struct stat sbuf;
-	if (fstat(fd, &sbuf) < 0)
-		error("%s: %s", path, strerror(errno));
-	if (sbuf.st_size < 8)
+static Vector *alk_read(const char *path) {
+	size_t size;
+	const uint8_t *p = map_file_fd(path, &size, &alk_fd);
+	alk_base = p;
+	if (size < 8)
 		error("%s: not an ALK file");
 
-#ifdef _POSIX_MAPPED_FILES
-	uint8_t *p = mmap(NULL, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
-	if (p == MAP_FAILED)
-		error("%s: %s", path, strerror(errno));
-#else
-	uint8_t *p = malloc(sbuf.st_size);
-	size_t bytes = 0;
-	while (bytes < sbuf.st_size) {
-		ssize_t ret = read(fd, p + bytes, sbuf.st_size - bytes);
-		if (ret <= 0)
-			error("%s: %s", path, strerror(errno));
-		bytes += ret;
-	}
-#endif
-	close(fd);
-
 	if (strncmp((char *)p, "ALK0", 4))
 		error("%s: invalid ALK signature", path);
 
 	uint32_t nfile = le32(p + 4);
-	if (sbuf.st_size < 8 + nfile * 8)
+	if (size < 8 + nfile * 8)
 		error("%s: not an ALK file");
 
 	AlkEntry *es = calloc(nfile, sizeof(AlkEntry));
@@ -72,7 +51,7 @@ static Vector *alk_read(const char *path) {
 	for (int i = 0; i < nfile; i++) {
 		uint32_t offset = le32(p + 8 + (i * 8));
 		uint32_t length = le32(p + 12 + (i * 8));
-		if (offset + length > sbuf.st_size)
+		if (offset + length > size)
 			error("%s: invalid ALK file");
 		es[i].data = p + offset;
 		es[i].size = length;
@@ -83,22 +62,23 @@ static Vector *alk_read(const char *path) {
 
 static void alk_write(Vector *entries, const char *path) {
 	FILE *fp = checked_fopen(path, "wb");
-	fputs("ALK0", fp);
-	fputdw(entries->len, fp);
+	ByteWriter *w = new_byte_writer(fp);
+	bw_bytes(w, "ALK0", 4);
+	bw_u32(w, entries->len);
 
 	uint32_t offset = 8 + 8 * entries->len;
 	for (int i = 0; i < entries->len; i++) {
 		AlkEntry *e = entries->data[i];
-		fputdw(offset, fp);
-		fputdw(e->size, fp);
+		bw_u32(w, offset);
+		bw_u32(w, e->size);
 		offset += e->size;
 	}
 
 	for (int i = 0; i < entries->len; i++) {
 		AlkEntry *e = entries->data[i];
-		if (e->size > 0 && fwrite(e->data, e->size, 1, fp) != 1)
-			error("%s: %s", path, strerror(errno));
+		bw_bytes(w, e->data, e->size);
 	}
+	free_byte_writer(w);
 	fclose(fp);
 }
 
@@ -191,9 +171,10 @@ static int do_create(int argc, char *argv[]) {
 
 // alk extract ----------------------------------------
 
-static const char extract_short_options[] = "d:";
+static const char extract_short_options[] = "d:j:";
 static const struct option extract_long_options[] = {
 	{ "directory", required_argument, NULL, 'd' },
+	{ "jobs",      required_argument, NULL, 'j' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -201,10 +182,21 @@ static void help_extract(void) {
 	puts("Usage: alk extract [options] <alkfile> [<index>...]");
 	puts("Options:");
 	puts("    -d, --directory <dir>    Extract files into <dir>");
+	puts("    -j, --jobs <n>           Extract <n> files at a time (default: 1)");
 }
 
-static void extract_entry(AlkEntry *e, int index, const char *directory) {
+typedef struct {
+	Vector *alk;
+	int *indices;  // 1-based
+	const char *directory;
+} ExtractJob;
+
+static void extract_entry(void *data, int i) {
+	ExtractJob *job = data;
+	int index = job->indices[i];
+	AlkEntry *e = job->alk->data[index - 1];
 	char fname[20];
+	char path[1024];
 	const char *type = guess_filetype(e);
 	if (type)
 		sprintf(fname, "%d.%s", index, type);
@@ -212,20 +204,25 @@ static void extract_entry(AlkEntry *e, int index, const char *directory) {
 		sprintf(fname, "%d", index);
 
 	puts(fname);
-	FILE *fp = checked_fopen(path_join(directory, fname), "wb");
-	if (e->size > 0 && fwrite(e->data, e->size, 1, fp) != 1)
-		error("%s: %s", fname, strerror(errno));
-	fclose(fp);
+	int fd = checked_create(path_join_buf(job->directory, fname, path, sizeof(path)));
+	write_fd(fd, e->data, e->size, alk_fd, e->data - alk_base);
+	close(fd);
 }
 
 static int do_extract(int argc, char *argv[]) {
 	const char *directory = NULL;
+	int jobs = 1;
 	int opt;
 	while ((opt = getopt_long(argc, argv, extract_short_options, extract_long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'd':
 			directory = optarg;
 			break;
+		case 'j':
+			jobs = atoi(optarg);
+			if (jobs < 1)
+				error("alk: invalid number of jobs: %s", optarg);
+			break;
 		default:
 			help_extract();
 			return 1;
@@ -243,14 +240,20 @@ static int do_extract(int argc, char *argv[]) {
 	if (directory && make_dir(directory) != 0 && errno != EEXIST)
 		error("cannot create directory %s: %s", directory, strerror(errno));
 
+	ExtractJob job = { .alk = alk, .directory = directory };
+	job.indices = calloc(argc == 1 ? alk->len : argc - 1, sizeof(int));
+	int n = 0;
 	if (argc == 1) {
 		// Extract all files.
 		for (int i = 0; i < alk->len; i++) {
 			AlkEntry *e = alk->data[i];
 			if (e->size > 0)
-				extract_entry(e, i + 1, directory);
+				job.indices[n++] = i + 1;
 		}
 	} else {
+		// Output names are unique per index, so skipping repeated indices
+		// keeps two threads from writing the same file.
+		bool *queued = calloc(alk->len + 1, sizeof(bool));
 		for (int i = 1; i < argc; i++) {
 			int idx = atoi(argv[i]);
 			if (idx <= 0 || idx > alk->len) {
@@ -262,9 +265,14 @@ static int do_extract(int argc, char *argv[]) {
 				fprintf(stderr, "alk: No entry for index %d\n", idx);
 				continue;
 			}
-			extract_entry(e, idx, directory);
+			if (!queued[idx])
+				job.indices[n++] = idx;
+			queued[idx] = true;
 		}
+		free(queued);
 	}
+	parallel_for(n, jobs, extract_entry, &job);
+	free(job.indices);
 	return 0;
 }
 
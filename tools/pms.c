@@ -21,7 +21,6 @@
 #include "common.h"
 #include "png_utils.h"
 #include <assert.h>
-#include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -91,22 +90,24 @@ static void version(void) {
 	puts("pms " VERSION);
 }
 
-static bool system2_pms_read_header(int first_word, struct pms_header *pms, FILE *fp) {
+static bool system2_pms_read_header(int first_word, struct pms_header *pms, ByteReader *r) {
 	int sx = first_word;
-	int sy = fgetw(fp);
-	int ex = fgetw(fp);
-	int ey = fgetw(fp);
+	int sy = br_u16(r);
+	int ex = br_u16(r);
+	int ey = br_u16(r);
 	if (sx >= 640 || sy >= 480 || ex >= 640 || ey >= 480 || sx > ex || sy > ey)
 		return false;
 
-	int flag = fgetw(fp);  // 256-color flag, but zero in Super DPS
+	int flag = br_u16(r);  // 256-color flag, but zero in Super DPS
 	if (flag > 1)
 		return false;
-	int palette_mask = fgetw(fp);
+	int palette_mask = br_u16(r);
 	for (int i = 12; i < 0x20; i++) {
-		if (fgetc(fp) != 0)
+		if (br_u8(r) != 0)
 			return false;
 	}
+	if (r->error)
+		return false;
 
 	memset(pms, 0, sizeof(struct pms_header));
 	pms->x            = sx;
@@ -120,99 +121,99 @@ static bool system2_pms_read_header(int first_word, struct pms_header *pms, FILE
 	return true;
 }
 
-static bool pms_read_header(struct pms_header *pms, FILE *fp) {
-	int head = fgetw(fp);
+static bool pms_read_header(struct pms_header *pms, ByteReader *r) {
+	int head = br_u16(r);
 	if (head != ('P' | 'M' << 8)) {
 		if (system2_pms)
-			return system2_pms_read_header(head, pms, fp);
+			return system2_pms_read_header(head, pms, r);
 		return false;
 	}
 
 	memset(pms, 0, sizeof(struct pms_header));
-	pms->version      = fgetw(fp);
-	pms->header_size  = fgetw(fp);
-	pms->bpp          = fgetc(fp);
-	pms->alpha_bpp    = fgetc(fp);
-	pms->trans_pal    = fgetc(fp);
-	pms->reserved1    = fgetc(fp);
-	pms->palette_mask = fgetw(fp);
-	pms->reserved2    = fgetdw(fp);
-	pms->x            = fgetdw(fp);
-	pms->y            = fgetdw(fp);
-	pms->width        = fgetdw(fp);
-	pms->height       = fgetdw(fp);
-	pms->data_off     = fgetdw(fp);
-	pms->auxdata_off  = fgetdw(fp);
-	pms->comment_off  = fgetdw(fp);
-	pms->reserved3    = fgetdw(fp);
+	pms->version      = br_u16(r);
+	pms->header_size  = br_u16(r);
+	pms->bpp          = br_u8(r);
+	pms->alpha_bpp    = br_u8(r);
+	pms->trans_pal    = br_u8(r);
+	pms->reserved1    = br_u8(r);
+	pms->palette_mask = br_u16(r);
+	pms->reserved2    = br_u32(r);
+	pms->x            = br_u32(r);
+	pms->y            = br_u32(r);
+	pms->width        = br_u32(r);
+	pms->height       = br_u32(r);
+	pms->data_off     = br_u32(r);
+	pms->auxdata_off  = br_u32(r);
+	pms->comment_off  = br_u32(r);
+	pms->reserved3    = br_u32(r);
 	if (pms->version >= 2) {
-		pms->timestamp = win_filetime_to_time_t(fget64(fp));
-		pms->reserved4 = fgetdw(fp);
-		pms->reserved5 = fgetdw(fp);
+		pms->timestamp = win_filetime_to_time_t(br_u64(r));
+		pms->reserved4 = br_u32(r);
+		pms->reserved5 = br_u32(r);
 	}
 	return true;
 }
 
-static void system2_pms_write_header(struct pms_header *pms, FILE *fp) {
-	fputw(pms->x, fp);
-	fputw(pms->y, fp);
-	fputw(pms->x + pms->width - 1, fp);
-	fputw(pms->y + pms->height - 1, fp);
-	fputw(1, fp); // 256-color flag
-	fputw(pms->palette_mask, fp);
+static void system2_pms_write_header(struct pms_header *pms, ByteWriter *w) {
+	bw_u16(w, pms->x);
+	bw_u16(w, pms->y);
+	bw_u16(w, pms->x + pms->width - 1);
+	bw_u16(w, pms->y + pms->height - 1);
+	bw_u16(w, 1); // 256-color flag
+	bw_u16(w, pms->palette_mask);
 	for (int i = 12; i < 0x20; i++)
-		fputc(0, fp);
+		bw_u8(w, 0);
 }
 
-static void pms_write_header(struct pms_header *pms, FILE *fp) {
+static void pms_write_header(struct pms_header *pms, ByteWriter *w) {
 	if (system2_pms) {
-		system2_pms_write_header(pms, fp);
+		system2_pms_write_header(pms, w);
 		return;
 	}
 
-	fputc('P', fp);
-	fputc('M', fp);
-	fputw(pms->version, fp);
-	fputw(pms->header_size, fp);
-	fputc(pms->bpp, fp);
-	fputc(pms->alpha_bpp, fp);
-	fputc(pms->trans_pal, fp);
-	fputc(pms->reserved1, fp);
-	fputw(pms->palette_mask, fp);
-	fputdw(pms->reserved2, fp);
-	fputdw(pms->x, fp);
-	fputdw(pms->y, fp);
-	fputdw(pms->width, fp);
-	fputdw(pms->height, fp);
-	fputdw(pms->data_off, fp);
-	fputdw(pms->auxdata_off, fp);
-	fputdw(pms->comment_off, fp);
-	fputdw(pms->reserved3, fp);
+	bw_u8(w, 'P');
+	bw_u8(w, 'M');
+	bw_u16(w, pms->version);
+	bw_u16(w, pms->header_size);
+	bw_u8(w, pms->bpp);
+	bw_u8(w, pms->alpha_bpp);
+	bw_u8(w, pms->trans_pal);
+	bw_u8(w, pms->reserved1);
+	bw_u16(w, pms->palette_mask);
+	bw_u32(w, pms->reserved2);
+	bw_u32(w, pms->x);
+	bw_u32(w, pms->y);
+	bw_u32(w, pms->width);
+	bw_u32(w, pms->height);
+	bw_u32(w, pms->data_off);
+	bw_u32(w, pms->auxdata_off);
+	bw_u32(w, pms->comment_off);
+	bw_u32(w, pms->reserved3);
 	if (pms->version >= 2) {
-		fput64(time_t_to_win_filetime(pms->timestamp), fp);
-		fputdw(pms->reserved4, fp);
-		fputdw(pms->reserved5, fp);
+		bw_u64(w, time_t_to_win_filetime(pms->timestamp));
+		bw_u32(w, pms->reserved4);
+		bw_u32(w, pms->reserved5);
 	}
 }
 
-static void pms_read_palette(png_color pal[256], FILE *fp) {
+static void pms_read_palette(png_color pal[256], ByteReader *r) {
 	for (int i = 0; i < 256; i++) {
-		pal[i].red   = fgetc(fp);
-		pal[i].green = fgetc(fp);
-		pal[i].blue  = fgetc(fp);
+		pal[i].red   = br_u8(r);
+		pal[i].green = br_u8(r);
+		pal[i].blue  = br_u8(r);
 	}
 }
 
-static void pms_write_palette(png_color pal[256], int n, FILE *fp) {
+static void pms_write_palette(png_color pal[256], int n, ByteWriter *w) {
 	for (int i = 0; i < n; i++) {
-		fputc(pal[i].red, fp);
-		fputc(pal[i].green, fp);
-		fputc(pal[i].blue, fp);
+		bw_u8(w, pal[i].red);
+		bw_u8(w, pal[i].green);
+		bw_u8(w, pal[i].blue);
 	}
 	for (int i = n; i < 256; i++) {
-		fputc(0, fp);
-		fputc(0, fp);
-		fputc(0, fp);
+		bw_u8(w, 0);
+		bw_u8(w, 0);
+		bw_u8(w, 0);
 	}
 }
 
@@ -221,7 +222,7 @@ static void pms_write_palette(png_color pal[256], int n, FILE *fp) {
  * Based on xsystem35 implementation, with commentary by Nunuhara [1].
  * [1] https://haniwa.technology/tech/pms8.html
  */
-static png_bytepp pms8_extract(FILE *fp, int width, int height) {
+static png_bytepp pms8_extract(ByteReader *r, int width, int height) {
 	png_bytepp rows = allocate_bitmap_buffer(width, height, 1);
 
 	// for each line...
@@ -229,9 +230,9 @@ static png_bytepp pms8_extract(FILE *fp, int width, int height) {
 		// for each pixel...
 		for (int x = 0; x < width; ) {
 			uint8_t *dst = rows[y] + x;
-			int c0 = fgetc(fp);
-			if (c0 == EOF)
+			if (br_eof(r))
 				goto err;
+			int c0 = br_u8(r);
 			// non-command byte: read 1 pixel into buffer
 			if (c0 <= 0xf7) {
 				*dst = c0;
@@ -239,7 +240,7 @@ static png_bytepp pms8_extract(FILE *fp, int width, int height) {
 			}
 			// copy n+3 pixels from previous line
 			else if (c0 == 0xff) {
-				int n = fgetc(fp) + 3;
+				int n = br_u8(r) + 3;
 				if (y < 1 || x + n > width)
 					goto err;
 				memcpy(dst, rows[y - 1] + x, n);
@@ -247,7 +248,7 @@ static png_bytepp pms8_extract(FILE *fp, int width, int height) {
 			}
 			// copy n+3 pixels from 2 lines previous
 			else if (c0 == 0xfe) {
-				int n = fgetc(fp) + 3;
+				int n = br_u8(r) + 3;
 				if (y < 2 || x + n > width)
 					goto err;
 				memcpy(dst, rows[y - 2] + x, n);
@@ -255,8 +256,8 @@ static png_bytepp pms8_extract(FILE *fp, int width, int height) {
 			}
 			// repeat 1 pixel n+4 times (1-byte RLE)
 			else if (c0 == 0xfd) {
-				int n = fgetc(fp) + 4;
-				int c0 = fgetc(fp);
+				int n = br_u8(r) + 4;
+				int c0 = br_u8(r);
 				if (x + n > width)
 					goto err;
 				memset(dst, c0, n);
@@ -264,9 +265,9 @@ static png_bytepp pms8_extract(FILE *fp, int width, int height) {
 			}
 			// repeat a sequence of 2 pixels n+3 times (2-byte RLE)
 			else if (c0 == 0xfc) {
-				int n = fgetc(fp) + 3;
-				int c0 = fgetc(fp);
-				int c1 = fgetc(fp);
+				int n = br_u8(r) + 3;
+				int c0 = br_u8(r);
+				int c1 = br_u8(r);
 				if (x + n * 2 > width)
 					goto err;
 				for (int i = 0; i < n; i++) {
@@ -277,7 +278,7 @@ static png_bytepp pms8_extract(FILE *fp, int width, int height) {
 			}
 			// escape: next byte is image data
 			else {
-				*dst = fgetc(fp);
+				*dst = br_u8(r);
 				x++;
 			}
 		}
@@ -289,7 +290,7 @@ static png_bytepp pms8_extract(FILE *fp, int width, int height) {
 	return NULL;
 }
 
-static void pms8_encode(png_bytepp rows, int width, int height, FILE *fp) {
+static void pms8_encode(png_bytepp rows, int width, int height, ByteWriter *w) {
 	// for each line...
 	for (int y = 0; y < height; y ++) {
 		// for each pixel...
@@ -362,7 +363,7 @@ static void pms8_encode(png_bytepp rows, int width, int height, FILE *fp) {
 			}
 
 			// write the encoded data
-			fwrite(code, codelen, 1, fp);
+			bw_bytes(w, code, codelen);
 			x += rawlen;
 		}
 	}
@@ -381,7 +382,7 @@ static uint32_t RGB565to888(uint16_t pc) {
 /*
  * Convert PMS16 image to RGB888 bitmap. Based on xsystem35 implementation.
  */
-static png_bytepp pms16_extract(FILE *fp, int width, int height) {
+static png_bytepp pms16_extract(ByteReader *r, int width, int height) {
 	png_bytepp rows = allocate_bitmap_buffer(width, height, 4);
 
 	// for each line...
@@ -389,18 +390,18 @@ static png_bytepp pms16_extract(FILE *fp, int width, int height) {
 		// for each pixel...
 		for (int x = 0; x < width;) {
 			uint32_t *dst = (uint32_t *)rows[y] + x;
-			int c0 = fgetc(fp);
-			if (c0 == EOF)
+			if (br_eof(r))
 				goto err;
+			int c0 = br_u8(r);
 			// non-command byte: read 1 pixel into buffer
 			if (c0 <= 0xf7) {
-				int c1 = fgetc(fp);
+				int c1 = br_u8(r);
 				*dst = RGB565to888(c0 | (c1 << 8));
 				x++;
 			}
 			// copy n+2 pixels from previous line
 			else if (c0 == 0xff) {
-				int n = fgetc(fp) + 2;
+				int n = br_u8(r) + 2;
 				if (y < 1 || x + n > width)
 					goto err;
 				memcpy(dst, (uint32_t *)rows[y - 1] + x, n * 4);
@@ -408,7 +409,7 @@ static png_bytepp pms16_extract(FILE *fp, int width, int height) {
 			}
 			// copy n+2 pixels from 2 lines previous
 			else if (c0 == 0xfe) {
-				int n = fgetc(fp) + 2;
+				int n = br_u8(r) + 2;
 				if (y < 2 || x + n > width)
 					goto err;
 				memcpy(dst, (uint32_t *)rows[y - 2] + x, n * 4);
@@ -416,8 +417,8 @@ static png_bytepp pms16_extract(FILE *fp, int width, int height) {
 			}
 			// repeat 1 pixel n+3 times (2-byte RLE)
 			else if (c0 == 0xfd) {
-				int n = fgetc(fp) + 3;
-				uint32_t pc = RGB565to888(fgetw(fp));
+				int n = br_u8(r) + 3;
+				uint32_t pc = RGB565to888(br_u16(r));
 				if (x + n > width)
 					goto err;
 				for (int i = 0; i < n; i++)
@@ -426,9 +427,9 @@ static png_bytepp pms16_extract(FILE *fp, int width, int height) {
 			}
 			// repeat a sequence of 2 pixels n+2 times (4-byte RLE)
 			else if (c0 == 0xfc) {
-				int n = fgetc(fp) + 2;
-				uint32_t pc0 = RGB565to888(fgetw(fp));
-				uint32_t pc1 = RGB565to888(fgetw(fp));
+				int n = br_u8(r) + 2;
+				uint32_t pc0 = RGB565to888(br_u16(r));
+				uint32_t pc1 = RGB565to888(br_u16(r));
 				if (x + n * 2 > width)
 					goto err;
 				for (int i = 0; i < n; i++) {
@@ -453,13 +454,13 @@ static png_bytepp pms16_extract(FILE *fp, int width, int height) {
 			}
 			// use common upper 3-2-3 bits of RGB565 in the next n+1 pixels
 			else if (c0 == 0xf9) {
-				int n = fgetc(fp) + 1;
-				int c0 = fgetc(fp); // read the upper RGB323
+				int n = br_u8(r) + 1;
+				int c0 = br_u8(r); // read the upper RGB323
 				int pc0 = ((c0 & 0xe0) << 8) + ((c0 & 0x18) << 6) + ((c0 & 0x07) << 2);
 				if (x + n > width)
 					goto err;
 				for (int i = 0; i < n; i++) {
-					int c1 = fgetc(fp); // read a lower RGB242
+					int c1 = br_u8(r); // read a lower RGB242
 					int pc1 = ((c1 & 0xc0) << 5) + ((c1 & 0x3c) << 3) + (c1 & 0x03);
 					dst[i] = RGB565to888(pc0 | pc1);
 				}
@@ -467,7 +468,7 @@ static png_bytepp pms16_extract(FILE *fp, int width, int height) {
 			}
 			// escape: next 2 bytes are image data
 			else {
-				*dst = RGB565to888(fgetw(fp));
+				*dst = RGB565to888(br_u16(r));
 				x++;
 			}
 		}
@@ -498,7 +499,7 @@ static void convert_rgba8888_to_alpha(png_bytepp src_rows, png_bytepp dst_rows,
 }
 
 // Write a run of raw pixel data, using the 0xf9 command when possible
-static void write_raw_pixel_run(uint16_t *pixels, int len, FILE *fp) {
+static void write_raw_pixel_run(uint16_t *pixels, int len, ByteWriter *w) {
 	while (len > 0) {
 		const int mask = 0xe61c;
 		int upper = pixels[0] & mask;
@@ -507,12 +508,12 @@ static void write_raw_pixel_run(uint16_t *pixels, int len, FILE *fp) {
 			n++;
 		if (n > 2) {
 			// use common upper 3-2-3 bits of RGB565 in the next n+1 pixels
-			fputc(0xf9, fp);
-			fputc(n - 1, fp);
-			fputc((upper & 0xe000) >> 8 | (upper & 0x600) >> 6 | (upper & 0x1c) >> 2, fp);
+			bw_u8(w, 0xf9);
+			bw_u8(w, n - 1);
+			bw_u8(w, (upper & 0xe000) >> 8 | (upper & 0x600) >> 6 | (upper & 0x1c) >> 2);
 			for (int i = 0; i < n; i++) {
 				int c = pixels[i];
-				fputc((c & 0x1800) >> 5 | (c & 0x1e0) >> 3 | (c & 0x3), fp);
+				bw_u8(w, (c & 0x1800) >> 5 | (c & 0x1e0) >> 3 | (c & 0x3));
 			}
 			pixels += n;
 			len -= n;
@@ -520,14 +521,14 @@ static void write_raw_pixel_run(uint16_t *pixels, int len, FILE *fp) {
 			// 1-pixel raw data
 			// if the first byte is >= 0xf8, prepend 0xf8 to distinguish it from commands
 			if ((*pixels & 0xff) >= 0xf8)
-				fputc(0xf8, fp);
-			fputw(*pixels++, fp);
+				bw_u8(w, 0xf8);
+			bw_u16(w, *pixels++);
 			len--;
 		}
 	}
 }
 
-static void pms16_encode(png_bytepp rgb8888_rows, int width, int height, FILE *fp) {
+static void pms16_encode(png_bytepp rgb8888_rows, int width, int height, ByteWriter *w) {
 	png_bytepp rows = allocate_bitmap_buffer(width, height, 2);
 	convert_rgba8888_to_rgb565(rgb8888_rows, rows, width, height);
 
@@ -626,29 +627,27 @@ static void pms16_encode(png_bytepp rgb8888_rows, int width, int height, FILE *f
 				x++;
 			} else {
 				// flush the pending raw pixel data
-				write_raw_pixel_run(&row[x - raw_pixel_run_length], raw_pixel_run_length, fp);
+				write_raw_pixel_run(&row[x - raw_pixel_run_length], raw_pixel_run_length, w);
 				raw_pixel_run_length = 0;
 
 				// write the encoded data
-				fwrite(code, codelen, 1, fp);
+				bw_bytes(w, code, codelen);
 				x += rawlen;
 			}
 		}
-		write_raw_pixel_run(&row[width - raw_pixel_run_length], raw_pixel_run_length, fp);
+		write_raw_pixel_run(&row[width - raw_pixel_run_length], raw_pixel_run_length, w);
 	}
 
 	free_bitmap_buffer(rows);
 }
 
-static void pms8_to_png(struct pms_header *pms, FILE *fp, const char *pms_path, const char *png_path) {
+static void pms8_to_png(struct pms_header *pms, ByteReader *r, const char *pms_path, const char *png_path) {
 	png_color pal[256];
-	if (fseek(fp, pms->auxdata_off, SEEK_SET) < 0)
-		error("%s: %s", pms_path, strerror(errno));
-	pms_read_palette(pal, fp);
+	br_seek(r, pms->auxdata_off);
+	pms_read_palette(pal, r);
 
-	if (fseek(fp, pms->data_off, SEEK_SET) < 0)
-		error("%s: %s", pms_path, strerror(errno));
-	png_bytepp rows = pms8_extract(fp, pms->width, pms->height);
+	br_seek(r, pms->data_off);
+	png_bytepp rows = pms8_extract(r, pms->width, pms->height);
 	if (!rows) {
 		fprintf(stderr, "%s: broken image\n", pms_path);
 		return;
@@ -687,19 +686,17 @@ static void pms8_to_png(struct pms_header *pms, FILE *fp, const char *pms_path,
 	free_bitmap_buffer(rows);
 }
 
-static void pms16_to_png(struct pms_header *pms, FILE *fp, const char *pms_path, const char *png_path) {
-	if (fseek(fp, pms->data_off, SEEK_SET) < 0)
-		error("%s: %s", pms_path, strerror(errno));
-	png_bytepp rows = pms16_extract(fp, pms->width, pms->height);
+static void pms16_to_png(struct pms_header *pms, ByteReader *r, const char *pms_path, const char *png_path) {
+	br_seek(r, pms->data_off);
+	png_bytepp rows = pms16_extract(r, pms->width, pms->height);
 	if (!rows) {
 		fprintf(stderr, "%s: broken image\n", pms_path);
 		return;
 	}
 
 	if (pms->auxdata_off) {
-		if (fseek(fp, pms->auxdata_off, SEEK_SET) < 0)
-			error("%s: %s", pms_path, strerror(errno));
-		png_bytepp alpha_rows = pms8_extract(fp, pms->width, pms->height);
+		br_seek(r, pms->auxdata_off);
+		png_bytepp alpha_rows = pms8_extract(r, pms->width, pms->height);
 		if (!alpha_rows) {
 			fprintf(stderr, "%s: broken alpha image\n", pms_path);
 			free_bitmap_buffer(rows);
@@ -740,27 +737,30 @@ static void pms16_to_png(struct pms_header *pms, FILE *fp, const char *pms_path,
 }
 
 static void pms_to_png(const char *pms_path, const char *png_path) {
-	FILE *fp = checked_fopen(pms_path, "rb");
+	size_t size;
+	const uint8_t *data = map_file(pms_path, &size);
+	ByteReader r;
+	br_init(&r, data, size);
 
 	struct pms_header pms;
-	if (!pms_read_header(&pms, fp)) {
+	if (!pms_read_header(&pms, &r)) {
 		fprintf(stderr, "%s: not a PMS file\n", pms_path);
-		fclose(fp);
+		unmap_file(data, size);
 		return;
 	}
 
 	switch (pms.bpp) {
 	case 8:
-		pms8_to_png(&pms, fp, pms_path, png_path);
+		pms8_to_png(&pms, &r, pms_path, png_path);
 		break;
 	case 16:
-		pms16_to_png(&pms, fp, pms_path, png_path);
+		pms16_to_png(&pms, &r, pms_path, png_path);
 		break;
 	default:
 		fprintf(stderr, "%s: invalid bpp %d", pms_path, pms.bpp);
 		break;
 	}
-	fclose(fp);
+	unmap_file(data, size);
 }
 
 static void png_to_pms8(PngReader *r, const char *png_path, const char *pms_path,
@@ -811,9 +811,11 @@ static void png_to_pms8(PngReader *r, const char *png_path, const char *pms_path
 	png_read_end(r->png, r->info);
 
 	FILE *fp = checked_fopen(pms_path, "wb");
-	pms_write_header(&pms, fp);
-	pms_write_palette(palette, num_palette, fp);
-	pms8_encode(rows, pms.width, pms.height, fp);
+	ByteWriter *w = new_byte_writer(fp);
+	pms_write_header(&pms, w);
+	pms_write_palette(palette, num_palette, w);
+	pms8_encode(rows, pms.width, pms.height, w);
+	free_byte_writer(w);
 	fclose(fp);
 
 	free_bitmap_buffer(rows);
@@ -873,22 +875,27 @@ static void png_to_pms16(PngReader *r, const char *png_path, const char *pms_pat
 	png_read_end(r->png, r->info);
 
 	FILE *fp = checked_fopen(pms_path, "wb");
-	pms_write_header(&pms, fp);
+	ByteWriter *w = new_byte_writer(fp);
+	pms_write_header(&pms, w);
 
-	pms16_encode(rows, pms.width, pms.height, fp);
+	pms16_encode(rows, pms.width, pms.height, w);
 
 	if (color_type == PNG_COLOR_TYPE_RGBA) {
-		pms.auxdata_off = ftell(fp);
+		pms.auxdata_off = bw_tell(w);
 
 		png_bytepp alpha_rows = allocate_bitmap_buffer(pms.width, pms.height, 1);
 		convert_rgba8888_to_alpha(rows, alpha_rows, pms.width, pms.height);
-		pms8_encode(alpha_rows, pms.width, pms.height, fp);
+		pms8_encode(alpha_rows, pms.width, pms.height, w);
 		free_bitmap_buffer(alpha_rows);
 
-		fseek(fp, 0, SEEK_SET);
-		pms_write_header(&pms, fp);  // Update the auxdata_off field
+		// Update the auxdata_off field
+		ByteWriter *header = new_byte_writer(NULL);
+		pms_write_header(&pms, header);
+		bw_patch(w, 0, header->buf, header->len);
+		free_byte_writer(header);
 	}
 
+	free_byte_writer(w);
 	fclose(fp);
 
 	free_bitmap_buffer(rows);
@@ -921,13 +928,16 @@ static void png_to_pms(const char *png_path, const char *pms_path,
 
 static void pms_info(const char *path) {
 	struct pms_header pms;
-	FILE *fp = checked_fopen(path, "rb");
-	if (!pms_read_header(&pms, fp)) {
+	size_t size;
+	const uint8_t *data = map_file(path, &size);
+	ByteReader r;
+	br_init(&r, data, size);
+	bool ok = pms_read_header(&pms, &r);
+	unmap_file(data, size);
+	if (!ok) {
 		fprintf(stderr, "%s: not a PMS file\n", path);
-		fclose(fp);
 		return;
 	}
-	fclose(fp);
 
 	printf("%s: PMS %d, %dx%d %dbpp", path, pms.version, pms.width, pms.height, pms.bpp);
 	if (pms.bpp == 16 && pms.auxdata_off)
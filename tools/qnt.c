@@ -21,7 +21,6 @@
 #include "common.h"
 #include "png_utils.h"
 #include <assert.h>
-#include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -69,70 +68,61 @@ static void version(void) {
 	puts("qnt " VERSION);
 }
 
-static bool read_and_uncompress(FILE *fp, uint32_t compressed_size,
+static bool read_and_uncompress(ByteReader *r, uint32_t compressed_size,
 								uint8_t *raw, unsigned long raw_size,
 								unsigned long minimum_size) {
-	uint8_t *compressed = malloc(compressed_size);
+	const uint8_t *compressed = br_bytes(r, compressed_size);
 	if (!compressed)
-		return NULL;
-	if (fread(compressed, compressed_size, 1, fp) != 1)
-		goto err;
+		return false;
 	unsigned long uncompressed_size = raw_size;
 	if (uncompress(raw, &uncompressed_size, compressed, compressed_size) != Z_OK)
-		goto err;
-	if (uncompressed_size < minimum_size)
-		goto err;
-	free(compressed);
-	return true;
-
- err:
-	free(compressed);
-	return false;
+		return false;
+	return uncompressed_size >= minimum_size;
 }
 
-static bool qnt_read_header(struct qnt_header *qnt, FILE *fp) {
-	if (fgetc(fp) != 'Q' || fgetc(fp) != 'N' || fgetc(fp) != 'T' || fgetc(fp) != 0)
+static bool qnt_read_header(struct qnt_header *qnt, ByteReader *r) {
+	if (br_u8(r) != 'Q' || br_u8(r) != 'N' || br_u8(r) != 'T' || br_u8(r) != 0)
 		return false;
 
-	qnt->version     = fgetdw(fp);
-	qnt->header_size = qnt->version ? fgetdw(fp) : 48;
-	qnt->x           = fgetdw(fp);
-	qnt->y           = fgetdw(fp);
-	qnt->width       = fgetdw(fp);
-	qnt->height      = fgetdw(fp);
-	qnt->bpp         = fgetdw(fp);
-	qnt->unknown     = fgetdw(fp);
-	qnt->pixel_size  = fgetdw(fp);
-	qnt->alpha_size  = fgetdw(fp);
+	qnt->version     = br_u32(r);
+	qnt->header_size = qnt->version ? br_u32(r) : 48;
+	qnt->x           = br_u32(r);
+	qnt->y           = br_u32(r);
+	qnt->width       = br_u32(r);
+	qnt->height      = br_u32(r);
+	qnt->bpp         = br_u32(r);
+	qnt->unknown     = br_u32(r);
+	qnt->pixel_size  = br_u32(r);
+	qnt->alpha_size  = br_u32(r);
 	return true;
 }
 
-static void qnt_write_header(struct qnt_header *qnt, FILE *fp) {
-	fputc('Q', fp);
-	fputc('N', fp);
-	fputc('T', fp);
-	fputc('\0', fp);
-	fputdw(qnt->version, fp);
-	fputdw(qnt->header_size, fp);
-	fputdw(qnt->x, fp);
-	fputdw(qnt->y, fp);
-	fputdw(qnt->width, fp);
-	fputdw(qnt->height, fp);
-	fputdw(qnt->bpp, fp);
-	fputdw(qnt->unknown, fp);
-	fputdw(qnt->pixel_size, fp);
-	fputdw(qnt->alpha_size, fp);
+static void qnt_write_header(struct qnt_header *qnt, ByteWriter *w) {
+	bw_u8(w, 'Q');
+	bw_u8(w, 'N');
+	bw_u8(w, 'T');
+	bw_u8(w, '\0');
+	bw_u32(w, qnt->version);
+	bw_u32(w, qnt->header_size);
+	bw_u32(w, qnt->x);
+	bw_u32(w, qnt->y);
+	bw_u32(w, qnt->width);
+	bw_u32(w, qnt->height);
+	bw_u32(w, qnt->bpp);
+	bw_u32(w, qnt->unknown);
+	bw_u32(w, qnt->pixel_size);
+	bw_u32(w, qnt->alpha_size);
 	for (int i = 44; i < qnt->header_size; i++)
-		fputc(0, fp);
+		bw_u8(w, 0);
 }
 
-static png_bytepp extract_pixels(struct qnt_header *qnt, FILE *fp) {
+static png_bytepp extract_pixels(struct qnt_header *qnt, ByteReader *r) {
 	int width = (qnt->width + 1) & ~1;
 	int height = (qnt->height + 1) & ~1;
 
 	const int bufsize = width * height * 3;
 	uint8_t *raw = malloc(bufsize);
-	if (!raw || !read_and_uncompress(fp, qnt->pixel_size, raw, bufsize, bufsize))
+	if (!raw || !read_and_uncompress(r, qnt->pixel_size, raw, bufsize, bufsize))
 		return NULL;
 
 	png_bytepp rows = allocate_bitmap_buffer(width, height, 4);
@@ -184,7 +174,7 @@ static uint8_t *encode_pixels(struct qnt_header *qnt, png_bytepp rows) {
 	return compressed;
 }
 
-static png_bytepp extract_alpha(struct qnt_header *qnt, FILE *fp) {
+static png_bytepp extract_alpha(struct qnt_header *qnt, ByteReader *r) {
 	int width = (qnt->width + 1) & ~1;
 	int height = (qnt->height + 1) & ~1;
 
@@ -193,7 +183,7 @@ static png_bytepp extract_alpha(struct qnt_header *qnt, FILE *fp) {
 	// ALDExplorer pads alpha data to even width, but not even height.
 	const unsigned long padded_size = width * height;
 	const unsigned long required_size = width * qnt->height;
-	if (!read_and_uncompress(fp, qnt->alpha_size, rows[0], padded_size, required_size))
+	if (!read_and_uncompress(r, qnt->alpha_size, rows[0], padded_size, required_size))
 		return NULL;
 
 	return rows;
@@ -265,31 +255,33 @@ static void filter(png_bytepp rows, int width, int height, int channels) {
 }
 
 static void qnt_to_png(const char *qnt_path, const char *png_path) {
-	FILE *fp = checked_fopen(qnt_path, "rb");
+	size_t size;
+	const uint8_t *data = map_file(qnt_path, &size);
+	ByteReader r;
+	br_init(&r, data, size);
 
 	struct qnt_header qnt;
-	if (!qnt_read_header(&qnt, fp)) {
+	if (!qnt_read_header(&qnt, &r)) {
 		fprintf(stderr, "%s: not a QNT file\n", qnt_path);
-		fclose(fp);
+		unmap_file(data, size);
 		return;
 	}
-	if (fseek(fp, qnt.header_size, SEEK_SET) < 0)
-		error("%s: %s", qnt_path, strerror(errno));
+	br_seek(&r, qnt.header_size);
 
 	png_bytepp rows = NULL;
 	if (qnt.pixel_size) {
-		rows = extract_pixels(&qnt, fp);
+		rows = extract_pixels(&qnt, &r);
 		if (!rows) {
 			fprintf(stderr, "%s: broken image\n", qnt_path);
-			fclose(fp);
+			unmap_file(data, size);
 			return;
 		}
 	}
 	if (qnt.alpha_size) {
-		png_bytepp alpha_rows = extract_alpha(&qnt, fp);
+		png_bytepp alpha_rows = extract_alpha(&qnt, &r);
 		if (!alpha_rows) {
 			fprintf(stderr, "%s: broken alpha image\n", qnt_path);
-			fclose(fp);
+			unmap_file(data, size);
 			free_bitmap_buffer(rows);
 			return;
 		}
@@ -300,7 +292,7 @@ static void qnt_to_png(const char *qnt_path, const char *png_path) {
 			rows = alpha_rows;
 		}
 	}
-	fclose(fp);
+	unmap_file(data, size);
 
 	if (!rows) {
 		fprintf(stderr, "%s: no pixel nor alpha data\n", qnt_path);
@@ -399,15 +391,17 @@ static void png_to_qnt(const char *png_path, const char *qnt_path, const ImageOf
 	}
 
 	FILE *fp = checked_fopen(qnt_path, "wb");
-	qnt_write_header(&qnt, fp);
+	ByteWriter *w = new_byte_writer(fp);
+	qnt_write_header(&qnt, w);
 	if (pixel_data) {
-		fwrite(pixel_data, qnt.pixel_size, 1, fp);
+		bw_bytes(w, pixel_data, qnt.pixel_size);
 		free(pixel_data);
 	}
 	if (alpha_data) {
-		fwrite(alpha_data, qnt.alpha_size, 1, fp);
+		bw_bytes(w, alpha_data, qnt.alpha_size);
 		free(alpha_data);
 	}
+	free_byte_writer(w);
 	fclose(fp);
 
 	destroy_png_reader(r);
@@ -416,13 +410,16 @@ static void png_to_qnt(const char *png_path, const char *qnt_path, const ImageOf
 
 static void qnt_info(const char *path) {
 	struct qnt_header qnt;
-	FILE *fp = checked_fopen(path, "rb");
-	if (!qnt_read_header(&qnt, fp)) {
+	size_t size;
+	const uint8_t *data = map_file(path, &size);
+	ByteReader r;
+	br_init(&r, data, size);
+	bool ok = qnt_read_header(&qnt, &r);
+	unmap_file(data, size);
+	if (!ok) {
 		fprintf(stderr, "%s: not a QNT file\n", path);
-		fclose(fp);
 		return;
 	}
-	fclose(fp);
 
 	printf("%s: QNT %d, %dx%d", path, qnt.version, qnt.width, qnt.height);
 	if (qnt.pixel_size) {
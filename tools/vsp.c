@@ -21,7 +21,6 @@
 #include "common.h"
 #include "png_utils.h"
 #include <assert.h>
-#include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -70,13 +69,13 @@ static void version(void) {
 	puts("vsp " VERSION);
 }
 
-static bool vsp_read_header(struct vsp_header *vsp, FILE *fp) {
-	vsp->x = fgetw(fp);
-	vsp->y = fgetw(fp);
-	vsp->width = fgetw(fp) - vsp->x;
-	vsp->height = fgetw(fp) - vsp->y;
-	vsp->reserved = fgetc(fp);
-	vsp->bank = fgetc(fp);
+static bool vsp_read_header(struct vsp_header *vsp, ByteReader *r) {
+	vsp->x = br_u16(r);
+	vsp->y = br_u16(r);
+	vsp->width = br_u16(r) - vsp->x;
+	vsp->height = br_u16(r) - vsp->y;
+	vsp->reserved = br_u8(r);
+	vsp->bank = br_u8(r);
 
 	// 401 for dalk's broken CG
 	if (vsp->x > 80 || vsp->y > 400 || vsp->width > 80 || vsp->height > 401 || vsp->bank > 15)
@@ -84,33 +83,33 @@ static bool vsp_read_header(struct vsp_header *vsp, FILE *fp) {
 	return true;
 }
 
-static void vsp_write_header(struct vsp_header *vsp, FILE *fp) {
-	fputw(vsp->x, fp);
-	fputw(vsp->y, fp);
-	fputw(vsp->x + vsp->width, fp);
-	fputw(vsp->y + vsp->height, fp);
-	fputc(vsp->reserved, fp);
-	fputc(vsp->bank, fp);
+static void vsp_write_header(struct vsp_header *vsp, ByteWriter *w) {
+	bw_u16(w, vsp->x);
+	bw_u16(w, vsp->y);
+	bw_u16(w, vsp->x + vsp->width);
+	bw_u16(w, vsp->y + vsp->height);
+	bw_u8(w, vsp->reserved);
+	bw_u8(w, vsp->bank);
 }
 
-static void vsp_read_palette(png_color pal[16], FILE *fp) {
+static void vsp_read_palette(png_color pal[16], ByteReader *r) {
 	for (int i = 0; i < 16; i++) {
-		pal[i].blue  = fgetc(fp) * 17;
-		pal[i].red   = fgetc(fp) * 17;
-		pal[i].green = fgetc(fp) * 17;
+		pal[i].blue  = br_u8(r) * 17;
+		pal[i].red   = br_u8(r) * 17;
+		pal[i].green = br_u8(r) * 17;
 	}
 }
 
-static void vsp_write_palette(png_color pal[16], int n, FILE *fp) {
+static void vsp_write_palette(png_color pal[16], int n, ByteWriter *w) {
 	for (int i = 0; i < n; i++) {
-		fputc(pal[i].blue  >> 4, fp);
-		fputc(pal[i].red   >> 4, fp);
-		fputc(pal[i].green >> 4, fp);
+		bw_u8(w, pal[i].blue  >> 4);
+		bw_u8(w, pal[i].red   >> 4);
+		bw_u8(w, pal[i].green >> 4);
 	}
 	for (int i = n; i < 16; i++) {
-		fputc(0, fp);
-		fputc(0, fp);
-		fputc(0, fp);
+		bw_u8(w, 0);
+		bw_u8(w, 0);
+		bw_u8(w, 0);
 	}
 }
 
@@ -119,7 +118,7 @@ static void vsp_write_palette(png_color pal[16], int n, FILE *fp) {
  * Based on xsystem35 implementation, with commentary by Nunuhara [1].
  * [1] https://haniwa.technology/tech/vsp.html
  */
-static png_bytepp vsp_extract(FILE *fp, int width, int height) {
+static png_bytepp vsp_extract(ByteReader *r, int width, int height) {
 	png_bytepp rows = allocate_bitmap_buffer(width * 8, height, 1);
 
 	// Extraction buffers. The planar image data is decompressed and read into
@@ -144,9 +143,9 @@ static png_bytepp vsp_extract(FILE *fp, int width, int height) {
 			for (int y = 0; y < height;) {
 				// read a byte; if it's < 0x08, it's a command byte,
 				// otherwise it's image data
-				int c0 = fgetc(fp);
-				if (c0 == EOF)
+				if (br_eof(r))
 					error("unexpected EOF");
+				int c0 = br_u8(r);
 				// copy byte into buffer
 				if (c0 >= 0x08) {
 					bc[pl][y] = c0;
@@ -155,7 +154,7 @@ static png_bytepp vsp_extract(FILE *fp, int width, int height) {
 				// copy n bytes from previous buffer to current buffer
 				// (compression for horizontal repetition)
 				else if (c0 == 0x00) {
-					int n = fgetc(fp) + 1;
+					int n = br_u8(r) + 1;
 					if (y + n > height)
 						goto err;
 					memcpy(bc[pl] + y, bp[pl] + y, n);
@@ -163,8 +162,8 @@ static png_bytepp vsp_extract(FILE *fp, int width, int height) {
 				}
 				// b0 * n (1-byte RLE compression)
 				else if (c0 == 0x01) {
-					int n = fgetc(fp) + 1;
-					uint8_t b0 = fgetc(fp);
+					int n = br_u8(r) + 1;
+					uint8_t b0 = br_u8(r);
 					if (y + n > height)
 						goto err;
 					memset(bc[pl] + y, b0, n);
@@ -172,9 +171,9 @@ static png_bytepp vsp_extract(FILE *fp, int width, int height) {
 				}
 				// b0,b1 * n (2-byte RLE compression)
 				else if (c0 == 0x02) {
-					int n = fgetc(fp) + 1;
-					uint8_t b0 = fgetc(fp);
-					uint8_t b1 = fgetc(fp);
+					int n = br_u8(r) + 1;
+					uint8_t b0 = br_u8(r);
+					uint8_t b1 = br_u8(r);
 					if (y + n * 2 > height)
 						goto err;
 					for (int i = 0; i < n; i++) {
@@ -184,7 +183,7 @@ static png_bytepp vsp_extract(FILE *fp, int width, int height) {
 				}
 				// copy n bytes from plane 0 XOR'd by the current mask
 				else if (c0 == 0x03) {
-					int n = fgetc(fp) + 1;
+					int n = br_u8(r) + 1;
 					if (y + n > height)
 						goto err;
 					for (int i = 0; i < n; i++) {
@@ -195,7 +194,7 @@ static png_bytepp vsp_extract(FILE *fp, int width, int height) {
 				}
 				// copy n bytes from plane 1 XOR'd by the current mask
 				else if (c0 == 0x04) {
-					int n = fgetc(fp) + 1;
+					int n = br_u8(r) + 1;
 					if (y + n > height)
 						goto err;
 					for (int i = 0; i < n; i++) {
@@ -206,7 +205,7 @@ static png_bytepp vsp_extract(FILE *fp, int width, int height) {
 				}
 				// copy n bytes from plane 2 XOR'd by the current mask
 				else if (c0 == 0x05) {
-					int n = fgetc(fp) + 1;
+					int n = br_u8(r) + 1;
 					if (y + n > height)
 						goto err;
 					for (int i = 0; i < n; i++) {
@@ -221,7 +220,7 @@ static png_bytepp vsp_extract(FILE *fp, int width, int height) {
 				}
 				// escape: next byte is image data
 				else if (c0 == 0x07) {
-					bc[pl][y] = fgetc(fp);
+					bc[pl][y] = br_u8(r);
 					y++;
 				}
 			}
@@ -258,7 +257,7 @@ static png_bytepp vsp_extract(FILE *fp, int width, int height) {
 	return NULL;
 }
 
-static void vsp_encode(png_bytepp rows, int width, int height, FILE *fp) {
+static void vsp_encode(png_bytepp rows, int width, int height, ByteWriter *w) {
 	uint8_t *bc[4]; // the current buffer
 	uint8_t *bp[4]; // the previous buffer
 	for (int i = 0; i < 4; i++) {
@@ -365,7 +364,7 @@ static void vsp_encode(png_bytepp rows, int width, int height, FILE *fp) {
 				}
 
 				// write the encoded data
-				fwrite(code, codelen, 1, fp);
+				bw_bytes(w, code, codelen);
 				y += rawlen;
 			}
 		}
@@ -379,20 +378,23 @@ static void vsp_encode(png_bytepp rows, int width, int height, FILE *fp) {
 }
 
 static void vsp_to_png(const char *vsp_path, const char *png_path) {
-	FILE *fp = checked_fopen(vsp_path, "rb");
+	size_t size;
+	const uint8_t *data = map_file(vsp_path, &size);
+	ByteReader r;
+	br_init(&r, data, size);
 
 	struct vsp_header vsp;
-	if (!vsp_read_header(&vsp, fp)) {
+	if (!vsp_read_header(&vsp, &r)) {
 		fprintf(stderr, "%s: not a VSP file\n", vsp_path);
-		fclose(fp);
+		unmap_file(data, size);
 		return;
 	}
 
 	png_color pal[16];
-	vsp_read_palette(pal, fp);
+	vsp_read_palette(pal, &r);
 
-	png_bytepp rows = vsp_extract(fp, vsp.width, vsp.height);
-	fclose(fp);
+	png_bytepp rows = vsp_extract(&r, vsp.width, vsp.height);
+	unmap_file(data, size);
 	if (!rows) {
 		fprintf(stderr, "%s: broken image\n", vsp_path);
 		return;
@@ -473,9 +475,11 @@ static void png_to_vsp(const char *png_path, const char *vsp_path,
 	}
 
 	FILE *fp = checked_fopen(vsp_path, "wb");
-	vsp_write_header(&vsp, fp);
-	vsp_write_palette(palette, num_palette, fp);
-	vsp_encode(png_get_rows(r->png, r->info), vsp.width, vsp.height, fp);
+	ByteWriter *w = new_byte_writer(fp);
+	vsp_write_header(&vsp, w);
+	vsp_write_palette(palette, num_palette, w);
+	vsp_encode(png_get_rows(r->png, r->info), vsp.width, vsp.height, w);
+	free_byte_writer(w);
 	fclose(fp);
 
 	destroy_png_reader(r);
@@ -483,13 +487,16 @@ static void png_to_vsp(const char *png_path, const char *vsp_path,
 
 static void vsp_info(const char *path) {
 	struct vsp_header vsp;
-	FILE *fp = checked_fopen(path, "rb");
-	if (!vsp_read_header(&vsp, fp)) {
+	size_t size;
+	const uint8_t *data = map_file(path, &size);
+	ByteReader r;
+	br_init(&r, data, size);
+	bool ok = vsp_read_header(&vsp, &r);
+	unmap_file(data, size);
+	if (!ok) {
 		fprintf(stderr, "%s: not a VSP file\n", path);
-		fclose(fp);
 		return;
 	}
-	fclose(fp);
 
 	printf("%s: %dx%d", path, vsp.width * 8, vsp.height);
 	if (vsp.x || vsp.y)